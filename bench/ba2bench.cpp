@@ -0,0 +1,359 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2generator.h"
+#include "ba2archive.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace BA2;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+struct BenchSettings {
+  BenchSettings()
+    : types({ TYPE_GENERAL, TYPE_DX10 })
+    , threads(std::max(1u, std::thread::hardware_concurrency()))
+    , repeat(5)
+    , lookups(10000)
+    , extract(true)
+    , keep(false)
+    , csv(false)
+  {
+    generator.entries = 10000;
+  }
+
+  GeneratorSettings generator;
+  std::vector<EType> types;
+  unsigned int threads;
+  int repeat;
+  BSAULong lookups;
+  bool extract;
+  bool keep;
+  bool csv;
+  fs::path workDirectory;
+};
+
+
+void usage()
+{
+  printf("usage: ba2tk_bench [options]\n"
+         "  --type gnrl|dx10|both        archive types to benchmark (both)\n"
+         "  --entries N                  number of entries (10000)\n"
+         "  --distribution fixed|uniform|lognormal\n"
+         "                               entry size distribution (lognormal)\n"
+         "  --min-size N                 fixed size, lower bound or median (16384)\n"
+         "  --max-size N                 upper bound of entry sizes (4194304)\n"
+         "  --compressibility X          0.0 (random) to 1.0 (repetitive) (0.5)\n"
+         "  --chunks MIN-MAX             chunks per texture (1-4)\n"
+         "  --level N                    zlib level of the generated archives (1)\n"
+         "  --seed N                     seed of the generator (1)\n"
+         "  --threads N                  worker threads for the parallel extraction (all cores)\n"
+         "  --repeat N                   runs per benchmark, the median is reported (5)\n"
+         "  --lookups N                  number of single entry lookups (10000)\n"
+         "  --workdir DIR                directory for generated archives and output\n"
+         "  --no-extract                 skip the extraction benchmarks\n"
+         "  --keep                       don't delete generated files\n"
+         "  --csv                        print results as csv\n");
+}
+
+
+bool parseArguments(int argc, char **argv, BenchSettings &settings)
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "missing value for %s\n", arg.c_str());
+        exit(1);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--type") {
+      std::string type = value();
+      if (type == "gnrl") settings.types = { TYPE_GENERAL };
+      else if (type == "dx10") settings.types = { TYPE_DX10 };
+      else if (type == "both") settings.types = { TYPE_GENERAL, TYPE_DX10 };
+      else return false;
+    }
+    else if (arg == "--entries") settings.generator.entries = strtoul(value(), nullptr, 10);
+    else if (arg == "--distribution") {
+      std::string distribution = value();
+      if (distribution == "fixed") settings.generator.distribution = SIZE_FIXED;
+      else if (distribution == "uniform") settings.generator.distribution = SIZE_UNIFORM;
+      else if (distribution == "lognormal") settings.generator.distribution = SIZE_LOGNORMAL;
+      else return false;
+    }
+    else if (arg == "--min-size") settings.generator.minSize = strtoul(value(), nullptr, 10);
+    else if (arg == "--max-size") settings.generator.maxSize = strtoul(value(), nullptr, 10);
+    else if (arg == "--compressibility") settings.generator.compressibility = atof(value());
+    else if (arg == "--chunks") {
+      unsigned int minChunks, maxChunks;
+      if (sscanf(value(), "%u-%u", &minChunks, &maxChunks) != 2) {
+        return false;
+      }
+      settings.generator.minChunks = minChunks;
+      settings.generator.maxChunks = maxChunks;
+    }
+    else if (arg == "--level") settings.generator.compressionLevel = atoi(value());
+    else if (arg == "--seed") settings.generator.seed = strtoull(value(), nullptr, 10);
+    else if (arg == "--threads") settings.threads = std::max(1, atoi(value()));
+    else if (arg == "--repeat") settings.repeat = std::max(1, atoi(value()));
+    else if (arg == "--lookups") settings.lookups = strtoul(value(), nullptr, 10);
+    else if (arg == "--workdir") settings.workDirectory = value();
+    else if (arg == "--no-extract") settings.extract = false;
+    else if (arg == "--keep") settings.keep = true;
+    else if (arg == "--csv") settings.csv = true;
+    else return false;
+  }
+  return true;
+}
+
+
+double median(std::vector<double> values)
+{
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+
+// run a benchmark repeatedly, returns the median duration in seconds
+double measure(int repeat, const std::function<void()> &setup, const std::function<void()> &run)
+{
+  std::vector<double> durations;
+  for (int i = 0; i < repeat; ++i) {
+    if (setup) {
+      setup();
+    }
+    auto start = std::chrono::steady_clock::now();
+    run();
+    durations.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  return median(durations);
+}
+
+
+class Report {
+public:
+  explicit Report(bool csv) : m_CSV(csv) {
+    if (m_CSV) {
+      printf("archive,benchmark,seconds,value,unit\n");
+    }
+    else {
+      printf("%-6s %-28s %12s %14s\n", "type", "benchmark", "median ms", "value");
+    }
+  }
+
+  void add(const char *type, const std::string &name, double seconds,
+           double value = 0.0, const char *unit = "") {
+    if (m_CSV) {
+      printf("%s,%s,%.6f,%.3f,%s\n", type, name.c_str(), seconds, value, unit);
+    }
+    else if (*unit != '\0') {
+      printf("%-6s %-28s %12.3f %10.1f %s\n", type, name.c_str(), seconds * 1000.0, value, unit);
+    }
+    else {
+      printf("%-6s %-28s %12.3f\n", type, name.c_str(), seconds * 1000.0);
+    }
+    fflush(stdout);
+  }
+
+private:
+  bool m_CSV;
+};
+
+
+bool benchmark(EType type, const BenchSettings &settings, Report &report)
+{
+  const char *typeName = type == TYPE_GENERAL ? "gnrl" : "dx10";
+  GeneratorSettings generator = settings.generator;
+  generator.type = type;
+
+  fs::path archivePath = settings.workDirectory / (std::string("bench_") + typeName + ".ba2");
+  fs::path outputPath = settings.workDirectory / (std::string("output_") + typeName);
+
+  std::string errorMessage;
+  auto start = std::chrono::steady_clock::now();
+  if (!generateArchive(archivePath.string().c_str(), generator, errorMessage)) {
+    fprintf(stderr, "%s\n", errorMessage.c_str());
+    return false;
+  }
+  double generateTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double archiveMB = fs::file_size(archivePath) / (1024.0 * 1024.0);
+  report.add(typeName, "generate", generateTime, archiveMB, "MB");
+
+  Statistics openStatistics;
+  double openTime = measure(settings.repeat, nullptr, [&]() {
+    Archive archive;
+    archive.setCollectStatistics(true);
+    if (archive.read(archivePath.string().c_str()) != ERROR_NONE) {
+      fprintf(stderr, "failed to open archive: %s\n", archive.getLastError().c_str());
+      exit(1);
+    }
+    openStatistics = archive.getOpenStatistics();
+  });
+  report.add(typeName, "open", openTime, static_cast<double>(openStatistics.readCalls), "reads");
+
+  Archive archive;
+  archive.read(archivePath.string().c_str());
+
+  double listTime = measure(settings.repeat, nullptr, [&]() {
+    std::vector<std::string> files = archive.getFileList();
+    if (files.size() != archive.getFileCount()) {
+      exit(1);
+    }
+  });
+  report.add(typeName, "getFileList", listTime);
+
+  std::vector<std::string> files = archive.getFileList();
+  std::vector<std::string> queries;
+  uint64_t state = generator.seed;
+  for (BSAULong i = 0; i < settings.lookups && !files.empty(); ++i) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    queries.push_back(files[(state >> 33) % files.size()]);
+  }
+
+  if (!queries.empty()) {
+    double lookupTime = measure(settings.repeat, nullptr, [&]() {
+      BSAULong index;
+      for (const std::string &query : queries) {
+        if (!archive.findFile(query, index)) {
+          exit(1);
+        }
+      }
+    });
+    report.add(typeName, "findFile", lookupTime,
+               lookupTime * 1e6 / queries.size(), "us/lookup");
+
+    double readTime = measure(settings.repeat, nullptr, [&]() {
+      Archive::DataBuffer buffer;
+      for (const std::string &query : queries) {
+        if (archive.readFile(query, buffer) != ERROR_NONE) {
+          exit(1);
+        }
+      }
+    });
+    report.add(typeName, "readFile", readTime,
+               readTime * 1e6 / queries.size(), "us/entry");
+
+    // the same lookups again, served from a warm cache
+    archive.setCacheCapacity(BSAHash(1) << 30);
+    double cachedTime = measure(settings.repeat + 1, nullptr, [&]() {
+      Archive::DataBuffer buffer;
+      for (const std::string &query : queries) {
+        if (archive.readFile(query, buffer) != ERROR_NONE) {
+          exit(1);
+        }
+      }
+    });
+    CacheStatistics cacheStatistics = archive.getCacheStatistics();
+    archive.setCacheCapacity(0);
+    report.add(typeName, "readFile cached", cachedTime,
+               cachedTime * 1e6 / queries.size(), "us/entry");
+    report.add(typeName, "cache hit rate", 0.0,
+               100.0 * cacheStatistics.hits / std::max<BSAHash>(1, cacheStatistics.hits + cacheStatistics.misses), "%");
+  }
+
+  if (!files.empty()) {
+    std::vector<BSAULong> indices(files.size());
+    for (BSAULong i = 0; i < indices.size(); ++i) {
+      indices[i] = i;
+    }
+    double peekTime = measure(settings.repeat, nullptr, [&]() {
+      std::vector<Archive::DataBuffer> buffers;
+      if (archive.peekFiles(indices, 256, buffers, settings.threads) != ERROR_NONE) {
+        exit(1);
+      }
+    });
+    report.add(typeName, "peekFiles 256 bytes", peekTime,
+               peekTime * 1e6 / indices.size(), "us/entry");
+  }
+
+  if (settings.extract) {
+    std::vector<unsigned int> threadCounts = { 1 };
+    if (settings.threads > 1) {
+      threadCounts.push_back(settings.threads);
+    }
+    for (unsigned int threads : threadCounts) {
+      Statistics statistics;
+      ExtractOptions options;
+      options.threads = threads;
+      options.statistics = &statistics;
+      double extractTime = measure(settings.repeat, [&]() {
+        fs::remove_all(outputPath);
+        fs::create_directories(outputPath);
+      }, [&]() {
+        if (archive.extractAll(outputPath.string().c_str(), options) != ERROR_NONE) {
+          fprintf(stderr, "extraction failed\n");
+          exit(1);
+        }
+      });
+      double megabytes = statistics.bytesWritten / (1024.0 * 1024.0);
+      report.add(typeName, "extractAll " + std::to_string(threads) + " thread(s)",
+                 extractTime, megabytes / extractTime, "MB/s");
+    }
+    fs::remove_all(outputPath);
+  }
+
+  if (!settings.keep) {
+    archive.close();
+    fs::remove(archivePath);
+  }
+  return true;
+}
+
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+  BenchSettings settings;
+  if (!parseArguments(argc, argv, settings)) {
+    usage();
+    return 1;
+  }
+
+  bool temporary = settings.workDirectory.empty();
+  if (temporary) {
+    settings.workDirectory = fs::temp_directory_path() / "ba2tk_bench";
+  }
+  fs::create_directories(settings.workDirectory);
+
+  Report report(settings.csv);
+  bool success = true;
+  for (EType type : settings.types) {
+    success = benchmark(type, settings, report) && success;
+  }
+
+  if (temporary && !settings.keep) {
+    fs::remove_all(settings.workDirectory);
+  }
+  return success ? 0 : 1;
+}
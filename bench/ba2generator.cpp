@@ -0,0 +1,417 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2generator.h"
+#include "dds.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <zlib.h>
+
+
+namespace BA2 {
+
+GeneratorSettings::GeneratorSettings()
+  : type(TYPE_GENERAL)
+  , entries(1000)
+  , distribution(SIZE_LOGNORMAL)
+  , minSize(16 * 1024)
+  , maxSize(4 * 1024 * 1024)
+  , compressibility(0.5)
+  , minChunks(1)
+  , maxChunks(4)
+  , compressionLevel(1)
+  , seed(1)
+{
+}
+
+
+namespace {
+
+// splitmix64, small and fast with good enough statistical properties for test data
+class Random {
+public:
+  explicit Random(uint64_t seed) : m_State(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (m_State += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // uniform in [min, max]
+  BSAULong range(BSAULong min, BSAULong max) {
+    if (max <= min) {
+      return min;
+    }
+    return min + static_cast<BSAULong>(next() % (static_cast<uint64_t>(max - min) + 1));
+  }
+
+  // uniform in [0, 1)
+  double real() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  double normal() {
+    double u1 = std::max(real(), 1e-12);
+    double u2 = real();
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+  }
+
+private:
+  uint64_t m_State;
+};
+
+
+// produces data with adjustable redundancy: words from a small dictionary
+// interspersed with random bytes
+class ContentGenerator {
+public:
+  ContentGenerator(Random &random, double compressibility)
+    : m_Random(random)
+    , m_Compressibility(compressibility)
+  {
+    for (int i = 0; i < 64; ++i) {
+      std::string word;
+      BSAULong length = m_Random.range(4, 16);
+      for (BSAULong j = 0; j < length; ++j) {
+        word.push_back(static_cast<char>('a' + m_Random.range(0, 25)));
+      }
+      m_Dictionary.push_back(word);
+    }
+  }
+
+  void fill(BSAUChar *buffer, size_t size) {
+    size_t pos = 0;
+    while (pos < size) {
+      if (m_Random.real() < m_Compressibility) {
+        const std::string &word = m_Dictionary[m_Random.next() % m_Dictionary.size()];
+        size_t count = std::min(word.size(), size - pos);
+        memcpy(buffer + pos, word.data(), count);
+        pos += count;
+      }
+      else {
+        uint64_t value = m_Random.next();
+        size_t count = std::min(sizeof(value), size - pos);
+        memcpy(buffer + pos, &value, count);
+        pos += count;
+      }
+    }
+  }
+
+private:
+  Random &m_Random;
+  double m_Compressibility;
+  std::vector<std::string> m_Dictionary;
+};
+
+
+template <typename T> void append(std::vector<char> &buffer, const T &value)
+{
+  const char *begin = reinterpret_cast<const char*>(&value);
+  buffer.insert(buffer.end(), begin, begin + sizeof(T));
+}
+
+
+BSAULong hashString(const std::string &value)
+{
+  std::string lower(value);
+  std::transform(lower.begin(), lower.end(), lower.begin(), [](char ch) {
+    return static_cast<char>(::tolower(static_cast<unsigned char>(ch)));
+  });
+  return static_cast<BSAULong>(crc32(0, reinterpret_cast<const Bytef*>(lower.data()),
+                                     static_cast<uInt>(lower.size())));
+}
+
+
+struct NameInfo {
+  std::string path;
+  BSAULong nameHash;
+  BSAULong dirHash;
+  char ext[4];
+};
+
+
+NameInfo makeName(BSAULong index, const char *root, const char *extension)
+{
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "%s\\bench\\d%04u", root, index / 256);
+  std::string directory(buffer);
+  snprintf(buffer, sizeof(buffer), "file%07u", index);
+  std::string stem(buffer);
+
+  NameInfo result;
+  result.path = directory + "\\" + stem + "." + extension;
+  result.nameHash = hashString(stem);
+  result.dirHash = hashString(directory);
+  // the field isn't null terminated, a four letter extension fills it
+  memset(result.ext, 0, sizeof(result.ext));
+  memcpy(result.ext, extension, std::min(strlen(extension), sizeof(result.ext)));
+  return result;
+}
+
+
+BSAULong entrySize(Random &random, const GeneratorSettings &settings)
+{
+  switch (settings.distribution) {
+    case SIZE_FIXED: return settings.minSize;
+    case SIZE_UNIFORM: return random.range(settings.minSize, settings.maxSize);
+    default: {
+      double value = std::exp(std::log(std::max<double>(settings.minSize, 1.0)) + random.normal());
+      return static_cast<BSAULong>(std::min<double>(std::max(value, 1.0), settings.maxSize));
+    }
+  }
+}
+
+
+// keeps one deflate state for all entries, compress2 would allocate it for every call
+class Compressor {
+public:
+  explicit Compressor(int level) {
+    memset(&m_Stream, 0, sizeof(m_Stream));
+    m_Initialized = deflateInit(&m_Stream, level) == Z_OK;
+  }
+
+  ~Compressor() {
+    if (m_Initialized) {
+      deflateEnd(&m_Stream);
+    }
+  }
+
+  // compress data, returns 0 if the data should be stored uncompressed
+  BSAULong compress(const std::vector<BSAUChar> &data, std::vector<BSAUChar> &output) {
+    if (!m_Initialized || (deflateReset(&m_Stream) != Z_OK)) {
+      return 0;
+    }
+    output.resize(deflateBound(&m_Stream, static_cast<uLong>(data.size())));
+    m_Stream.next_in = const_cast<Bytef*>(data.data());
+    m_Stream.avail_in = static_cast<uInt>(data.size());
+    m_Stream.next_out = output.data();
+    m_Stream.avail_out = static_cast<uInt>(output.size());
+    if ((deflate(&m_Stream, Z_FINISH) != Z_STREAM_END) || (m_Stream.total_out >= data.size())) {
+      return 0;
+    }
+    return static_cast<BSAULong>(m_Stream.total_out);
+  }
+
+private:
+  z_stream m_Stream;
+  bool m_Initialized;
+};
+
+
+struct Texture {
+  BSAUChar format;
+  BSAUShort width;
+  BSAUShort height;
+  BSAUChar numMips;
+  // first mip of each chunk, plus one past the last
+  std::vector<BSAUShort> chunkMips;
+  std::vector<BSAULong> mipSizes;
+};
+
+
+Texture makeTexture(Random &random, const GeneratorSettings &settings, BSAULong index)
+{
+  static const BSAUChar formats[] = {
+    DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_B8G8R8A8_UNORM
+  };
+  static const double bytesPerPixel[] = { 0.5, 1.0, 4.0 };
+
+  Texture result;
+  int formatIndex = index % 3;
+  result.format = formats[formatIndex];
+
+  // the mip chain adds about a third to the size of the top level
+  double pixels = entrySize(random, settings) * 0.75 / bytesPerPixel[formatIndex];
+  int level = std::max(2, std::min(13, static_cast<int>(std::log2(std::max(pixels, 1.0)) / 2.0)));
+  result.width = static_cast<BSAUShort>(1 << level);
+  result.height = result.width;
+  result.numMips = static_cast<BSAUChar>(level + 1);
+
+  for (BSAULong mip = 0; mip < result.numMips; ++mip) {
+    BSAULong width = std::max(1, result.width >> mip);
+    BSAULong height = std::max(1, result.height >> mip);
+    if (result.format == DXGI_FORMAT_B8G8R8A8_UNORM) {
+      result.mipSizes.push_back(width * height * 4);
+    }
+    else {
+      BSAULong blockSize = result.format == DXGI_FORMAT_BC1_UNORM ? 8 : 16;
+      result.mipSizes.push_back(std::max<BSAULong>(1, (width + 3) / 4)
+                                * std::max<BSAULong>(1, (height + 3) / 4) * blockSize);
+    }
+  }
+
+  // like the official tools, the largest mips get a chunk each and the rest share the last one
+  BSAULong numChunks = std::max<BSAULong>(1, std::min<BSAULong>(
+    random.range(settings.minChunks, settings.maxChunks), result.numMips));
+  for (BSAULong chunk = 0; chunk < numChunks; ++chunk) {
+    result.chunkMips.push_back(static_cast<BSAUShort>(chunk));
+  }
+  result.chunkMips.push_back(result.numMips);
+  return result;
+}
+
+} // namespace
+
+
+bool generateArchive(const char *fileName, const GeneratorSettings &settings,
+                     std::string &errorMessage)
+{
+  std::fstream file;
+  file.open(fileName, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+  if (!file.is_open()) {
+    errorMessage = std::string("failed to open ") + fileName;
+    return false;
+  }
+
+  Random random(settings.seed);
+  ContentGenerator content(random, settings.compressibility);
+
+  std::vector<NameInfo> names;
+  names.reserve(settings.entries);
+  std::vector<Texture> textures;
+
+  BSAHash indexSize;
+  if (settings.type == TYPE_GENERAL) {
+    static const char *extensions[] = { "nif", "hkx", "wav", "txt" };
+    for (BSAULong i = 0; i < settings.entries; ++i) {
+      names.push_back(makeName(i, "meshes", extensions[i % 4]));
+    }
+    indexSize = static_cast<BSAHash>(settings.entries) * 36;
+  }
+  else {
+    indexSize = 0;
+    for (BSAULong i = 0; i < settings.entries; ++i) {
+      names.push_back(makeName(i, "textures", "dds"));
+      textures.push_back(makeTexture(random, settings, i));
+      indexSize += 24 + 24 * (textures.back().chunkMips.size() - 1);
+    }
+  }
+
+  // the index is written once all payload offsets are known
+  BSAHash dataOffset = 24 + indexSize;
+  std::vector<char> index;
+  index.reserve(static_cast<size_t>(indexSize));
+  file.seekp(dataOffset);
+
+  std::vector<BSAUChar> data;
+  std::vector<BSAUChar> packed;
+  Compressor compressor(settings.compressionLevel);
+
+  auto writePayload = [&](BSAULong &packedLen) -> BSAHash {
+    BSAHash offset = dataOffset;
+    packedLen = compressor.compress(data, packed);
+    if (packedLen != 0) {
+      file.write(reinterpret_cast<const char*>(packed.data()), packedLen);
+      dataOffset += packedLen;
+    }
+    else {
+      file.write(reinterpret_cast<const char*>(data.data()), data.size());
+      dataOffset += data.size();
+    }
+    return offset;
+  };
+
+  for (BSAULong i = 0; i < settings.entries; ++i) {
+    const NameInfo &name = names[i];
+    if (settings.type == TYPE_GENERAL) {
+      data.resize(entrySize(random, settings));
+      content.fill(data.data(), data.size());
+
+      BSAULong packedLen;
+      BSAHash offset = writePayload(packedLen);
+
+      append<BSAULong>(index, name.nameHash);
+      index.insert(index.end(), name.ext, name.ext + 4);
+      append<BSAULong>(index, name.dirHash);
+      append<BSAULong>(index, 0x00100100);
+      append<BSAHash>(index, offset);
+      append<BSAULong>(index, packedLen);
+      append<BSAULong>(index, static_cast<BSAULong>(data.size()));
+      append<BSAULong>(index, 0xBAADF00D);
+    }
+    else {
+      const Texture &texture = textures[i];
+      BSAUChar numChunks = static_cast<BSAUChar>(texture.chunkMips.size() - 1);
+      append<BSAULong>(index, name.nameHash);
+      index.insert(index.end(), name.ext, name.ext + 4);
+      append<BSAULong>(index, name.dirHash);
+      append<BSAUChar>(index, 0);
+      append<BSAUChar>(index, numChunks);
+      append<BSAUShort>(index, 24);
+      append<BSAUShort>(index, texture.height);
+      append<BSAUShort>(index, texture.width);
+      append<BSAUChar>(index, texture.numMips);
+      append<BSAUChar>(index, texture.format);
+      append<BSAUShort>(index, 0x0800);
+
+      for (BSAUChar chunk = 0; chunk < numChunks; ++chunk) {
+        BSAUShort startMip = texture.chunkMips[chunk];
+        BSAUShort endMip = static_cast<BSAUShort>(texture.chunkMips[chunk + 1] - 1);
+        BSAULong size = 0;
+        for (BSAUShort mip = startMip; mip <= endMip; ++mip) {
+          size += texture.mipSizes[mip];
+        }
+        data.resize(size);
+        content.fill(data.data(), data.size());
+
+        BSAULong packedLen;
+        BSAHash offset = writePayload(packedLen);
+
+        append<BSAHash>(index, offset);
+        append<BSAULong>(index, packedLen);
+        append<BSAULong>(index, size);
+        append<BSAUShort>(index, startMip);
+        append<BSAUShort>(index, endMip);
+        append<BSAULong>(index, 0xBAADF00D);
+      }
+    }
+  }
+
+  BSAHash nameTableOffset = dataOffset;
+  for (const NameInfo &name : names) {
+    BSAUShort length = static_cast<BSAUShort>(name.path.size());
+    file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    file.write(name.path.data(), length);
+  }
+
+  std::vector<char> header;
+  header.insert(header.end(), { 'B', 'T', 'D', 'X' });
+  append<BSAULong>(header, 1);
+  const char *typeID = settings.type == TYPE_GENERAL ? "GNRL" : "DX10";
+  header.insert(header.end(), typeID, typeID + 4);
+  append<BSAULong>(header, settings.entries);
+  append<BSAHash>(header, nameTableOffset);
+
+  file.seekp(0);
+  file.write(header.data(), header.size());
+  file.write(index.data(), index.size());
+
+  if (file.fail()) {
+    errorMessage = std::string("failed to write ") + fileName;
+    return false;
+  }
+  return true;
+}
+
+} // namespace BA2
@@ -0,0 +1,75 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_GENERATOR_H
+#define BA2_GENERATOR_H
+
+
+#include "ba2type.h"
+#include "ba2types.h"
+#include <string>
+
+
+namespace BA2 {
+
+  enum ESizeDistribution {
+    SIZE_FIXED,
+    SIZE_UNIFORM,
+    SIZE_LOGNORMAL
+  };
+
+  /**
+   * @brief parameters of a synthetic archive. The same settings always produce
+   * the same archive, byte for byte
+   */
+  struct GeneratorSettings {
+    GeneratorSettings();
+
+    EType type;
+    /// number of files or textures
+    BSAULong entries;
+    /// how (unpacked) entry sizes are distributed
+    ESizeDistribution distribution;
+    /// entry size for SIZE_FIXED, lower bound for SIZE_UNIFORM, median for SIZE_LOGNORMAL
+    BSAULong minSize;
+    /// upper bound for SIZE_UNIFORM and SIZE_LOGNORMAL
+    BSAULong maxSize;
+    /// 0.0 produces random (incompressible) data, 1.0 highly repetitive data
+    double compressibility;
+    /// range of the number of chunks per texture, limited by the mip count
+    BSAULong minChunks;
+    BSAULong maxChunks;
+    /// zlib compression level used for the payloads
+    int compressionLevel;
+    uint64_t seed;
+  };
+
+  /**
+   * generate a synthetic archive
+   * @param fileName name of the file to write
+   * @param settings parameters of the archive
+   * @param errorMessage receives a description of the problem on failure
+   * @return true on success
+   */
+  bool generateArchive(const char *fileName, const GeneratorSettings &settings,
+                       std::string &errorMessage);
+
+} // namespace BA2
+
+#endif // BA2_GENERATOR_H
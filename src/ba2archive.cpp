@@ -1,5 +1,11 @@
 #include "ba2archive.h"
 #include "ba2exception.h"
+#include "ba2inflater.h"
+#include "ba2journal.h"
+#include "ba2pathkey.h"
+#include "ba2statistics.h"
+#include "ba2texturedecoder.h"
+#include "ba2trace.h"
 #ifdef _WIN32
 #include <Windows.h>
 #endif
@@ -12,26 +18,79 @@
 #include <queue>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <zlib.h>
 #include <sys/stat.h>
 
+#ifndef WIN32
+#define _stricmp strcasecmp
+#endif // WIN32
+
 using std::fstream;
 using namespace std::chrono_literals;
 
 
+// number of bytes read at once when opening an archive. This covers the header and,
+// for most archives, the complete file index
+static const size_t INITIAL_READ_SIZE = 64 * 1024;
+
+// when decompressing only the beginning of a block, compressed data is read in
+// pieces of at least this size
+static const size_t PEEK_INPUT_SIZE = 4096;
+
+// deflate can't compress better than about 1032:1. Entries claiming a larger
+// unpacked size are corrupt
+static const BSAULong MAX_COMPRESSION_RATIO = 1032;
+
+
 namespace BA2 {
 
+// accounts the memory of a temporary buffer with the statistics from construction
+// until the scope ends. Whoever grows the buffer accounts the added capacity
+class BufferMemoryScope {
+
+public:
+
+  BufferMemoryScope(StatisticsCollector *statistics, const std::vector<char> &buffer)
+    : m_Statistics(statistics)
+    , m_Buffer(buffer)
+  {
+    if (m_Statistics != nullptr) {
+      m_Statistics->addBufferMemory(m_Buffer.capacity());
+    }
+  }
+
+  ~BufferMemoryScope()
+  {
+    if (m_Statistics != nullptr) {
+      m_Statistics->addBufferMemory(-static_cast<int64_t>(m_Buffer.capacity()));
+    }
+  }
+
+  BufferMemoryScope(const BufferMemoryScope&) = delete;
+  BufferMemoryScope &operator=(const BufferMemoryScope&) = delete;
+
+private:
+
+  StatisticsCollector *m_Statistics;
+  const std::vector<char> &m_Buffer;
+
+};
+
+
 Archive::Archive()
   : m_Type(TYPE_GENERAL)
+  , m_Header()
+  , m_UseATIFourCC(false)
+  , m_CollectStatistics(false)
 {
 }
 
 
 Archive::~Archive()
 {
-  if (m_File.is_open()) {
-    m_File.close();
-  }
+  m_File.close();
 }
 
 
@@ -59,23 +118,26 @@ const char *Archive::typeToID(EType type)
 }
 
 
-Archive::Header Archive::readHeader(std::fstream &infile)
+Archive::Header Archive::readHeader(const std::vector<char> &buffer)
 {
   Header result;
 
-  char fileID[4];
-  infile.read(fileID, 4);
-  if (memcmp(fileID, "BTDX", 4) != 0) {
+  if (buffer.size() < sizeof(Header)) {
+    throw data_invalid_exception(makeString("file too small to be a ba2 (%u bytes)",
+                                            static_cast<unsigned int>(buffer.size())));
+  }
+  if (memcmp(&buffer[0], "BTDX", 4) != 0) {
     throw data_invalid_exception(makeString("not a ba2 file"));
   }
+  memcpy(result.fileIdentifier, &buffer[0], 4);
 
-  result.version          = readType<BSAULong>(infile);
+  memcpy(&result.version, &buffer[4], sizeof(BSAULong));
   char typeBuffer[5];
-  infile.read(typeBuffer, 4);
+  memcpy(typeBuffer, &buffer[8], 4);
   typeBuffer[4] = '\0';
   result.type          = typeFromID(typeBuffer);
-  result.fileCount        = readType<BSAULong>(infile);
-  result.offsetNameTable  = readType<BSAHash>(infile);
+  memcpy(&result.fileCount, &buffer[12], sizeof(BSAULong));
+  memcpy(&result.offsetNameTable, &buffer[16], sizeof(BSAHash));
 
   return result;
 }
@@ -83,76 +145,319 @@ Archive::Header Archive::readHeader(std::fstream &infile)
 
 EErrorCode Archive::read(const char *fileName)
 {
-  m_File.open(fileName, fstream::in | fstream::binary);
+  m_File.open(fileName);
   return read();
 }
 
 #ifdef _WIN32
 EErrorCode Archive::read(const wchar_t *fileName)
 {
-  m_File.open(fileName, fstream::in | fstream::binary);
+  m_File.open(fileName);
   return read();
 }
 #endif
 
+void Archive::readAll(const std::vector<std::string> &fileNames,
+                      std::vector<OpenedArchive> &results, unsigned int threads)
+{
+  results.clear();
+  results.resize(fileNames.size());
+
+  // biggest first, so a large archive started last doesn't hold up the end
+  std::vector<std::pair<BSAHash, size_t>> order;
+  for (size_t i = 0; i < fileNames.size(); ++i) {
+    std::error_code ec;
+    BSAHash size = std::filesystem::file_size(fileNames[i], ec);
+    order.push_back(std::make_pair(ec ? 0 : size, i));
+    results[i].fileName = fileNames[i];
+    results[i].error = ERROR_NONE;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const std::pair<BSAHash, size_t> &lhs, const std::pair<BSAHash, size_t> &rhs) {
+    return lhs.first > rhs.first;
+  });
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t position = next++; position < order.size(); position = next++) {
+      OpenedArchive &result = results[order[position].second];
+      std::unique_ptr<Archive> archive(new Archive());
+      result.error = archive->read(result.fileName.c_str());
+      if (result.error == ERROR_NONE) {
+        result.archive = std::move(archive);
+      }
+      else {
+        result.errorMessage = archive->getLastError();
+      }
+    }
+  };
+
+  // threads mostly wait for reads, more of them than cores keep the device queue filled
+  if (threads == 0) {
+    threads = std::max(8u, std::thread::hardware_concurrency() * 2);
+  }
+  unsigned int numThreads = static_cast<unsigned int>(
+    std::max<size_t>(1, std::min<size_t>(threads, order.size())));
+  std::vector<std::thread> workers;
+  for (unsigned int i = 1; i < numThreads; ++i) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (std::thread &thread : workers) {
+    thread.join();
+  }
+}
+
+
+EErrorCode Archive::readDirectory(const char *directory, std::vector<OpenedArchive> &results,
+                                  unsigned int threads)
+{
+  namespace fs = std::filesystem;
+  results.clear();
+
+  std::vector<std::string> fileNames;
+  std::error_code ec;
+  for (fs::directory_iterator iter(directory, ec), end; !ec && (iter != end); iter.increment(ec)) {
+    std::string extension = iter->path().extension().string();
+    if ((_stricmp(extension.c_str(), ".ba2") == 0) && iter->is_regular_file(ec)) {
+      fileNames.push_back(iter->path().string());
+    }
+  }
+  if (ec) {
+    return ERROR_FILENOTFOUND;
+  }
+  std::sort(fileNames.begin(), fileNames.end());
+
+  readAll(fileNames, results, threads);
+  return ERROR_NONE;
+}
+
+
 EErrorCode Archive::read() {
-  if (!m_File.is_open()) {
+  m_Files.clear();
+  m_TextureChunks.clear();
+  m_Chunks.clear();
+  m_TextureHeaders.clear();
+  m_TableNames.clear();
+  m_KeyLookup.clear();
+  m_TableKeys.clear();
+  m_LastError.clear();
+  m_OpenStatistics.reset();
+  m_Cache.clear();
+
+  if (!m_File.isOpen()) {
+    m_LastError = "failed to open file";
     return ERROR_FILENOTFOUND;
   }
-  m_File.exceptions(std::ios_base::badbit);
-  try {
-    try {
-      m_Header = readHeader(m_File);
-    } catch (const data_invalid_exception&) {
-      return ERROR_INVALIDDATA;
-    }
 
-    m_Type = m_Header.type;
+  StatisticsCollector *statistics = openStatistics();
 
-    if (m_Type == TYPE_GENERAL)
+  try {
     {
-      if (!readGeneral())
-        return ERROR_INVALIDDATA;
+      StatisticsTimer timer(statistics, PHASE_INDEX);
+
+      // the first read covers the header and, for most archives, the whole index.
+      // Everything is parsed from memory and validated against the file size before
+      // anything gets allocated based on values from the file
+      std::vector<char> buffer(static_cast<size_t>(
+        std::min<BSAHash>(m_File.size(), INITIAL_READ_SIZE)));
+      BufferMemoryScope bufferMemory(statistics, buffer);
+      if (!buffer.empty()) {
+        m_File.readAt(0, &buffer[0], buffer.size(), statistics);
+      }
+
+      m_Header = readHeader(buffer);
+
+      m_Type = m_Header.type;
+
+      if (m_Header.offsetNameTable > m_File.size()) {
+        throw data_invalid_exception(makeString("name table offset %llu is beyond the end of the file (%llu bytes)",
+                                                static_cast<unsigned long long>(m_Header.offsetNameTable),
+                                                static_cast<unsigned long long>(m_File.size())));
+      }
+
+      if (m_Type == TYPE_GENERAL)
+      {
+        if (!readGeneral(buffer))
+          return ERROR_INVALIDDATA;
+      }
+      else if (m_Type == TYPE_DX10)
+      {
+        if (!readDX10(buffer))
+          return ERROR_INVALIDDATA;
+      }
     }
-    else if (m_Type == TYPE_DX10)
+
     {
-      if (!readDX10())
+      StatisticsTimer timer(statistics, PHASE_NAMETABLE);
+      if (!readNametable())
         return ERROR_INVALIDDATA;
     }
 
-    if (!readNametable())
-      return ERROR_INVALIDDATA;
-
     return ERROR_NONE;
-  } catch (std::ios_base::failure&) {
+  } catch (const data_invalid_exception &e) {
+    m_LastError = e.what();
+    m_Header.fileCount = 0;
+    m_Files.clear();
+    m_TextureChunks.clear();
+    m_Chunks.clear();
+    m_TextureHeaders.clear();
+    m_TableNames.clear();
+    m_KeyLookup.clear();
+    m_TableKeys.clear();
     return ERROR_INVALIDDATA;
   }
 }
 
 
-bool Archive::readGeneral()
+void Archive::readIndexBuffer(std::vector<char> &buffer, BSAHash size) const
+{
+  size_t oldSize = buffer.size();
+  if (size <= oldSize) {
+    return;
+  }
+  size_t oldCapacity = buffer.capacity();
+  buffer.resize(static_cast<size_t>(size));
+  StatisticsCollector *statistics = openStatistics();
+  if (statistics != nullptr) {
+    statistics->addBufferMemory(buffer.capacity() - oldCapacity);
+  }
+  m_File.readAt(oldSize, &buffer[oldSize], buffer.size() - oldSize, statistics);
+}
+
+
+void Archive::checkBlock(BSAHash offset, BSAULong packedLen, BSAULong unpackedLen,
+                         BSAHash dataStart, const char *kind, BSAULong index) const
+{
+  BSAHash storedLen = packedLen != 0 ? packedLen : unpackedLen;
+  if ((offset < dataStart) || (offset > m_File.size())
+      || (storedLen > m_File.size() - offset)) {
+    throw data_invalid_exception(makeString("%s %u (offset %llu, %u bytes) is outside the data section",
+                                            kind, index, static_cast<unsigned long long>(offset),
+                                            static_cast<unsigned int>(storedLen)));
+  }
+  if ((packedLen != 0) && (unpackedLen / MAX_COMPRESSION_RATIO > packedLen)) {
+    throw data_invalid_exception(makeString("%s %u can't inflate from %u to %u bytes",
+                                            kind, index, packedLen, unpackedLen));
+  }
+}
+
+
+bool Archive::readGeneral(std::vector<char> &buffer)
 {
+  BSAHash indexEnd = sizeof(Header) + static_cast<BSAHash>(sizeof(FileEntry)) * m_Header.fileCount;
+  if (indexEnd > m_File.size()) {
+    throw data_invalid_exception(makeString("file table with %u entries exceeds the file size (%llu bytes)",
+                                            m_Header.fileCount,
+                                            static_cast<unsigned long long>(m_File.size())));
+  }
+  if ((m_Header.offsetNameTable != 0) && (m_Header.offsetNameTable < indexEnd)) {
+    throw data_invalid_exception(makeString("name table offset %llu overlaps the file table",
+                                            static_cast<unsigned long long>(m_Header.offsetNameTable)));
+  }
+
+  readIndexBuffer(buffer, indexEnd);
+
   m_Files.resize(m_Header.fileCount);
   if (m_Header.fileCount) {
-    m_File.read((char*)&m_Files[0], sizeof(FileEntry) * m_Header.fileCount);
+    memcpy(&m_Files[0], &buffer[sizeof(Header)], sizeof(FileEntry) * m_Header.fileCount);
+  }
+
+  for (BSAULong i = 0; i < m_Header.fileCount; ++i) {
+    const FileEntry &file = m_Files[i];
+    checkBlock(file.offset, packedSize(file), unpackedSize(file), indexEnd, "file", i);
   }
 
   return true;
 }
 
 
-bool Archive::readDX10()
+bool Archive::readDX10(std::vector<char> &buffer)
 {
-  m_Textures.resize(m_Header.fileCount);
+  BSAULong count = m_Header.fileCount;
+  BSAHash fileSize = m_File.size();
+
+  // every texture has at least its header so this is the smallest possible index
+  BSAHash minIndexEnd = sizeof(Header) + static_cast<BSAHash>(sizeof(FileEntry_DX10)) * count;
+  if (minIndexEnd > fileSize) {
+    throw data_invalid_exception(makeString("texture table with %u entries exceeds the file size (%llu bytes)",
+                                            count, static_cast<unsigned long long>(fileSize)));
+  }
+
+  // the size of the index depends on the number of chunks per texture. Guess generously
+  // so that one read usually covers it. If it doesn't, the chunk offsets seen so far
+  // bound the rest of the index since data can't start before the index ends
+  BSAHash guess = minIndexEnd + static_cast<BSAHash>(4 * sizeof(DX10Chunk)) * count;
+  readIndexBuffer(buffer, std::min(guess, fileSize));
+  bool extended = false;
+
+  m_TextureHeaders.resize(count);
+  m_TextureChunks.resize(count);
+  m_Chunks.reserve(count);
+
+  BSAHash dataStart = fileSize;
+  size_t pos = sizeof(Header);
+
+  auto require = [&](BSAULong texture, size_t size) {
+    if (buffer.size() - pos >= size) {
+      return;
+    }
+    if (!extended) {
+      BSAHash maxRemaining = static_cast<BSAHash>(count - texture)
+                           * (sizeof(FileEntry_DX10) + 255 * sizeof(DX10Chunk));
+      readIndexBuffer(buffer, std::min(dataStart, pos + maxRemaining));
+      extended = true;
+    }
+    if (buffer.size() - pos < size) {
+      throw data_invalid_exception(makeString("texture table is truncated at texture %u", texture));
+    }
+  };
 
-  for(BSAULong i = 0; i < m_Textures.size(); i++)
+  for (BSAULong i = 0; i < count; ++i)
   {
-    Texture *texture = &m_Textures[i];
-    m_File.read((char*)&texture->texhdr, sizeof(texture->texhdr));
+    require(i, sizeof(FileEntry_DX10));
+    FileEntry_DX10 &header = m_TextureHeaders[i];
+    memcpy(&header, &buffer[pos], sizeof(FileEntry_DX10));
+    pos += sizeof(FileEntry_DX10);
+    // mip sizes are computed by shifting the dimensions by the mip level
+    if (header.numMips > TextureDecoder::maxMipCount(header.width, header.height)) {
+      throw data_invalid_exception(makeString("texture %u of %ux%u pixels claims %u mip maps", i,
+                                              static_cast<BSAULong>(header.width),
+                                              static_cast<BSAULong>(header.height),
+                                              static_cast<BSAULong>(header.numMips)));
+    }
 
-    texture->texchunks.resize(texture->texhdr.numChunks);
-    if(texture->texhdr.numChunks)
-      m_File.read((char*)&texture->texchunks[0], sizeof(DX10Chunk) * texture->texhdr.numChunks);
+    ChunkRange &range = m_TextureChunks[i];
+    range.first = static_cast<BSAULong>(m_Chunks.size());
+    range.count = header.numChunks;
+    if (header.numChunks) {
+      size_t chunksSize = sizeof(DX10Chunk) * header.numChunks;
+      require(i, chunksSize);
+      m_Chunks.resize(m_Chunks.size() + header.numChunks);
+      memcpy(&m_Chunks[range.first], &buffer[pos], chunksSize);
+      pos += chunksSize;
+
+      for (BSAULong j = range.first; j < range.first + range.count; ++j) {
+        dataStart = std::min(dataStart, m_Chunks[j].offset);
+      }
+      if (dataStart < pos) {
+        throw data_invalid_exception(makeString("chunk of texture %u overlaps the texture table", i));
+      }
+    }
+  }
+
+  BSAHash indexEnd = pos;
+  if ((m_Header.offsetNameTable != 0) && (m_Header.offsetNameTable < indexEnd)) {
+    throw data_invalid_exception(makeString("name table offset %llu overlaps the texture table",
+                                            static_cast<unsigned long long>(m_Header.offsetNameTable)));
+  }
+
+  for (BSAULong i = 0; i < count; ++i) {
+    const ChunkRange &range = m_TextureChunks[i];
+    for (BSAULong j = range.first; j < range.first + range.count; ++j) {
+      const DX10Chunk &chunk = m_Chunks[j];
+      checkBlock(chunk.offset, chunk.packedLen, chunk.unpackedLen, indexEnd, "texture", i);
+    }
   }
 
   return true;
@@ -161,19 +466,49 @@ bool Archive::readDX10()
 
 bool Archive::readNametable()
 {
-  m_File.seekg(0, std::ios_base::end);
-  size_t fileSize = m_File.tellg();
-  m_File.seekg(m_Header.offsetNameTable);
-  std::unique_ptr<char[]> buffer(new char[0x10000]);
+  // archives may be written without names
+  if (m_Header.offsetNameTable == 0) {
+    return true;
+  }
 
-  while((fileSize - m_File.tellg()) >= 2)
+  std::vector<char> buffer(static_cast<size_t>(m_File.size() - m_Header.offsetNameTable));
+  BufferMemoryScope bufferMemory(openStatistics(), buffer);
+  if (!buffer.empty()) {
+    m_File.readAt(m_Header.offsetNameTable, &buffer[0], buffer.size(), openStatistics());
+  }
+
+  m_TableNames.reserve(m_Header.fileCount);
+
+  size_t pos = 0;
+  while (m_TableNames.size() < m_Header.fileCount)
   {
-    BSAULong length = readType<BSAUShort>(m_File);
+    if ((buffer.size() - pos) < sizeof(BSAUShort)) {
+      throw data_invalid_exception(makeString("name table ends after %u of %u names",
+                                              static_cast<unsigned int>(m_TableNames.size()),
+                                              m_Header.fileCount));
+    }
+    BSAUShort length;
+    memcpy(&length, &buffer[pos], sizeof(BSAUShort));
+    pos += sizeof(BSAUShort);
+    if (length > buffer.size() - pos) {
+      throw data_invalid_exception(makeString("name %u exceeds the name table",
+                                              static_cast<unsigned int>(m_TableNames.size())));
+    }
 
-    m_File.read(buffer.get(), length);
-    buffer[length] = '\0';
+    // names aren't expected to contain null bytes but if they do, cut them off there
+    const char *name = &buffer[pos];
+    m_TableNames.push_back(std::string(name, std::find(name, name + length, '\0')));
+    pos += length;
+  }
 
-    m_TableNames.push_back(std::string(buffer.get()));
+  // the lookup refers to the keys, so fill it only once they don't move anymore
+  m_TableKeys.resize(m_TableNames.size());
+  for (size_t i = 0; i < m_TableNames.size(); ++i) {
+    PathKey::normalize(m_TableNames[i].data(), m_TableNames[i].size(), m_TableKeys[i]);
+  }
+  m_KeyLookup.reserve(m_TableKeys.size());
+  for (BSAULong i = 0; i < m_TableKeys.size(); ++i) {
+    m_KeyLookup.emplace(m_TableKeys[i], i);
   }
 
   return true;
@@ -181,6 +516,7 @@ bool Archive::readNametable()
 
 void Archive::close()
 {
+  m_Cache.clear();
   m_File.close();
 }
 
@@ -201,10 +537,6 @@ BSAULong Archive::countCharacters(const std::vector<std::string> &list) const
   return static_cast<BSAULong>(sum);
 }
 
-#ifndef WIN32
-#define _stricmp strcasecmp
-#endif // WIN32
-
 static bool endsWith(const std::string &fileName, const char *extension)
 {
   size_t endLength = strlen(extension);
@@ -236,205 +568,875 @@ std::vector<std::string> const Archive::getFileList()
   return m_TableNames;
 }
 
-EErrorCode Archive::extractAll(const char *destination,
-                        const std::function<bool (int value, std::string fileName)> &progress,
-                        bool overwrite) const
+
+bool Archive::getFileInfo(BSAULong index, FileInfo &info) const
 {
-  switch (m_Header.type) {
-    case TYPE_GENERAL: return extractAllGeneral(destination);
-    case TYPE_DX10: return extractAllDX10(destination);
-    default: return ERROR_INVALIDDATA;
+  if (m_Type == TYPE_GENERAL) {
+    if (index >= m_Files.size()) {
+      return false;
+    }
+    const FileEntry &file = m_Files[index];
+    info.offset = file.offset;
+    info.compressed = packedSize(file) != 0;
+    info.packedSize = info.compressed ? packedSize(file) : file.unpackedLen;
+    info.unpackedSize = unpackedSize(file);
+    info.chunks = 1;
+  }
+  else {
+    if (index >= m_TextureChunks.size()) {
+      return false;
+    }
+    const ChunkRange &range = m_TextureChunks[index];
+    info.offset = range.count > 0 ? m_Chunks[range.first].offset : 0;
+    info.packedSize = 0;
+    info.unpackedSize = textureSize(index);
+    info.chunks = range.count;
+    info.compressed = false;
+    for (BSAULong i = range.first; i < range.first + range.count; ++i) {
+      const DX10Chunk &chunk = m_Chunks[i];
+      info.packedSize += chunk.packedLen != 0 ? chunk.packedLen : chunk.unpackedLen;
+      info.compressed = info.compressed || (chunk.packedLen != 0);
+    }
   }
+  return true;
 }
 
 
-EErrorCode Archive::extractAllGeneral(const char *destination) const
+bool Archive::findFile(const std::string &fileName, BSAULong &index) const
 {
-  if (m_Files.size() != m_TableNames.size()) {
-    return ERROR_INVALIDDATA;
+  auto iter = m_KeyLookup.find(PathKey::normalize(fileName));
+  if (iter == m_KeyLookup.end()) {
+    return false;
   }
+  index = iter->second;
+  return true;
+}
 
-  for(BSAULong i = 0; i < m_Files.size(); ++i)
-  {
-    const FileEntry &file = m_Files[i];
 
-    std::string destinationPath = std::string(destination) + "\\" + m_TableNames[i];
+BSAULong Archive::packedSize(const FileEntry &file)
+{
+  // general files with identical packed and unpacked size are stored uncompressed
+  return file.unpackedLen != file.packedLen ? file.packedLen : 0;
+}
 
-    // ensure all directories exist
-    std::filesystem::create_directories(std::filesystem::path(destinationPath).parent_path());
-    std::fstream outFile;
-    outFile.open(destinationPath.c_str(), fstream::out | fstream::binary);
-    if (outFile.is_open()) {
-      m_File.seekg(file.offset);
-
-      if ((file.packedLen != 0) && (file.unpackedLen != file.packedLen)) {
-        BSAULong unpackedLen = file.unpackedLen;
-        if (!unpackedLen) {
-          unpackedLen = file.unk20;	// ???
-        }
 
-        // TODO Umm, maybe don't read the whole thing in one go? Who knows how large
-        //   this file could be. Do this in chunks like civilized people!
-        std::unique_ptr<BSAUChar[]> sourceBuffer(new BSAUChar[file.packedLen]);
+BSAULong Archive::unpackedSize(const FileEntry &file)
+{
+  if ((packedSize(file) != 0) && !file.unpackedLen) {
+    return file.unk20;	// ???
+  }
+  return file.unpackedLen;
+}
+
 
-        m_File.read((char*)sourceBuffer.get(), file.packedLen);
+BSAHash Archive::textureSize(BSAULong index) const
+{
+  BSAHash result = sizeof(BSAULong) + sizeof(DDS_HEADER);
+  const ChunkRange &range = m_TextureChunks[index];
+  for (BSAULong i = range.first; i < range.first + range.count; ++i) {
+    result += m_Chunks[i].unpackedLen;
+  }
+  return result;
+}
 
-        std::unique_ptr<BSAUChar[]> destinationBuffer(new BSAUChar[unpackedLen]);
 
-        uLongf bytesWritten = unpackedLen;
-        int result = uncompress(destinationBuffer.get(), &bytesWritten, sourceBuffer.get(), file.packedLen);
-        if ((result != Z_OK) || (bytesWritten != unpackedLen)) {
-          return ERROR_INVALIDDATA;
-        }
+void Archive::growBuffer(std::vector<BSAUChar> &buffer, size_t size, StatisticsCollector *statistics)
+{
+  if (buffer.size() < size) {
+    size_t oldCapacity = buffer.capacity();
+    buffer.resize(size);
+    if (statistics != nullptr) {
+      statistics->addBufferMemory(buffer.capacity() - oldCapacity);
+    }
+  }
+}
+
+
+void Archive::readBlock(BSAHash offset, BSAULong packedLen, BSAULong unpackedLen,
+                        BSAUChar *destination, ExtractContext &context,
+                        BSAULong entry, int chunk) const
+{
+  StatisticsCollector *statistics = context.statistics;
+  if (packedLen != 0) {
+    std::vector<BSAUChar> &scratch = context.sourceBuffer;
+    growBuffer(scratch, packedLen, statistics);
+    {
+      TraceScope span(context.trace, "read", entry, chunk);
+      m_File.readAt(offset, &scratch[0], packedLen, statistics);
+    }
+
+    StatisticsTimer timer(statistics, PHASE_INFLATE);
+    TraceScope span(context.trace, "inflate", entry, chunk);
+    if (!Inflater::local().inflate(&scratch[0], packedLen, destination, unpackedLen)) {
+      throw data_invalid_exception(makeString("failed to decompress data at offset %llu",
+                                              static_cast<unsigned long long>(offset)));
+    }
+    if (statistics != nullptr) {
+      statistics->addInflated(unpackedLen);
+    }
+  }
+  else if (unpackedLen != 0) {
+    TraceScope span(context.trace, "read", entry, chunk);
+    m_File.readAt(offset, destination, unpackedLen, statistics);
+  }
+}
+
 
-        outFile.write((const char*)destinationBuffer.get(), unpackedLen);
+EErrorCode Archive::readFile(BSAULong index, DataBuffer &result) const
+{
+  BSAHash cacheKey = EntryCache::makeKey(index);
+  if (m_Cache.get(cacheKey, result)) {
+    return ERROR_NONE;
+  }
+
+  try {
+    ExtractContext context(nullptr, nullptr);
+    if (m_Type == TYPE_GENERAL) {
+      if (index >= m_Files.size()) {
+        return ERROR_FILENOTFOUND;
       }
-      else {
-        std::unique_ptr<BSAUChar[]> destinationBuffer(new BSAUChar[file.unpackedLen]);
-        m_File.read((char*)destinationBuffer.get(), file.unpackedLen);
-        outFile.write((const char*)destinationBuffer.get(), file.unpackedLen);
+      const FileEntry &file = m_Files[index];
+      BSAULong size = unpackedSize(file);
+      std::shared_ptr<unsigned char> buffer(new unsigned char[size], array_deleter<unsigned char>());
+      readBlock(file.offset, packedSize(file), size, buffer.get(), context, index);
+      result = DataBuffer(buffer, size);
+    }
+    else {
+      if (index >= m_TextureChunks.size()) {
+        return ERROR_FILENOTFOUND;
+      }
+      BSAHash size = textureSize(index);
+      if (size > UINT32_MAX) {
+        return ERROR_INVALIDDATA;
+      }
+      std::shared_ptr<unsigned char> buffer(new unsigned char[static_cast<size_t>(size)],
+                                            array_deleter<unsigned char>());
+      if (!writeDDSHeader(m_TextureHeaders[index], buffer.get())) {
+        return ERROR_INVALIDDATA;
+      }
+      BSAUChar *pos = buffer.get() + sizeof(BSAULong) + sizeof(DDS_HEADER);
+      const ChunkRange &range = m_TextureChunks[index];
+      for (BSAULong i = range.first; i < range.first + range.count; ++i) {
+        const DX10Chunk &chunk = m_Chunks[i];
+        readBlock(chunk.offset, chunk.packedLen, chunk.unpackedLen, pos, context,
+                  index, static_cast<int>(i - range.first));
+        pos += chunk.unpackedLen;
+      }
+      result = DataBuffer(buffer, static_cast<BSAULong>(size));
+    }
+    m_Cache.put(cacheKey, result);
+    return ERROR_NONE;
+  } catch (const data_invalid_exception&) {
+    return ERROR_INVALIDDATA;
+  } catch (const std::bad_alloc&) {
+    return ERROR_INVALIDDATA;
+  }
+}
+
+
+EErrorCode Archive::readFile(const std::string &fileName, DataBuffer &result) const
+{
+  BSAULong index;
+  if (!findFile(fileName, index)) {
+    return ERROR_FILENOTFOUND;
+  }
+  return readFile(index, result);
+}
+
+
+void Archive::peekBlock(BSAHash offset, BSAULong packedLen, BSAULong unpackedLen,
+                        BSAUChar *destination, size_t length, ExtractContext &context,
+                        BSAULong entry, int chunk) const
+{
+  if ((packedLen == 0) || (length >= unpackedLen)) {
+    // uncompressed data can be read partially, complete blocks are decompressed
+    // in one go
+    if (length >= unpackedLen) {
+      readBlock(offset, packedLen, unpackedLen, destination, context, entry, chunk);
+    }
+    else if (length != 0) {
+      TraceScope span(context.trace, "read", entry, chunk);
+      m_File.readAt(offset, destination, length, context.statistics);
+    }
+    return;
+  }
+
+  // the compressed size of a prefix is usually smaller than the prefix itself,
+  // start with that and double the amount read each time the stream needs more
+  BSAHash consumed = 0;
+  size_t pieceSize = std::max(PEEK_INPUT_SIZE, length);
+  auto fetch = [&](const BSAUChar *&data) -> size_t {
+    size_t size = static_cast<size_t>(std::min<BSAHash>(pieceSize, packedLen - consumed));
+    if (size == 0) {
+      return 0;
+    }
+    growBuffer(context.sourceBuffer, size, context.statistics);
+    TraceScope span(context.trace, "read", entry, chunk);
+    m_File.readAt(offset + consumed, &context.sourceBuffer[0], size, context.statistics);
+    consumed += size;
+    pieceSize *= 2;
+    data = &context.sourceBuffer[0];
+    return size;
+  };
+
+  StatisticsTimer timer(context.statistics, PHASE_INFLATE);
+  TraceScope span(context.trace, "inflate", entry, chunk);
+  if (!Inflater::local().inflatePrefix(fetch, destination, length)) {
+    throw data_invalid_exception(makeString("failed to decompress data at offset %llu",
+                                            static_cast<unsigned long long>(offset)));
+  }
+  if (context.statistics != nullptr) {
+    context.statistics->addInflated(length);
+  }
+}
+
+
+EErrorCode Archive::peekFile(BSAULong index, size_t length, DataBuffer &result) const
+{
+  ExtractContext context(nullptr, nullptr);
+  return peekFile(index, length, result, context);
+}
+
+
+EErrorCode Archive::peekFile(BSAULong index, size_t length, DataBuffer &result,
+                             ExtractContext &context) const
+{
+  try {
+    if (m_Type == TYPE_GENERAL) {
+      if (index >= m_Files.size()) {
+        return ERROR_FILENOTFOUND;
       }
+      const FileEntry &file = m_Files[index];
+      BSAULong size = static_cast<BSAULong>(std::min<BSAHash>(length, unpackedSize(file)));
+      std::shared_ptr<unsigned char> buffer(new unsigned char[size], array_deleter<unsigned char>());
+      peekBlock(file.offset, packedSize(file), unpackedSize(file), buffer.get(), size, context, index);
+      result = DataBuffer(buffer, size);
     }
     else {
-      return ERROR_ACCESSFAILED;
+      if (index >= m_TextureChunks.size()) {
+        return ERROR_FILENOTFOUND;
+      }
+      BSAULong size = static_cast<BSAULong>(std::min<BSAHash>(length, textureSize(index)));
+      std::shared_ptr<unsigned char> buffer(new unsigned char[size], array_deleter<unsigned char>());
+
+      BSAUChar header[sizeof(BSAULong) + sizeof(DDS_HEADER)];
+      if (!writeDDSHeader(m_TextureHeaders[index], header)) {
+        return ERROR_INVALIDDATA;
+      }
+      BSAULong pos = std::min<BSAULong>(size, sizeof(header));
+      memcpy(buffer.get(), header, pos);
+
+      const ChunkRange &range = m_TextureChunks[index];
+      for (BSAULong i = range.first; (i < range.first + range.count) && (pos < size); ++i) {
+        const DX10Chunk &chunk = m_Chunks[i];
+        BSAULong count = std::min(chunk.unpackedLen, size - pos);
+        peekBlock(chunk.offset, chunk.packedLen, chunk.unpackedLen, buffer.get() + pos, count,
+                  context, index, static_cast<int>(i - range.first));
+        pos += count;
+      }
+      result = DataBuffer(buffer, size);
     }
+    return ERROR_NONE;
+  } catch (const data_invalid_exception&) {
+    return ERROR_INVALIDDATA;
+  } catch (const std::bad_alloc&) {
+    return ERROR_INVALIDDATA;
   }
-  return ERROR_NONE;
 }
 
 
-EErrorCode Archive::extractAllDX10(const char *destination) const
+EErrorCode Archive::peekFiles(const std::vector<BSAULong> &indices, size_t length,
+                              std::vector<DataBuffer> &results, unsigned int threads) const
 {
-  for(BSAULong i = 0; i < m_Textures.size(); ++i)
-  {
-    const Texture *texture = &m_Textures[i];
+  results.assign(indices.size(), DataBuffer());
+
+  std::atomic<size_t> next(0);
+  std::atomic<int> result(ERROR_NONE);
+
+  auto worker = [&]() {
+    ExtractContext context(nullptr, nullptr);
+    for (size_t position = next++; position < indices.size(); position = next++) {
+      EErrorCode error = peekFile(indices[position], length, results[position], context);
+      if (error != ERROR_NONE) {
+        int expected = ERROR_NONE;
+        result.compare_exchange_strong(expected, error);
+      }
+    }
+  };
+
+  // files are small compared to the cost of starting a thread, the calling thread
+  // works as well
+  unsigned int numThreads = static_cast<unsigned int>(
+    std::max<size_t>(1, std::min<size_t>(threads, indices.size())));
+  std::vector<std::thread> workers;
+  for (unsigned int i = 1; i < numThreads; ++i) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (std::thread &thread : workers) {
+    thread.join();
+  }
 
-    std::string destinationPath = destination;
-    destinationPath += "\\";
-    destinationPath += m_TableNames[i];
+  return static_cast<EErrorCode>(result.load());
+}
 
-    std::fstream outFile;
-    outFile.open(destinationPath.c_str(), fstream::out | fstream::binary);
-    if (outFile.is_open()) {
-      DDS_HEADER ddsHeader = { 0 };
 
-      ddsHeader.dwSize = sizeof(ddsHeader);
-      ddsHeader.dwHeaderFlags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE | DDS_HEADER_FLAGS_MIPMAP;
-      ddsHeader.dwHeight = texture->texhdr.height;
-      ddsHeader.dwWidth = texture->texhdr.width;
-      ddsHeader.dwMipMapCount = texture->texhdr.numMips;
-      ddsHeader.ddspf.dwSize = sizeof(DDS_PIXELFORMAT);
-      ddsHeader.dwSurfaceFlags = DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP;
+// largest surface decodeTexture produces: 16384 x 16384 RGBA pixels, the maximum
+// texture size of Direct3D 11. Well below UINT32_MAX, the limit of DataBuffer
+static const BSAHash MAX_DECODED_SIZE = static_cast<BSAHash>(16384) * 16384 * 4;
 
-      bool ok = true;
 
-      switch(texture->texhdr.format)
-      {
-      case DXGI_FORMAT_BC1_UNORM:
-        ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-        ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '1');
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height / 2;	// 4bpp
-        break;
+EErrorCode Archive::decodeTexture(BSAULong index, BSAULong mip, DataBuffer &result,
+                                  BSAULong &width, BSAULong &height) const
+{
+  if ((m_Type != TYPE_DX10) || (index >= m_TextureChunks.size())) {
+    return ERROR_FILENOTFOUND;
+  }
+  const FileEntry_DX10 &header = m_TextureHeaders[index];
+  if ((mip >= header.numMips) || !TextureDecoder::isSupported(header.format)) {
+    return ERROR_INVALIDDATA;
+  }
+  width = std::max<BSAULong>(1, header.width >> mip);
+  height = std::max<BSAULong>(1, header.height >> mip);
+
+  const ChunkRange &range = m_TextureChunks[index];
+  for (BSAULong i = range.first; i < range.first + range.count; ++i) {
+    const DX10Chunk &chunk = m_Chunks[i];
+    if ((mip < chunk.startMip) || (mip > chunk.endMip)) {
+      continue;
+    }
 
-      case DXGI_FORMAT_BC2_UNORM:
-        ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-        ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '3');
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height;	// 8bpp
-        break;
+    // mip maps are stored largest first
+    BSAHash offset = 0;
+    for (BSAULong level = chunk.startMip; level < mip; ++level) {
+      offset += TextureDecoder::surfaceSize(header.format, std::max<BSAULong>(1, header.width >> level),
+                                            std::max<BSAULong>(1, header.height >> level));
+    }
+    BSAHash size = TextureDecoder::surfaceSize(header.format, width, height);
+    if (offset + size > chunk.unpackedLen) {
+      return ERROR_INVALIDDATA;
+    }
 
-      case DXGI_FORMAT_BC3_UNORM:
-        ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-        ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '5');
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height;	// 8bpp
-        break;
+    try {
+      // dimensions come from the archive, don't trust them with the allocation
+      BSAHash pixelSize = static_cast<BSAHash>(width) * height * 4;
+      if (pixelSize > MAX_DECODED_SIZE) {
+        throw data_invalid_exception(makeString("texture of %ux%u pixels is too large to decode",
+                                                width, height));
+      }
 
-      case DXGI_FORMAT_BC5_UNORM:
-        ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-        if(m_UseATIFourCC)
-          ddsHeader.ddspf.dwFourCC = MAKEFOURCC('A', 'T', 'I', '2');	// this is more correct but the only thing I have found that supports it is the nvidia photoshop plugin
-        else
-          ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '5');
+      int chunkIndex = static_cast<int>(i - range.first);
+      DataBuffer chunkData;
+      BSAHash cacheKey = EntryCache::makeKey(index, chunkIndex);
+      if (!m_Cache.get(cacheKey, chunkData)) {
+        ExtractContext context(nullptr, nullptr);
+        std::shared_ptr<unsigned char> buffer(new unsigned char[chunk.unpackedLen],
+                                              array_deleter<unsigned char>());
+        readBlock(chunk.offset, chunk.packedLen, chunk.unpackedLen, buffer.get(), context,
+                  index, chunkIndex);
+        chunkData = DataBuffer(buffer, chunk.unpackedLen);
+        m_Cache.put(cacheKey, chunkData);
+      }
 
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height;	// 8bpp
-        break;
+      std::shared_ptr<unsigned char> pixels(new unsigned char[static_cast<size_t>(pixelSize)],
+                                            array_deleter<unsigned char>());
+      if (!TextureDecoder::decode(header.format, chunkData.first.get() + offset, static_cast<size_t>(size),
+                                  width, height, pixels.get())) {
+        return ERROR_INVALIDDATA;
+      }
+      result = DataBuffer(pixels, static_cast<BSAULong>(pixelSize));
+      return ERROR_NONE;
+    } catch (const data_invalid_exception&) {
+      return ERROR_INVALIDDATA;
+    } catch (const std::bad_alloc&) {
+      return ERROR_INVALIDDATA;
+    }
+  }
+  return ERROR_INVALIDDATA;
+}
 
-      case DXGI_FORMAT_BC7_UNORM:
-        // totally wrong but not worth writing out the DX10 header
-        ddsHeader.ddspf.dwFlags = DDS_FOURCC;
-        ddsHeader.ddspf.dwFourCC = MAKEFOURCC('B', 'C', '7', '\0');
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height;	// 8bpp
-        break;
 
-      case DXGI_FORMAT_B8G8R8A8_UNORM:
-        ddsHeader.ddspf.dwFlags = DDS_RGBA;
-        ddsHeader.ddspf.dwRGBBitCount = 32;
-        ddsHeader.ddspf.dwRBitMask =	0x00FF0000;
-        ddsHeader.ddspf.dwGBitMask =	0x0000FF00;
-        ddsHeader.ddspf.dwBBitMask =	0x000000FF;
-        ddsHeader.ddspf.dwABitMask =	0xFF000000;
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height * 4;	// 32bpp
-        break;
+BSAULong Archive::findMip(BSAULong index, BSAULong maxSize) const
+{
+  if ((m_Type != TYPE_DX10) || (index >= m_TextureHeaders.size())) {
+    return 0;
+  }
+  const FileEntry_DX10 &header = m_TextureHeaders[index];
+  BSAULong mip = 0;
+  while ((mip + 1 < header.numMips)
+         && (std::max<BSAULong>(header.width >> mip, header.height >> mip) > maxSize)) {
+    ++mip;
+  }
+  return mip;
+}
 
-      case DXGI_FORMAT_R8_UNORM:
-        ddsHeader.ddspf.dwFlags = DDS_RGB;
-        ddsHeader.ddspf.dwRGBBitCount = 8;
-        ddsHeader.ddspf.dwRBitMask =	0xFF;
-        ddsHeader.dwPitchOrLinearSize = texture->texhdr.width * texture->texhdr.height;	// 8bpp
-        break;
 
-      default:
-        ok = false;
+inline bool fileExists(const std::string &name) {
+  struct stat buffer;
+  return stat(name.c_str(), &buffer) != -1;
+}
+
+
+// names in the archive always use backslashes, convert them to the native separator.
+// Names are appended rather than combined with path::operator/ so that a name with
+// a leading separator can't replace the output directory
+static std::string outputPath(const char *destination, const std::string &name)
+{
+  std::string result(destination);
+#ifdef _WIN32
+  result.append("\\").append(name);
+#else
+  result.append("/").append(name);
+  std::replace(result.end() - name.size(), result.end(), '\\', '/');
+#endif
+  return result;
+}
+
+
+EErrorCode Archive::extractAll(const char *destination,
+                        const ProgressCallback &progress,
+                        bool overwrite) const
+{
+  ExtractOptions options;
+  options.progress = progress;
+  options.overwrite = overwrite;
+  return extractAll(destination, options);
+}
+
+
+EErrorCode Archive::extractAll(const char *destination, const ExtractOptions &options) const
+{
+  if ((m_Header.type != TYPE_GENERAL) && (m_Header.type != TYPE_DX10)) {
+    return ERROR_INVALIDDATA;
+  }
+
+  if (m_TableNames.size() != countFiles()) {
+    return ERROR_INVALIDDATA;
+  }
+
+  bool journaling = !options.journal.empty();
+
+  // indices of the files to extract, only used with a filter or a journal
+  bool selective = options.filter || journaling;
+  std::vector<BSAULong> selection;
+  if (selective) {
+    for (BSAULong i = 0; i < countFiles(); ++i) {
+      if (!options.filter || options.filter(i, m_TableNames[i])) {
+        selection.push_back(i);
+      }
+    }
+  }
+
+  // files a previous run completed. Its records are only trusted if the output
+  // still has the expected size, the rest is extracted again
+  ExtractJournal journal;
+  BSAULong skipped = 0;
+  if (journaling) {
+    std::vector<BSAULong> recorded;
+    ExtractJournal::load(options.journal, countFiles(), m_File.size(), recorded);
+    std::vector<bool> complete(countFiles(), false);
+    for (BSAULong index : recorded) {
+      complete[index] = isExtracted(index, destination);
+    }
+    std::vector<BSAULong> completed;
+    std::vector<BSAULong> remaining;
+    for (BSAULong index : selection) {
+      (complete[index] ? completed : remaining).push_back(index);
+    }
+    if (!journal.create(options.journal, countFiles(), m_File.size(), completed)) {
+      return ERROR_ACCESSFAILED;
+    }
+    skipped = static_cast<BSAULong>(completed.size());
+    selection.swap(remaining);
+    if (options.filesDone != nullptr) {
+      *options.filesDone += skipped;
+    }
+  }
+
+  BSAULong count = selective ? static_cast<BSAULong>(selection.size()) : countFiles();
+  BSAULong total = count + skipped;
+  auto entryAt = [&](BSAULong position) {
+    return selective ? selection[position] : position;
+  };
+
+  unsigned int numThreads = std::max(1u, std::min<unsigned int>(options.threads, count));
+
+  std::atomic<BSAULong> nextIndex(0);
+  std::atomic<BSAULong> filesDone(skipped);
+  std::atomic<BSAULong> lastDone(countFiles());
+  std::atomic<bool> canceled(false);
+  std::atomic<int> result(ERROR_NONE);
+
+  StatisticsCollector statistics;
+  StatisticsCollector *collector = options.statistics != nullptr ? &statistics : nullptr;
+
+  std::mutex finishedMutex;
+  std::condition_variable finishedCondition;
+  unsigned int running = numThreads;
+
+  auto cancelRequested = [&]() {
+    return (options.cancel != nullptr) && options.cancel->load(std::memory_order_relaxed);
+  };
+  auto cancel = [&]() {
+    int expected = ERROR_NONE;
+    result.compare_exchange_strong(expected, ERROR_CANCELED);
+    canceled = true;
+  };
+
+  auto worker = [&]() {
+    ExtractContext context(collector, options.trace);
+    while (!canceled.load(std::memory_order_relaxed)) {
+      if (cancelRequested()) {
+        cancel();
+        break;
+      }
+      BSAULong position = nextIndex++;
+      if (position >= count) {
+        break;
+      }
+      BSAULong index = entryAt(position);
+      EErrorCode error = extractFile(index, destination, options.overwrite, options.directThreshold,
+                                     context, canceled);
+      // a record in the journal has to be backed by data that survives a crash
+      if ((error == ERROR_NONE) && journaling
+          && !syncFile(outputPath(destination, m_TableNames[index]).c_str())) {
+        error = ERROR_ACCESSFAILED;
+      }
+      if (error != ERROR_NONE) {
+        int expected = ERROR_NONE;
+        result.compare_exchange_strong(expected, error);
+        canceled = true;
         break;
       }
+      if (journaling) {
+        journal.add(index);
+      }
+      lastDone.store(index, std::memory_order_relaxed);
+      ++filesDone;
+      if (options.filesDone != nullptr) {
+        ++*options.filesDone;
+      }
+    }
 
-      if(ok)
-      {
-        writeType<BSAULong>(outFile, DDS_MAGIC);
-        writeType(outFile, ddsHeader);
+    std::lock_guard<std::mutex> lock(finishedMutex);
+    --running;
+    finishedCondition.notify_all();
+  };
 
-        for(BSAULong j = 0; j < texture->texchunks.size(); ++j) {
-          const DX10Chunk *chunk = &texture->texchunks[j];
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    threads.push_back(std::thread(worker));
+  }
 
-          std::unique_ptr<BSAUChar[]> sourceBuffer(new BSAUChar[chunk->packedLen]);
+  // the calling thread reports progress, so the callback is never invoked from
+  // a worker and workers never wait for it
+  auto report = [&]() -> bool {
+    BSAULong done = filesDone.load();
+    BSAULong last = lastDone.load(std::memory_order_relaxed);
+    int percentage = total > 0 ? static_cast<int>(static_cast<BSAHash>(done) * 100 / total) : 100;
+    static const std::string noFile;
+    return options.progress(percentage, last < countFiles() ? m_TableNames[last] : noFile);
+  };
 
-          m_File.seekg(chunk->offset);
-          m_File.read((char*)sourceBuffer.get(), chunk->packedLen);
+  {
+    std::unique_lock<std::mutex> lock(finishedMutex);
+    while (running > 0) {
+      if (!options.progress && (options.cancel == nullptr) && !journaling) {
+        finishedCondition.wait(lock);
+      }
+      else if (!finishedCondition.wait_for(lock, options.progressInterval, [&]() { return running == 0; })) {
+        // polling the flag here as well reaches workers busy with a large file
+        lock.unlock();
+        if (cancelRequested() || (options.progress && !report())) {
+          cancel();
+        }
+        if (journaling && !journal.flush()) {
+          int expected = ERROR_NONE;
+          result.compare_exchange_strong(expected, ERROR_ACCESSFAILED);
+          canceled = true;
+        }
+        lock.lock();
+      }
+    }
+  }
 
-          std::unique_ptr<BSAUChar[]> destinationBuffer(new BSAUChar[chunk->unpackedLen]);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
 
-          uLongf bytesWritten = chunk->unpackedLen;
-          int result = uncompress(destinationBuffer.get(), &bytesWritten, sourceBuffer.get(), chunk->packedLen);
-          if ((result != Z_OK) || (bytesWritten != chunk->unpackedLen)) {
-            return ERROR_INVALIDDATA;
-          }
+  if (journaling) {
+    journal.close(result == ERROR_NONE);
+  }
 
-          outFile.write((char*)destinationBuffer.get(), chunk->unpackedLen);
-        }
+  if ((result == ERROR_NONE) && options.progress) {
+    report();
+  }
+
+  if (options.statistics != nullptr) {
+    *options.statistics = statistics.snapshot();
+  }
+
+  return static_cast<EErrorCode>(result.load());
+}
+
+
+AsyncOperation Archive::readAsync(const char *fileName, const AsyncOptions &asyncOptions)
+{
+  std::string name(fileName);
+  return AsyncOperation::start([this, name](const std::atomic<bool>&) {
+    return read(name.c_str());
+  }, asyncOptions);
+}
+
+
+AsyncOperation Archive::extractAllAsync(const char *outputDirectory, const ExtractOptions &options,
+                                        const AsyncOptions &asyncOptions) const
+{
+  std::string destination(outputDirectory);
+  return AsyncOperation::start([this, destination, options](const std::atomic<bool> &canceled) {
+    ExtractOptions localOptions(options);
+    localOptions.cancel = &canceled;
+    return extractAll(destination.c_str(), localOptions);
+  }, asyncOptions);
+}
+
+
+bool Archive::isExtracted(BSAULong index, const char *destination) const
+{
+  FileInfo info;
+  if (!getFileInfo(index, info)) {
+    return false;
+  }
+  BSAHash expected = info.unpackedSize;
+  if (m_Type == TYPE_DX10) {
+    // textures in formats dds headers can't describe are written as empty files
+    BSAUChar header[sizeof(BSAULong) + sizeof(DDS_HEADER)];
+    if (!writeDDSHeader(m_TextureHeaders[index], header)) {
+      expected = 0;
+    }
+  }
+  std::error_code ec;
+  std::uintmax_t size = std::filesystem::file_size(outputPath(destination, m_TableNames[index]), ec);
+  return !ec && (size == expected);
+}
+
+
+EErrorCode Archive::extractFile(BSAULong index, const char *destination, bool overwrite,
+                                BSAHash directThreshold, ExtractContext &context,
+                                const std::atomic<bool> &canceled) const
+{
+  TraceScope span(context.trace, "entry", index, -1, &m_TableNames[index]);
+
+  std::string destinationPath = outputPath(destination, m_TableNames[index]);
+
+  if (!overwrite && fileExists(destinationPath)) {
+    return ERROR_NONE;
+  }
+
+  FileInfo info;
+  bool direct = (directThreshold != 0) && getFileInfo(index, info)
+             && (info.unpackedSize >= directThreshold);
+
+  std::fstream outFile;
+  std::unique_ptr<DirectOutputBuffer> directBuffer;
+  std::unique_ptr<std::ostream> directStream;
+  {
+    StatisticsTimer timer(context.statistics, PHASE_OUTPUTOPEN);
+    TraceScope span(context.trace, "open", index);
+    // ensure all directories exist
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(destinationPath).parent_path(), ec);
+    if (direct) {
+      directBuffer.reset(new DirectOutputBuffer());
+      if (!directBuffer->open(destinationPath.c_str(), info.unpackedSize)) {
+        return ERROR_ACCESSFAILED;
       }
+      directStream.reset(new std::ostream(directBuffer.get()));
     }
     else {
-      return ERROR_ACCESSFAILED;
+      outFile.open(destinationPath.c_str(), fstream::out | fstream::binary);
+      if (!outFile.is_open()) {
+        return ERROR_ACCESSFAILED;
+      }
     }
   }
-  return ERROR_NONE;
+  std::ostream &output = direct ? *directStream : outFile;
+
+  try {
+    if (m_Header.type == TYPE_GENERAL) {
+      extractGeneral(index, output, context);
+    }
+    else if (!extractDX10(index, output, context, canceled)) {
+      // the file is incomplete, it must not count as extracted
+      return ERROR_CANCELED;
+    }
+  } catch (const data_invalid_exception&) {
+    return ERROR_INVALIDDATA;
+  } catch (const std::bad_alloc&) {
+    return ERROR_INVALIDDATA;
+  }
+
+  if (direct) {
+    // writes the last block, so failures only show up here
+    bool closed = directBuffer->close();
+    return (closed && !output.fail()) ? ERROR_NONE : ERROR_ACCESSFAILED;
+  }
+  return outFile.fail() ? ERROR_ACCESSFAILED : ERROR_NONE;
+}
+
+
+void Archive::extractGeneral(BSAULong index, std::ostream &outFile, ExtractContext &context) const
+{
+  const FileEntry &file = m_Files[index];
+  BSAULong unpackedLen = unpackedSize(file);
+
+  // TODO Umm, maybe don't read the whole thing in one go? Who knows how large
+  //   this file could be. Do this in chunks like civilized people!
+  growBuffer(context.destinationBuffer, unpackedLen, context.statistics);
+  if (unpackedLen != 0) {
+    readBlock(file.offset, packedSize(file), unpackedLen, &context.destinationBuffer[0],
+              context, index);
+    writeOutput(outFile, &context.destinationBuffer[0], unpackedLen, context, index);
+  }
+}
+
+
+bool Archive::writeDDSHeader(const FileEntry_DX10 &texhdr, BSAUChar *buffer) const
+{
+  DDS_HEADER ddsHeader = {};
+
+  ddsHeader.dwSize = sizeof(ddsHeader);
+  ddsHeader.dwHeaderFlags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE | DDS_HEADER_FLAGS_MIPMAP;
+  ddsHeader.dwHeight = texhdr.height;
+  ddsHeader.dwWidth = texhdr.width;
+  ddsHeader.dwMipMapCount = texhdr.numMips;
+  ddsHeader.ddspf.dwSize = sizeof(DDS_PIXELFORMAT);
+  ddsHeader.dwSurfaceFlags = DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP;
+
+  switch(texhdr.format)
+  {
+  case DXGI_FORMAT_BC1_UNORM:
+    ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+    ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '1');
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height / 2;	// 4bpp
+    break;
+
+  case DXGI_FORMAT_BC2_UNORM:
+    ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+    ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '3');
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height;	// 8bpp
+    break;
+
+  case DXGI_FORMAT_BC3_UNORM:
+    ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+    ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '5');
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height;	// 8bpp
+    break;
+
+  case DXGI_FORMAT_BC5_UNORM:
+    ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+    if(m_UseATIFourCC)
+      ddsHeader.ddspf.dwFourCC = MAKEFOURCC('A', 'T', 'I', '2');	// this is more correct but the only thing I have found that supports it is the nvidia photoshop plugin
+    else
+      ddsHeader.ddspf.dwFourCC = MAKEFOURCC('D', 'X', 'T', '5');
+
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height;	// 8bpp
+    break;
+
+  case DXGI_FORMAT_BC7_UNORM:
+    // totally wrong but not worth writing out the DX10 header
+    ddsHeader.ddspf.dwFlags = DDS_FOURCC;
+    ddsHeader.ddspf.dwFourCC = MAKEFOURCC('B', 'C', '7', '\0');
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height;	// 8bpp
+    break;
+
+  case DXGI_FORMAT_B8G8R8A8_UNORM:
+    ddsHeader.ddspf.dwFlags = DDS_RGBA;
+    ddsHeader.ddspf.dwRGBBitCount = 32;
+    ddsHeader.ddspf.dwRBitMask =	0x00FF0000;
+    ddsHeader.ddspf.dwGBitMask =	0x0000FF00;
+    ddsHeader.ddspf.dwBBitMask =	0x000000FF;
+    ddsHeader.ddspf.dwABitMask =	0xFF000000;
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height * 4;	// 32bpp
+    break;
+
+  case DXGI_FORMAT_R8_UNORM:
+    ddsHeader.ddspf.dwFlags = DDS_RGB;
+    ddsHeader.ddspf.dwRGBBitCount = 8;
+    ddsHeader.ddspf.dwRBitMask =	0xFF;
+    ddsHeader.dwPitchOrLinearSize = texhdr.width * texhdr.height;	// 8bpp
+    break;
+
+  default:
+    return false;
+  }
+
+  BSAULong magic = DDS_MAGIC;
+  memcpy(buffer, &magic, sizeof(BSAULong));
+  memcpy(buffer + sizeof(BSAULong), &ddsHeader, sizeof(DDS_HEADER));
+  return true;
+}
+
+
+bool Archive::extractDX10(BSAULong index, std::ostream &outFile, ExtractContext &context,
+                          const std::atomic<bool> &canceled) const
+{
+  BSAUChar header[sizeof(BSAULong) + sizeof(DDS_HEADER)];
+  if (!writeDDSHeader(m_TextureHeaders[index], header)) {
+    return true;
+  }
+  writeOutput(outFile, header, sizeof(header), context, index);
+
+  const ChunkRange &range = m_TextureChunks[index];
+  for (BSAULong i = range.first; i < range.first + range.count; ++i) {
+    // large textures consist of several chunks, don't make the user wait for all of them
+    if (canceled.load(std::memory_order_relaxed)) {
+      return false;
+    }
+
+    const DX10Chunk &chunk = m_Chunks[i];
+    growBuffer(context.destinationBuffer, chunk.unpackedLen, context.statistics);
+    if (chunk.unpackedLen != 0) {
+      int chunkIndex = static_cast<int>(i - range.first);
+      readBlock(chunk.offset, chunk.packedLen, chunk.unpackedLen, &context.destinationBuffer[0],
+                context, index, chunkIndex);
+      writeOutput(outFile, &context.destinationBuffer[0], chunk.unpackedLen, context, index,
+                  chunkIndex);
+    }
+  }
+  return true;
+}
+
+
+void Archive::writeOutput(std::ostream &outFile, const BSAUChar *data, size_t size,
+                          ExtractContext &context, BSAULong entry, int chunk) const
+{
+  StatisticsTimer timer(context.statistics, PHASE_OUTPUTWRITE);
+  TraceScope span(context.trace, "write", entry, chunk);
+  outFile.write(reinterpret_cast<const char*>(data), size);
+  if (context.statistics != nullptr) {
+    context.statistics->addWritten(size);
+  }
+}
+
+
+Archive::ExtractContext::~ExtractContext()
+{
+  if (statistics != nullptr) {
+    statistics->addBufferMemory(-static_cast<int64_t>(sourceBuffer.capacity()
+                                                      + destinationBuffer.capacity()));
+  }
 }
 
 
 void Archive::writeHeader(std::fstream &outfile, EType type, BSAULong fileVersion, BSAULong numFiles,
                           BSAHash nameTableOffset)
 {
-  // dummy code
   outfile.write("BTDX", 4);
   writeType<BSAULong>(outfile, fileVersion);
   outfile.write(typeToID(type), 4);
   writeType<BSAULong>(outfile, numFiles);
-  writeType<BSAULong>(outfile, nameTableOffset);
-}
-
-
-inline bool fileExists(const std::string &name) {
-  struct stat buffer;
-  return stat(name.c_str(), &buffer) != -1;
+  writeType<BSAHash>(outfile, nameTableOffset);
 }
 
 
@@ -22,14 +22,23 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 
 #include "errorcodes.h"
+#include "ba2async.h"
 #include "ba2type.h"
 #include "ba2types.h"
+#include "ba2file.h"
+#include "ba2cache.h"
+#include "ba2statistics.h"
+#include "ba2trace.h"
 #include "semaphore.h"
 #include <vector>
 #include <queue>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string_view>
+#include <unordered_map>
 
 
 namespace BA2 {
@@ -45,11 +54,159 @@ namespace BA2 {
 
   class File;
 
+  /**
+   * callback reporting extraction progress
+   * @param value percentage of files extracted
+   * @param fileName name of the file most recently extracted
+   * @return false to cancel the extraction
+   */
+  typedef std::function<bool(int value, const std::string &fileName)> ProgressCallback;
+
+  /**
+   * callback selecting the files to extract
+   * @param index index of the file, corresponding to Archive::getFileList()
+   * @param fileName name of the file as stored in the archive
+   * @return true to extract the file
+   */
+  typedef std::function<bool(BSAULong index, const std::string &fileName)> ExtractFilter;
+
+  /**
+   * @brief settings for Archive::extractAll
+   */
+  struct ExtractOptions {
+    ExtractOptions()
+      : progressInterval(100)
+      , filesDone(nullptr)
+      , cancel(nullptr)
+      , statistics(nullptr)
+      , trace(nullptr)
+      , overwrite(true)
+      , threads(1)
+      , directThreshold(0)
+    {
+    }
+
+    /**
+     * optional progress callback. It's invoked on the thread running extractAll,
+     * at most once per progressInterval and once after the extraction completed
+     */
+    ProgressCallback progress;
+
+    /**
+     * minimum time between two progress callbacks
+     */
+    std::chrono::milliseconds progressInterval;
+
+    /**
+     * optional counter that gets incremented for each extracted file. It may be polled
+     * from another thread instead of (or in addition to) using a callback
+     */
+    std::atomic<BSAULong> *filesDone;
+
+    /**
+     * optional flag that cancels the extraction once it's set, so it can be canceled
+     * from another thread without a progress callback. It's checked before each
+     * file and at least once per progressInterval
+     */
+    const std::atomic<bool> *cancel;
+
+    /**
+     * if set, receives performance counters of the extraction once it's done.
+     * Statistics are only collected if this is set
+     */
+    Statistics *statistics;
+
+    /**
+     * if set, a span is recorded for every file, texture chunk and i/o operation
+     */
+    TraceRecorder *trace;
+
+    /**
+     * optional filter, if set only files it accepts are extracted and progress
+     * refers to the selected files
+     */
+    ExtractFilter filter;
+
+    /**
+     * if true, existing files are overwritten, otherwise they are skipped
+     */
+    bool overwrite;
+
+    /**
+     * number of worker threads extracting files
+     */
+    unsigned int threads;
+
+    /**
+     * optional journal file that makes the extraction resumable. Completed files are
+     * recorded in it while extracting. If it exists when the extraction starts, the
+     * files it lists are skipped if they still exist with the expected size, and
+     * they count as done for progress. The journal is deleted once the extraction
+     * succeeded and kept if it failed or was canceled.
+     * Each file is synced to disk before it's recorded, and the journal itself is
+     * synced whenever new records are written, so after a crash or power loss the
+     * journal lists no file whose data was lost. Directories aren't synced, files
+     * that disappeared with their directory entry or don't have the expected size
+     * are extracted again. Syncing costs time, especially with many small files
+     */
+    std::string journal;
+
+    /**
+     * files whose extracted size is at least this many bytes are written with
+     * unbuffered I/O, see DirectOutputBuffer. This keeps large outputs from
+     * evicting archive data from the page cache. 0 (the default) writes all
+     * files normally
+     */
+    BSAHash directThreshold;
+  };
+
+  /**
+   * @brief location and size of a file inside the archive
+   */
+  struct FileInfo {
+    /// offset of the file data or, for textures, of the first chunk
+    BSAHash offset;
+    /// number of bytes the file occupies in the archive
+    BSAHash packedSize;
+    /// size of the extracted file. For textures this includes the dds header
+    BSAHash unpackedSize;
+    /// number of chunks of a texture, always 1 for general files
+    BSAULong chunks;
+    /// true if at least part of the data is compressed
+    bool compressed;
+  };
+
+  class Archive;
+
+  /**
+   * @brief result of opening one archive with Archive::readAll
+   */
+  struct OpenedArchive {
+    std::string fileName;
+    /// the opened archive, null if it couldn't be opened
+    std::unique_ptr<Archive> archive;
+    EErrorCode error;
+    /// description of the problem if opening failed
+    std::string errorMessage;
+  };
+
   /**
    * @brief top level structure to represent a bsa file
+   *
+   * Once read() returned, all const member functions may be called from multiple
+   * threads concurrently on the same instance: file data is accessed through
+   * positional reads and every thread uses its own decompression context.
+   * read(), close() and the other non-const functions must not run concurrently
+   * with any other call.
    */
   class Archive {
 
+    friend class EntryReader;
+    friend class ArchiveWriter;
+    friend class ArchiveDiff;
+    friend class DirectoryTree;
+    friend class ContentSearch;
+
   public:
 
     typedef std::pair<std::shared_ptr<unsigned char>, BSAULong> DataBuffer;
@@ -76,6 +233,63 @@ namespace BA2 {
      */
     EErrorCode read(const wchar_t *fileName);
 
+    /**
+     * open many archives concurrently. Opening an archive is a sequence of small
+     * dependent reads, so running them side by side keeps the storage busy.
+     * Larger archives are started first
+     * @param fileNames names of the archive files
+     * @param results receives one entry per file name, in the same order
+     * @param threads number of archives opened at the same time, 0 to pick a number
+     *                suitable for I/O bound work
+     */
+    static void readAll(const std::vector<std::string> &fileNames,
+                        std::vector<OpenedArchive> &results, unsigned int threads = 0);
+
+    /**
+     * open all .ba2 files in a directory (not its subdirectories) concurrently, see readAll
+     * @param directory the directory, usually a game's Data directory
+     * @param results receives one entry per archive, sorted by file name
+     * @param threads number of archives opened at the same time, 0 to pick a number
+     *                suitable for I/O bound work
+     * @return ERROR_NONE if the directory could be listed, errors opening
+     *         individual archives are reported in results
+     */
+    static EErrorCode readDirectory(const char *directory, std::vector<OpenedArchive> &results,
+                                    unsigned int threads = 0);
+
+    /**
+     * @return description of the problem encountered by the last call to read(). Empty
+     *         if it succeeded
+     */
+    const std::string &getLastError() const { return m_LastError; }
+
+    /**
+     * enable collection of performance counters while opening the archive.
+     * Needs to be set before calling read()
+     * @param enable true to collect statistics
+     */
+    void setCollectStatistics(bool enable) { m_CollectStatistics = enable; }
+
+    /**
+     * @return performance counters of the last call to read(). Only filled in
+     *         if collection was enabled with setCollectStatistics
+     */
+    Statistics getOpenStatistics() const { return m_OpenStatistics.snapshot(); }
+
+    /**
+     * enable caching of decompressed files read with readFile and of texture chunks
+     * read through an EntryReader. Buffers returned from the cache are shared
+     * between all callers and must not be modified.
+     * Must not be called concurrently with other functions
+     * @param capacity maximum number of bytes to cache, 0 (default) disables the cache
+     */
+    void setCacheCapacity(BSAHash capacity) { m_Cache.setCapacity(capacity); }
+
+    /**
+     * @return hit, miss and eviction counters and current size of the cache
+     */
+    CacheStatistics getCacheStatistics() const { return m_Cache.getStatistics(); }
+
     /**
      * @brief close the archive
      */
@@ -97,6 +311,101 @@ namespace BA2 {
      */
     std::vector<std::string> const getFileList();
 
+    /**
+     * @return number of files in this archive
+     */
+    BSAULong getFileCount() const { return countFiles(); }
+
+    /**
+     * retrieve location and size of a file without reading it
+     * @param index index of the file, corresponding to getFileList()
+     * @param info receives the file information
+     * @return true if the index is valid
+     */
+    bool getFileInfo(BSAULong index, FileInfo &info) const;
+
+    /**
+     * @param index index of the file, corresponding to getFileList()
+     * @return normalized name of the file (see PathKey), computed when the archive
+     *         was read. Comparing keys is the fast way to compare names across archives
+     */
+    const std::string &getFileKey(BSAULong index) const { return m_TableKeys[index]; }
+
+    /**
+     * find a file by name. The comparison is case insensitive and '/' is treated
+     * like '\'
+     * @param fileName name of the file as stored in the archive
+     * @param index receives the index of the file if found
+     * @return true if the file was found
+     */
+    bool findFile(const std::string &fileName, BSAULong &index) const;
+
+    /**
+     * read a file into memory, decompressing it if necessary. Textures are
+     * returned as complete dds files.
+     * This is thread safe.
+     * @param index index of the file, corresponding to getFileList()
+     * @param result receives the file content
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode readFile(BSAULong index, DataBuffer &result) const;
+
+    /**
+     * read a file into memory, decompressing it if necessary.
+     * This is thread safe.
+     * @param fileName name of the file as stored in the archive
+     * @param result receives the file content
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode readFile(const std::string &fileName, DataBuffer &result) const;
+
+    /**
+     * read only the beginning of a file. Compressed data is decompressed only until
+     * length bytes are produced, so this is much cheaper than readFile for large files.
+     * This is thread safe.
+     * @param index index of the file, corresponding to getFileList()
+     * @param length maximum number of bytes to read
+     * @param result receives the data. It's shorter than length if the file is smaller
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode peekFile(BSAULong index, size_t length, DataBuffer &result) const;
+
+    /**
+     * read the beginning of many files, distributed over several threads
+     * @param indices indices of the files to read
+     * @param length maximum number of bytes to read per file
+     * @param results receives one buffer per entry of indices, in the same order.
+     *                Buffers of files that couldn't be read are empty
+     * @param threads number of worker threads
+     * @return ERROR_NONE if all files were read, otherwise the error of one of the
+     *         files that failed
+     */
+    EErrorCode peekFiles(const std::vector<BSAULong> &indices, size_t length,
+                         std::vector<DataBuffer> &results, unsigned int threads = 1) const;
+
+    /**
+     * decode one mip map of a texture to 8 bit RGBA pixels, for thumbnails and
+     * previews. Only the chunk containing the mip map is read and decompressed,
+     * so small mip maps are cheap. See TextureDecoder for the supported formats.
+     * This is thread safe
+     * @param index index of the texture
+     * @param mip mip level, 0 is the full size image
+     * @param result receives width * height pixels of 4 bytes each, rows from top to bottom
+     * @param width receives the width of the mip map
+     * @param height receives the height of the mip map
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode decodeTexture(BSAULong index, BSAULong mip, DataBuffer &result,
+                             BSAULong &width, BSAULong &height) const;
+
+    /**
+     * find the largest mip map of a texture that fits into a square
+     * @param index index of the texture
+     * @param maxSize maximum width and height
+     * @return the mip level or, if none fits, the smallest mip map
+     */
+    BSAULong findMip(BSAULong index, BSAULong maxSize) const;
+
     /**
      * extract a file from the archive
      * @param outputDirectory name of the directory to extract to.
@@ -115,9 +424,42 @@ namespace BA2 {
      * @return ERROR_NONE on success or an error code
      */
     EErrorCode extractAll(const char *outputDirectory,
-      const std::function<bool(int value, std::string fileName)> &progress,
+      const ProgressCallback &progress,
       bool overwrite = true) const;
 
+    /**
+     * extract all files
+     * @param outputDirectory name of the directory to extract to.
+     *                        may be absolute or relative
+     * @param options extraction settings
+     * @return ERROR_NONE on success, ERROR_CANCELED if the progress callback
+     *         returned false or an error code
+     */
+    EErrorCode extractAll(const char *outputDirectory, const ExtractOptions &options) const;
+
+    /**
+     * read the archive in the background. Canceling only has an effect before
+     * reading started. The archive must not be used until the operation finished
+     * @param fileName name of the file to read from
+     * @param asyncOptions executor and completion callback
+     * @return handle of the operation
+     */
+    AsyncOperation readAsync(const char *fileName, const AsyncOptions &asyncOptions = AsyncOptions());
+
+    /**
+     * extract files in the background, see extractAll. The progress callback is
+     * invoked on the thread running the extraction. options.cancel is replaced by
+     * the flag of the returned operation, AsyncOperation::cancel stops the
+     * extraction. The archive has to stay open until the operation finished
+     * @param outputDirectory name of the directory to extract to.
+     *                        may be absolute or relative
+     * @param options extraction settings
+     * @param asyncOptions executor and completion callback
+     * @return handle of the operation
+     */
+    AsyncOperation extractAllAsync(const char *outputDirectory, const ExtractOptions &options,
+                                   const AsyncOptions &asyncOptions = AsyncOptions()) const;
+
   private:
 
 // these structs need to be aligned properly. pragma pack is a visual studio feature but
@@ -168,30 +510,79 @@ namespace BA2 {
       BSAULong	unk14;			// 14 - BAADFOOD
     };
 
-    struct Texture
+#pragma pack(pop)
+
+    // chunks of all textures are stored in one array, each texture references
+    // its chunks by range
+    struct ChunkRange
     {
-      FileEntry_DX10 texhdr;
-      std::vector <DX10Chunk>	texchunks;
+      BSAULong first;
+      BSAULong count;
     };
-#pragma pack(pop)
 
   private:
 
     EErrorCode read();
 
-    static Header readHeader(std::fstream &infile);
+    static Header readHeader(const std::vector<char> &buffer);
     static void writeHeader(std::fstream &outfile, EType type, BSAULong fileVersion,
-      BSAULong numFiles, BSAHash nameTableOffset);
+                            BSAULong numFiles, BSAHash nameTableOffset);
 
     static EType typeFromID(const char *typeID);
     static const char *typeToID(EType type);
 
-    bool readGeneral();
-    bool readDX10();
+    bool readGeneral(std::vector<char> &buffer);
+    bool readDX10(std::vector<char> &buffer);
     bool readNametable();
 
-    EErrorCode extractAllGeneral(const char *destination) const;
-    EErrorCode extractAllDX10(const char *destination) const;
+    void readIndexBuffer(std::vector<char> &buffer, BSAHash size) const;
+    void checkBlock(BSAHash offset, BSAULong packedLen, BSAULong unpackedLen,
+                    BSAHash dataStart, const char *kind, BSAULong index) const;
+
+    // state of one thread reading files: buffers reused between files and
+    // instrumentation
+    struct ExtractContext {
+      ExtractContext(StatisticsCollector *collector, TraceRecorder *recorder)
+        : statistics(collector), trace(recorder) {}
+      ~ExtractContext();
+      std::vector<BSAUChar> sourceBuffer;
+      std::vector<BSAUChar> destinationBuffer;
+      StatisticsCollector *statistics;
+      TraceBuffer trace;
+    };
+
+    // files of at least directThreshold bytes are written with DirectOutputBuffer, 0 disables it
+    EErrorCode extractFile(BSAULong index, const char *destination, bool overwrite,
+                           BSAHash directThreshold, ExtractContext &context,
+                           const std::atomic<bool> &canceled) const;
+    // true if the output of a file exists and has the size extracting it produces
+    bool isExtracted(BSAULong index, const char *destination) const;
+    void extractGeneral(BSAULong index, std::ostream &outFile, ExtractContext &context) const;
+    // returns false if it stopped early because the extraction was canceled
+    bool extractDX10(BSAULong index, std::ostream &outFile, ExtractContext &context,
+                     const std::atomic<bool> &canceled) const;
+    void writeOutput(std::ostream &outFile, const BSAUChar *data, size_t size,
+                     ExtractContext &context, BSAULong entry, int chunk = -1) const;
+
+    static BSAULong packedSize(const FileEntry &file);
+    static BSAULong unpackedSize(const FileEntry &file);
+    BSAHash textureSize(BSAULong index) const;
+    bool writeDDSHeader(const FileEntry_DX10 &texhdr, BSAUChar *buffer) const;
+    // reads packedLen bytes and inflates them or, if packedLen is 0, reads unpackedLen bytes.
+    // context.sourceBuffer is used as scratch space
+    void readBlock(BSAHash offset, BSAULong packedLen, BSAULong unpackedLen,
+                   BSAUChar *destination, ExtractContext &context,
+                   BSAULong entry, int chunk = -1) const;
+    // decompresses only the first length bytes of a block
+    void peekBlock(BSAHash offset, BSAULong packedLen, BSAULong unpackedLen,
+                   BSAUChar *destination, size_t length, ExtractContext &context,
+                   BSAULong entry, int chunk = -1) const;
+    EErrorCode peekFile(BSAULong index, size_t length, DataBuffer &result,
+                        ExtractContext &context) const;
+    static void growBuffer(std::vector<BSAUChar> &buffer, size_t size, StatisticsCollector *statistics);
+    StatisticsCollector *openStatistics() const {
+      return m_CollectStatistics ? &m_OpenStatistics : nullptr;
+    }
 
     void UseATIFourCC() { m_UseATIFourCC = false; }
 
@@ -203,17 +594,31 @@ namespace BA2 {
 
   private:
 
-    mutable std::fstream m_File;
+    InputFile m_File;
 
     std::vector <FileEntry> m_Files;
-    std::vector <Texture> m_Textures;
+    // DX10 index as structure of arrays. Ranges and chunks are what extraction
+    // iterates over, the texture headers are only needed to create dds headers
+    std::vector <ChunkRange> m_TextureChunks;
+    std::vector <DX10Chunk> m_Chunks;
+    std::vector <FileEntry_DX10> m_TextureHeaders;
     std::vector <std::string> m_TableNames;
+    // PathKey of each name and the lookup from key to the first file using it
+    std::vector <std::string> m_TableKeys;
+    std::unordered_map<std::string_view, BSAULong> m_KeyLookup;
 
     EType m_Type;
     Header m_Header;
 
     bool m_UseATIFourCC;
 
+    std::string m_LastError;
+
+    bool m_CollectStatistics;
+    mutable StatisticsCollector m_OpenStatistics;
+
+    mutable EntryCache m_Cache;
+
     std::mutex m_ReaderMutex;
     std::mutex m_ExtractMutex;
 
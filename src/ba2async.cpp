@@ -0,0 +1,108 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2async.h"
+#include <system_error>
+#include <thread>
+
+
+namespace BA2 {
+
+AsyncOperation AsyncOperation::start(const Work &work, const AsyncOptions &options)
+{
+  AsyncOperation operation;
+  operation.m_State = std::make_shared<State>();
+  operation.m_State->future = operation.m_State->promise.get_future().share();
+
+  std::shared_ptr<State> state = operation.m_State;
+  CompletionCallback completion = options.completion;
+  // whatever the work or the callback throw, the promise is fulfilled so nobody waits forever
+  auto task = [state, work, completion]() {
+    EErrorCode result = ERROR_CANCELED;
+    if (!state->canceled.load()) {
+      try {
+        result = work(state->canceled);
+      } catch (...) {
+        result = ERROR_INVALIDDATA;
+      }
+    }
+    if (completion) {
+      try {
+        completion(result);
+      } catch (...) {
+        // there is no one to report this to
+      }
+    }
+    state->promise.set_value(result);
+  };
+
+  if (options.executor) {
+    options.executor(task);
+  }
+  else {
+    try {
+      std::thread(task).detach();
+    } catch (const std::system_error&) {
+      // out of threads, do the work right away rather than never
+      task();
+    }
+  }
+  return operation;
+}
+
+
+void AsyncOperation::cancel()
+{
+  if (m_State != nullptr) {
+    m_State->canceled = true;
+  }
+}
+
+
+bool AsyncOperation::isCanceled() const
+{
+  return (m_State != nullptr) && m_State->canceled.load();
+}
+
+
+bool AsyncOperation::isDone() const
+{
+  return (m_State != nullptr)
+      && (m_State->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+}
+
+
+EErrorCode AsyncOperation::wait() const
+{
+  return m_State->future.get();
+}
+
+
+bool AsyncOperation::waitFor(std::chrono::milliseconds timeout) const
+{
+  return m_State->future.wait_for(timeout) == std::future_status::ready;
+}
+
+
+std::shared_future<EErrorCode> AsyncOperation::getFuture() const
+{
+  return m_State->future;
+}
+
+} // namespace BA2
@@ -0,0 +1,150 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_ASYNC_H
+#define BA2_ASYNC_H
+
+
+#include "errorcodes.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+
+
+namespace BA2 {
+
+  /**
+   * runs a task, on any thread. It must invoke the task exactly once, for
+   * example by posting it to a thread pool
+   */
+  typedef std::function<void(std::function<void()> task)> Executor;
+
+  /**
+   * callback invoked once an asynchronous operation finished
+   * @param result result of the operation
+   */
+  typedef std::function<void(EErrorCode result)> CompletionCallback;
+
+  /**
+   * @brief settings for asynchronous operations
+   */
+  struct AsyncOptions {
+    /**
+     * runs the operation. If not set, the operation gets a thread of its own
+     */
+    Executor executor;
+
+    /**
+     * optional callback invoked on the thread that ran the operation, once it
+     * finished and before the result becomes available through the future. It's
+     * also invoked for operations canceled before they started. Exceptions thrown
+     * by the callback are ignored
+     */
+    CompletionCallback completion;
+  };
+
+  /**
+   * @brief handle of an operation running in the background.
+   * Handles are cheap to copy, all copies refer to the same operation. Dropping
+   * the handles doesn't stop or wait for the operation, but everything the
+   * operation uses (like the archive it was started on) has to stay alive until
+   * it finished.
+   */
+  class AsyncOperation {
+
+  public:
+
+    /**
+     * a function doing the actual work
+     * @param canceled flag that is set once the operation should stop
+     * @return ERROR_NONE on success, ERROR_CANCELED if it stopped early or an error code.
+     *         If it throws, the operation finishes with ERROR_INVALIDDATA
+     */
+    typedef std::function<EErrorCode(const std::atomic<bool> &canceled)> Work;
+
+    /**
+     * constructs an invalid handle not referring to an operation
+     */
+    AsyncOperation() = default;
+
+    /**
+     * start an operation
+     * @param work the work to do
+     * @param options executor and completion callback
+     * @return handle of the operation
+     */
+    static AsyncOperation start(const Work &work, const AsyncOptions &options = AsyncOptions());
+
+    /**
+     * @return true if the handle refers to an operation
+     */
+    bool isValid() const { return m_State != nullptr; }
+
+    /**
+     * ask the operation to stop. This doesn't wait for it, the operation finishes
+     * with ERROR_CANCELED unless it completed before noticing the request
+     */
+    void cancel();
+
+    /**
+     * @return true if cancel was called
+     */
+    bool isCanceled() const;
+
+    /**
+     * @return true if the operation finished and its result is available
+     */
+    bool isDone() const;
+
+    /**
+     * block until the operation finished
+     * @return result of the operation
+     */
+    EErrorCode wait() const;
+
+    /**
+     * block until the operation finished or the timeout expired
+     * @param timeout maximum time to wait
+     * @return true if the operation finished
+     */
+    bool waitFor(std::chrono::milliseconds timeout) const;
+
+    /**
+     * @return future receiving the result of the operation, for use with code that
+     *         deals with futures
+     */
+    std::shared_future<EErrorCode> getFuture() const;
+
+  private:
+
+    struct State {
+      std::atomic<bool> canceled{ false };
+      std::promise<EErrorCode> promise;
+      std::shared_future<EErrorCode> future;
+    };
+
+    std::shared_ptr<State> m_State;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_ASYNC_H
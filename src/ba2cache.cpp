@@ -0,0 +1,127 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2cache.h"
+
+
+namespace BA2 {
+
+CacheStatistics::CacheStatistics()
+  : hits(0)
+  , misses(0)
+  , evictions(0)
+  , entries(0)
+  , size(0)
+  , capacity(0)
+{
+}
+
+
+EntryCache::EntryCache(BSAHash capacity)
+  : m_Capacity(capacity)
+  , m_Size(0)
+  , m_Hits(0)
+  , m_Misses(0)
+  , m_Evictions(0)
+{
+}
+
+
+void EntryCache::setCapacity(BSAHash capacity)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Capacity = capacity;
+  evict(0);
+}
+
+
+bool EntryCache::get(BSAHash key, Buffer &result)
+{
+  if (!isEnabled()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto iter = m_Index.find(key);
+  if (iter == m_Index.end()) {
+    ++m_Misses;
+    return false;
+  }
+  m_List.splice(m_List.begin(), m_List, iter->second);
+  result = iter->second->second;
+  ++m_Hits;
+  return true;
+}
+
+
+void EntryCache::put(BSAHash key, const Buffer &buffer)
+{
+  if (!isEnabled() || (buffer.second > m_Capacity)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto iter = m_Index.find(key);
+  if (iter != m_Index.end()) {
+    // another thread added the same data in the meantime
+    m_List.splice(m_List.begin(), m_List, iter->second);
+    return;
+  }
+  evict(buffer.second);
+  m_List.push_front(std::make_pair(key, buffer));
+  m_Index[key] = m_List.begin();
+  m_Size += buffer.second;
+}
+
+
+void EntryCache::clear()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_List.clear();
+  m_Index.clear();
+  m_Size = 0;
+}
+
+
+CacheStatistics EntryCache::getStatistics() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  CacheStatistics result;
+  result.hits = m_Hits;
+  result.misses = m_Misses;
+  result.evictions = m_Evictions;
+  result.entries = m_List.size();
+  result.size = m_Size;
+  result.capacity = m_Capacity;
+  return result;
+}
+
+
+void EntryCache::evict(BSAHash required)
+{
+  while (!m_List.empty() && (m_Size + required > m_Capacity)) {
+    const std::pair<BSAHash, Buffer> &last = m_List.back();
+    m_Size -= last.second.second;
+    m_Index.erase(last.first);
+    m_List.pop_back();
+    ++m_Evictions;
+  }
+}
+
+} // namespace BA2
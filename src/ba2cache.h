@@ -0,0 +1,138 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_CACHE_H
+#define BA2_CACHE_H
+
+
+#include "ba2types.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+
+namespace BA2 {
+
+  /**
+   * @brief counters of an EntryCache
+   */
+  struct CacheStatistics {
+    CacheStatistics();
+
+    /// lookups that found a buffer
+    BSAHash hits;
+    /// lookups that didn't find a buffer
+    BSAHash misses;
+    /// buffers removed to make room for new ones
+    BSAHash evictions;
+    /// number of buffers currently held
+    BSAHash entries;
+    /// number of bytes currently held
+    BSAHash size;
+    /// maximum number of bytes held
+    BSAHash capacity;
+  };
+
+  /**
+   * @brief thread safe, size bounded cache of decompressed data, discarding the
+   * least recently used buffers first.
+   * Buffers are shared with the caller, not copied, so they must not be modified
+   * once they were added. A capacity of 0 disables the cache, lookups then fail
+   * without being counted.
+   */
+  class EntryCache {
+
+  public:
+
+    typedef std::pair<std::shared_ptr<unsigned char>, BSAULong> Buffer;
+
+  public:
+
+    explicit EntryCache(BSAHash capacity = 0);
+
+    EntryCache(const EntryCache&) = delete;
+    EntryCache &operator=(const EntryCache&) = delete;
+
+    /**
+     * @return key of a file or, if chunk isn't negative, of one chunk of a texture
+     */
+    static BSAHash makeKey(BSAULong entry, int chunk = -1) {
+      return (static_cast<BSAHash>(entry) << 32) | static_cast<BSAULong>(chunk + 1);
+    }
+
+    /**
+     * @return true if the cache holds anything at all
+     */
+    bool isEnabled() const { return m_Capacity != 0; }
+
+    /**
+     * change the maximum size, discarding buffers if necessary. Must not be
+     * called concurrently with other functions
+     * @param capacity maximum number of bytes to hold, 0 disables the cache
+     */
+    void setCapacity(BSAHash capacity);
+
+    /**
+     * look up a buffer and mark it as most recently used
+     * @param key key of the buffer
+     * @param result receives the buffer if found
+     * @return true if the buffer was found
+     */
+    bool get(BSAHash key, Buffer &result);
+
+    /**
+     * add a buffer. Buffers larger than the capacity aren't added. If the key is
+     * already present the existing buffer is kept
+     * @param key key of the buffer
+     * @param buffer the buffer
+     */
+    void put(BSAHash key, const Buffer &buffer);
+
+    /**
+     * @brief remove all buffers, counters are kept
+     */
+    void clear();
+
+    CacheStatistics getStatistics() const;
+
+  private:
+
+    void evict(BSAHash required);
+
+  private:
+
+    typedef std::list<std::pair<BSAHash, Buffer>> List;
+
+    mutable std::mutex m_Mutex;
+    // most recently used in front
+    List m_List;
+    std::unordered_map<BSAHash, List::iterator> m_Index;
+    BSAHash m_Capacity;
+    BSAHash m_Size;
+    BSAHash m_Hits;
+    BSAHash m_Misses;
+    BSAHash m_Evictions;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_CACHE_H
@@ -0,0 +1,1059 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2archive.h"
+#include "ba2diff.h"
+#include "ba2directorytree.h"
+#include "ba2exception.h"
+#include "ba2pathkey.h"
+#include "ba2search.h"
+#include "ba2trace.h"
+#include "ba2writer.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace BA2;
+
+
+namespace {
+
+const char *errorString(EErrorCode code)
+{
+  switch (code) {
+    case ERROR_NONE: return "no error";
+    case ERROR_INVALIDHASHES: return "invalid hashes";
+    case ERROR_FILENOTFOUND: return "file not found";
+    case ERROR_INVALIDDATA: return "invalid data";
+    case ERROR_ACCESSFAILED: return "access failed";
+    case ERROR_ZLIBINITFAILED: return "zlib initialization failed";
+    case ERROR_SOURCEFILEMISSING: return "source file missing";
+    case ERROR_CANCELED: return "canceled";
+    default: return "unknown error";
+  }
+}
+
+
+void usage()
+{
+  fprintf(stderr,
+    "usage: ba2tk <command> [options]\n"
+    "\n"
+    "  list [--json] [--long] <archive> [pattern...]\n"
+    "      list files, --long adds offsets and sizes, --json prints all details as json\n"
+    "  extract [--jobs N] [--no-overwrite] [--stats] [--trace FILE] [--journal FILE]\n"
+    "          [--direct MB] <archive> <directory> [pattern...]\n"
+    "      extract files, all of them if no pattern is given. With --journal an\n"
+    "      interrupted extraction continues where it stopped when run again.\n"
+    "      --direct writes files of at least MB megabytes bypassing the page cache\n"
+    "  verify [--jobs N] <archive> [pattern...]\n"
+    "      decompress files without writing them to check the archive for errors\n"
+    "  merge [--exclude PATTERN]... [--order FILE] <output> <archive>...\n"
+    "      combine archives without recompressing, files of later archives replace\n"
+    "      files with the same name in earlier ones. With a single archive and\n"
+    "      --order this rewrites an archive with a new layout\n"
+    "  thumbnails [--size N] [--jobs N] <archive> <directory> [pattern...]\n"
+    "      decode the largest mip map of each texture that fits into N x N pixels\n"
+    "      (default 256) and save it as a tga file\n"
+    "  tree [--depth N] <archive> [directory]\n"
+    "      print the directories below directory (default: all) with the number of\n"
+    "      files and their packed and unpacked size, up to N levels deep\n"
+    "  scan [--jobs N] <directory|archive...>\n"
+    "      open all archives of a directory or the given archives concurrently and\n"
+    "      print their type and number of files\n"
+    "  diff [--jobs N] <old archive> <new archive>\n"
+    "      list added (A), removed (D) and modified (M) files. Compressed files are\n"
+    "      only decompressed if their stored data differs\n"
+    "  grep [--jobs N] [--ignore-case] [--regex] [--prefilter TEXT] [--max-count N]\n"
+    "       [--include PATTERN]... [--extension EXT]... <text> <archive>...\n"
+    "      search the content of files for text, or a regular expression with\n"
+    "      --regex, and print archive, file and offset of each match. --include and\n"
+    "      --extension select the files to search, with --regex only files\n"
+    "      containing the --prefilter text are searched\n"
+    "  pack [--type gnrl|dx10] [--level N] [--compression adaptive|always|never]\n"
+    "       [--order FILE] <archive> <directory>\n"
+    "      create an archive from the files of a directory, identical files are\n"
+    "      stored once. dx10 archives take dds files. adaptive compression stores\n"
+    "      files that are already compressed\n"
+    "  update [--exclude PATTERN]... [--level N] [--compression adaptive|always|never]\n"
+    "         [--compact] <archive> [directory]\n"
+    "      add or replace the files of a directory and remove excluded files in\n"
+    "      place, only changed data is written. --compact rewrites the archive to\n"
+    "      reclaim the space of replaced files\n"
+    "\n"
+    "patterns are matched case insensitively against the full name in the archive.\n"
+    "'*' matches any sequence of characters including separators, '?' any single\n"
+    "character, '/' and '\\' are interchangeable.\n"
+    "--jobs defaults to the number of cores\n"
+    "--order lays files out in load order. FILE lists one name per line or is a\n"
+    "trace written by extract --trace, then files are ordered by first access\n");
+}
+
+
+// iterative wildcard matching with backtracking to the most recent '*'. Both
+// pattern and name are PathKeys, so characters compare as they are
+bool matchGlob(const char *pattern, const char *name)
+{
+  const char *starPattern = nullptr;
+  const char *starName = nullptr;
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      starPattern = pattern++;
+      starName = name;
+    }
+    else if ((*pattern != '\0') && ((*pattern == '?') || (*pattern == *name))) {
+      ++pattern;
+      ++name;
+    }
+    else if (starPattern != nullptr) {
+      pattern = starPattern + 1;
+      name = ++starName;
+    }
+    else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+
+// patterns are normalized once so matching works on the keys the archive computed
+std::vector<std::string> makePatterns(std::vector<std::string>::const_iterator begin,
+                                      std::vector<std::string>::const_iterator end)
+{
+  std::vector<std::string> result;
+  for (auto iter = begin; iter != end; ++iter) {
+    result.push_back(PathKey::normalize(*iter));
+  }
+  return result;
+}
+
+
+bool matchAny(const std::vector<std::string> &patterns, const std::string &key)
+{
+  if (patterns.empty()) {
+    return true;
+  }
+  for (const std::string &pattern : patterns) {
+    if (matchGlob(pattern.c_str(), key.c_str())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// command line of a subcommand: options with their values and the remaining
+// positional arguments
+struct Arguments {
+  std::vector<std::string> positional;
+  bool json = false;
+  bool longFormat = false;
+  bool overwrite = true;
+  bool stats = false;
+  std::string trace;
+  std::string journal;
+  unsigned int direct = 0;
+  std::vector<std::string> excludes;
+  std::vector<std::string> includes;
+  std::vector<std::string> extensions;
+  bool regex = false;
+  bool ignoreCase = false;
+  std::string prefilter;
+  unsigned int maxCount = 0;
+  std::string type = "gnrl";
+  int level = -1;
+  unsigned int size = 256;
+  std::string compression = "adaptive";
+  std::string order;
+  bool compact = false;
+  unsigned int depth = UINT_MAX;
+  unsigned int jobs = std::max(1u, std::thread::hardware_concurrency());
+};
+
+
+bool parseArguments(int argc, char **argv, Arguments &arguments)
+{
+  for (int i = 0; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "--jobs") || (arg == "-j")) {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.jobs = static_cast<unsigned int>(std::max(1, atoi(argv[i])));
+    }
+    else if (arg == "--trace") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.trace = argv[i];
+    }
+    else if (arg == "--direct") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.direct = static_cast<unsigned int>(std::max(1, atoi(argv[i])));
+    }
+    else if (arg == "--journal") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.journal = argv[i];
+    }
+    else if (arg == "--type") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.type = argv[i];
+    }
+    else if (arg == "--order") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.order = argv[i];
+    }
+    else if (arg == "--compression") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.compression = argv[i];
+    }
+    else if (arg == "--depth") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.depth = static_cast<unsigned int>(std::max(0, atoi(argv[i])));
+    }
+    else if (arg == "--size") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.size = static_cast<unsigned int>(std::max(1, atoi(argv[i])));
+    }
+    else if (arg == "--level") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.level = atoi(argv[i]);
+    }
+    else if (arg == "--exclude") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.excludes.push_back(PathKey::normalize(argv[i]));
+    }
+    else if (arg == "--include") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.includes.push_back(PathKey::normalize(argv[i]));
+    }
+    else if (arg == "--extension") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.extensions.push_back(argv[i]);
+    }
+    else if (arg == "--prefilter") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.prefilter = argv[i];
+    }
+    else if (arg == "--max-count") {
+      if (++i >= argc) {
+        return false;
+      }
+      arguments.maxCount = static_cast<unsigned int>(std::max(0, atoi(argv[i])));
+    }
+    else if (arg == "--json") arguments.json = true;
+    else if (arg == "--regex") arguments.regex = true;
+    else if ((arg == "--ignore-case") || (arg == "-i")) arguments.ignoreCase = true;
+    else if ((arg == "--long") || (arg == "-l")) arguments.longFormat = true;
+    else if (arg == "--no-overwrite") arguments.overwrite = false;
+    else if (arg == "--stats") arguments.stats = true;
+    else if (arg == "--compact") arguments.compact = true;
+    else if (arg == "--") {
+      arguments.positional.insert(arguments.positional.end(), argv + i + 1, argv + argc);
+      break;
+    }
+    else if ((arg.size() > 1) && (arg[0] == '-')) {
+      fprintf(stderr, "unknown option %s\n", arg.c_str());
+      return false;
+    }
+    else arguments.positional.push_back(arg);
+  }
+  return true;
+}
+
+
+bool readOrder(const std::string &fileName, std::vector<std::string> &names)
+{
+  std::ifstream file(fileName);
+  if (!file.is_open()) {
+    fprintf(stderr, "failed to open %s\n", fileName.c_str());
+    return false;
+  }
+
+  std::string line;
+  if (file.peek() != '{') {
+    while (std::getline(file, line)) {
+      if (!line.empty() && (line.back() == '\r')) {
+        line.pop_back();
+      }
+      if (!line.empty() && (line[0] != '#')) {
+        names.push_back(line);
+      }
+    }
+    return true;
+  }
+
+  // a trace written by extract --trace
+  TraceRecorder trace;
+  if (!trace.readChromeTrace(fileName.c_str())) {
+    fprintf(stderr, "%s is not a valid trace\n", fileName.c_str());
+    return false;
+  }
+  names = trace.getAccessOrder();
+  return true;
+}
+
+
+bool openArchive(Archive &archive, const std::string &fileName)
+{
+  EErrorCode error = archive.read(fileName.c_str());
+  if (error != ERROR_NONE) {
+    const std::string &message = archive.getLastError();
+    fprintf(stderr, "failed to open %s: %s\n", fileName.c_str(),
+            message.empty() ? errorString(error) : message.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+int listFiles(const Arguments &arguments)
+{
+  if (arguments.positional.empty()) {
+    usage();
+    return 2;
+  }
+
+  Archive archive;
+  if (!openArchive(archive, arguments.positional[0])) {
+    return 1;
+  }
+
+  std::vector<std::string> patterns = makePatterns(arguments.positional.begin() + 1, arguments.positional.end());
+  std::vector<std::string> files = archive.getFileList();
+
+  if (arguments.json) {
+    printf("{\"type\":\"%s\",\"files\":[", archive.getType() == TYPE_DX10 ? "DX10" : "GNRL");
+  }
+  bool first = true;
+  for (BSAULong i = 0; i < files.size(); ++i) {
+    if (!matchAny(patterns, archive.getFileKey(i))) {
+      continue;
+    }
+    FileInfo info;
+    archive.getFileInfo(i, info);
+    if (arguments.json) {
+      printf(first ? "\n" : ",\n");
+      printf("{\"index\":%u,\"name\":", i);
+      fputs(makeJSONString(files[i]).c_str(), stdout);
+      printf(",\"offset\":%llu,\"packed\":%llu,\"unpacked\":%llu,\"chunks\":%u,\"compressed\":%s}",
+             static_cast<unsigned long long>(info.offset),
+             static_cast<unsigned long long>(info.packedSize),
+             static_cast<unsigned long long>(info.unpackedSize),
+             info.chunks, info.compressed ? "true" : "false");
+    }
+    else if (arguments.longFormat) {
+      printf("%12llu %12llu %12llu  %s\n", static_cast<unsigned long long>(info.offset),
+             static_cast<unsigned long long>(info.packedSize),
+             static_cast<unsigned long long>(info.unpackedSize), files[i].c_str());
+    }
+    else {
+      printf("%s\n", files[i].c_str());
+    }
+    first = false;
+  }
+  if (arguments.json) {
+    printf("\n]}\n");
+  }
+  return 0;
+}
+
+
+void printStatistics(const Statistics &statistics, BSAULong files, double seconds)
+{
+  auto milliseconds = [](std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+  double megabytes = statistics.bytesWritten / (1024.0 * 1024.0);
+  fprintf(stderr,
+          "files:           %u\n"
+          "bytes read:      %llu in %llu calls\n"
+          "bytes inflated:  %llu\n"
+          "bytes written:   %llu\n"
+          "peak buffers:    %llu bytes\n"
+          "wall time:       %.1f ms (%.1f MB/s)\n"
+          "inflate time:    %.1f ms\n"
+          "open time:       %.1f ms\n"
+          "write time:      %.1f ms\n",
+          files,
+          static_cast<unsigned long long>(statistics.bytesRead),
+          static_cast<unsigned long long>(statistics.readCalls),
+          static_cast<unsigned long long>(statistics.bytesInflated),
+          static_cast<unsigned long long>(statistics.bytesWritten),
+          static_cast<unsigned long long>(statistics.peakBufferMemory),
+          seconds * 1000.0, seconds > 0.0 ? megabytes / seconds : 0.0,
+          milliseconds(statistics.inflateTime),
+          milliseconds(statistics.outputOpenTime),
+          milliseconds(statistics.outputWriteTime));
+}
+
+
+int extractFiles(const Arguments &arguments)
+{
+  if (arguments.positional.size() < 2) {
+    usage();
+    return 2;
+  }
+
+  Archive archive;
+  if (!openArchive(archive, arguments.positional[0])) {
+    return 1;
+  }
+
+  std::vector<std::string> patterns = makePatterns(arguments.positional.begin() + 2, arguments.positional.end());
+  std::atomic<BSAULong> filesDone(0);
+  Statistics statistics;
+  TraceRecorder trace;
+
+  ExtractOptions options;
+  options.threads = arguments.jobs;
+  options.overwrite = arguments.overwrite;
+  options.filesDone = &filesDone;
+  options.journal = arguments.journal;
+  options.directThreshold = static_cast<BSAHash>(arguments.direct) * 1024 * 1024;
+  if (!patterns.empty()) {
+    options.filter = [&patterns, &archive](BSAULong index, const std::string&) {
+      return matchAny(patterns, archive.getFileKey(index));
+    };
+  }
+  if (arguments.stats) {
+    options.statistics = &statistics;
+  }
+  if (!arguments.trace.empty()) {
+    options.trace = &trace;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  EErrorCode error = archive.extractAll(arguments.positional[1].c_str(), options);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (arguments.stats) {
+    printStatistics(statistics, filesDone.load(), seconds);
+  }
+  if (!arguments.trace.empty() && !trace.writeChromeTrace(arguments.trace.c_str())) {
+    fprintf(stderr, "failed to write trace to %s\n", arguments.trace.c_str());
+  }
+
+  if (error != ERROR_NONE) {
+    fprintf(stderr, "extraction failed: %s\n", errorString(error));
+    return 1;
+  }
+  return 0;
+}
+
+
+int verifyFiles(const Arguments &arguments)
+{
+  if (arguments.positional.empty()) {
+    usage();
+    return 2;
+  }
+
+  Archive archive;
+  if (!openArchive(archive, arguments.positional[0])) {
+    return 1;
+  }
+
+  std::vector<std::string> patterns = makePatterns(arguments.positional.begin() + 1, arguments.positional.end());
+  std::vector<std::string> files = archive.getFileList();
+  std::vector<BSAULong> selection;
+  for (BSAULong i = 0; i < files.size(); ++i) {
+    if (matchAny(patterns, archive.getFileKey(i))) {
+      selection.push_back(i);
+    }
+  }
+
+  // readFile is thread safe so files are simply distributed over the workers
+  std::atomic<size_t> next(0);
+  std::atomic<BSAULong> failures(0);
+  std::mutex outputMutex;
+  auto worker = [&]() {
+    Archive::DataBuffer buffer;
+    for (size_t position = next++; position < selection.size(); position = next++) {
+      BSAULong index = selection[position];
+      EErrorCode error = archive.readFile(index, buffer);
+      if (error != ERROR_NONE) {
+        ++failures;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        fprintf(stderr, "%s: %s\n", files[index].c_str(), errorString(error));
+      }
+    }
+  };
+
+  unsigned int numThreads = std::max<unsigned int>(1, std::min<size_t>(arguments.jobs, selection.size()));
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    threads.push_back(std::thread(worker));
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  printf("%u files verified, %u failed\n",
+         static_cast<unsigned int>(selection.size()), failures.load());
+  return failures.load() == 0 ? 0 : 1;
+}
+
+
+// 32 bit uncompressed targa with the origin at the top left
+bool writeTGA(const std::string &fileName, const BSAUChar *rgba, BSAULong width, BSAULong height)
+{
+  std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  BSAUChar header[18] = { 0 };
+  header[2] = 2;
+  header[12] = static_cast<BSAUChar>(width & 0xFF);
+  header[13] = static_cast<BSAUChar>(width >> 8);
+  header[14] = static_cast<BSAUChar>(height & 0xFF);
+  header[15] = static_cast<BSAUChar>(height >> 8);
+  header[16] = 32;
+  header[17] = 0x28;
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  std::vector<BSAUChar> bgra(static_cast<size_t>(width) * height * 4);
+  for (size_t i = 0; i < bgra.size(); i += 4) {
+    bgra[i] = rgba[i + 2];
+    bgra[i + 1] = rgba[i + 1];
+    bgra[i + 2] = rgba[i];
+    bgra[i + 3] = rgba[i + 3];
+  }
+  file.write(reinterpret_cast<const char*>(bgra.data()), bgra.size());
+  return !file.fail();
+}
+
+
+// names come from the archive, so they are appended as strings the way the library
+// builds extraction paths and names that could leave the directory are refused
+bool thumbnailPath(const std::string &directory, std::string name, std::string &result)
+{
+  std::replace(name.begin(), name.end(), '\\', '/');
+  if (name.empty() || (name[0] == '/') || (name.find(':') != std::string::npos)) {
+    return false;
+  }
+  for (size_t start = 0; start <= name.size();) {
+    size_t end = std::min(name.find('/', start), name.size());
+    if (name.compare(start, end - start, "..") == 0) {
+      return false;
+    }
+    start = end + 1;
+  }
+
+  size_t extension = name.rfind('.');
+  if ((extension != std::string::npos) && (name.find('/', extension) == std::string::npos)) {
+    name.erase(extension);
+  }
+  result = directory + "/" + name + ".tga";
+  return true;
+}
+
+
+int createThumbnails(const Arguments &arguments)
+{
+  if (arguments.positional.size() < 2) {
+    usage();
+    return 2;
+  }
+
+  Archive archive;
+  if (!openArchive(archive, arguments.positional[0])) {
+    return 1;
+  }
+  if (archive.getType() != TYPE_DX10) {
+    fprintf(stderr, "%s doesn't contain textures\n", arguments.positional[0].c_str());
+    return 1;
+  }
+
+  std::vector<std::string> patterns = makePatterns(arguments.positional.begin() + 2, arguments.positional.end());
+  std::vector<std::string> files = archive.getFileList();
+  std::vector<BSAULong> selection;
+  for (BSAULong i = 0; i < files.size(); ++i) {
+    if (matchAny(patterns, archive.getFileKey(i))) {
+      selection.push_back(i);
+    }
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<BSAULong> failures(0);
+  std::mutex outputMutex;
+  auto worker = [&]() {
+    Archive::DataBuffer pixels;
+    for (size_t position = next++; position < selection.size(); position = next++) {
+      BSAULong index = selection[position];
+      std::string output;
+      if (!thumbnailPath(arguments.positional[1], files[index], output)) {
+        ++failures;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        fprintf(stderr, "%s: invalid file name\n", files[index].c_str());
+        continue;
+      }
+
+      BSAULong width = 0;
+      BSAULong height = 0;
+      EErrorCode error = archive.decodeTexture(index, archive.findMip(index, arguments.size), pixels,
+                                               width, height);
+      std::error_code ec;
+      std::filesystem::create_directories(std::filesystem::path(output).parent_path(), ec);
+      if ((error == ERROR_NONE) && !writeTGA(output, pixels.first.get(), width, height)) {
+        error = ERROR_ACCESSFAILED;
+      }
+      if (error != ERROR_NONE) {
+        ++failures;
+        std::lock_guard<std::mutex> lock(outputMutex);
+        fprintf(stderr, "%s: %s\n", files[index].c_str(), errorString(error));
+      }
+    }
+  };
+
+  unsigned int numThreads = std::max<unsigned int>(1, std::min<size_t>(arguments.jobs, selection.size()));
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    threads.push_back(std::thread(worker));
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  printf("%u thumbnails written, %u failed\n",
+         static_cast<unsigned int>(selection.size() - failures.load()), failures.load());
+  return failures.load() == 0 ? 0 : 1;
+}
+
+
+int mergeArchives(const Arguments &arguments)
+{
+  if (arguments.positional.size() < 2) {
+    usage();
+    return 2;
+  }
+
+  // all sources have to stay open until the output is written
+  std::vector<std::unique_ptr<Archive>> sources;
+  for (size_t i = 1; i < arguments.positional.size(); ++i) {
+    sources.push_back(std::unique_ptr<Archive>(new Archive()));
+    if (!openArchive(*sources.back(), arguments.positional[i])) {
+      return 1;
+    }
+  }
+
+  ArchiveWriter writer(sources.front()->getType());
+  if (!arguments.order.empty()) {
+    std::vector<std::string> order;
+    if (!readOrder(arguments.order, order)) {
+      return 1;
+    }
+    writer.setOrder(order);
+  }
+  for (size_t i = 0; i < sources.size(); ++i) {
+    const Archive &source = *sources[i];
+    EErrorCode error = writer.addArchive(source, [&arguments, &source](BSAULong index, const std::string&) {
+      return arguments.excludes.empty() || !matchAny(arguments.excludes, source.getFileKey(index));
+    });
+    if (error != ERROR_NONE) {
+      fprintf(stderr, "failed to add %s: %s\n", arguments.positional[i + 1].c_str(),
+              writer.getLastError().c_str());
+      return 1;
+    }
+  }
+
+  if (writer.write(arguments.positional[0].c_str()) != ERROR_NONE) {
+    fprintf(stderr, "failed to write %s: %s\n", arguments.positional[0].c_str(),
+            writer.getLastError().c_str());
+    return 1;
+  }
+  printf("%u files written to %s\n", writer.getFileCount(), arguments.positional[0].c_str());
+  return 0;
+}
+
+
+int scanArchives(const Arguments &arguments)
+{
+  if (arguments.positional.empty()) {
+    usage();
+    return 2;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<OpenedArchive> results;
+  std::error_code ec;
+  if ((arguments.positional.size() == 1) && std::filesystem::is_directory(arguments.positional[0], ec)) {
+    if (Archive::readDirectory(arguments.positional[0].c_str(), results, arguments.jobs) != ERROR_NONE) {
+      fprintf(stderr, "failed to list %s\n", arguments.positional[0].c_str());
+      return 1;
+    }
+  }
+  else {
+    Archive::readAll(arguments.positional, results, arguments.jobs);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+  int failures = 0;
+  BSAHash files = 0;
+  for (const OpenedArchive &result : results) {
+    if (result.archive) {
+      BSAULong count = result.archive->getFileCount();
+      printf("%s %8u  %s\n", result.archive->getType() == TYPE_DX10 ? "DX10" : "GNRL", count,
+             result.fileName.c_str());
+      files += count;
+    }
+    else {
+      fprintf(stderr, "failed to open %s: %s\n", result.fileName.c_str(),
+              result.errorMessage.empty() ? errorString(result.error) : result.errorMessage.c_str());
+      ++failures;
+    }
+  }
+  printf("%u archives with %llu files opened in %lld ms, %d failed\n",
+         static_cast<unsigned int>(results.size() - failures), static_cast<unsigned long long>(files),
+         static_cast<long long>(elapsed.count()), failures);
+  return failures == 0 ? 0 : 1;
+}
+
+
+void printTree(const DirectoryTree &tree, BSAULong directory, unsigned int depth,
+               unsigned int maxDepth)
+{
+  printf("%*s%s\\  %u files, %llu packed, %llu unpacked\n", depth * 2, "",
+         directory == DirectoryTree::ROOT ? "" : tree.getName(directory).c_str(),
+         tree.getFileCount(directory, true),
+         static_cast<unsigned long long>(tree.getPackedSize(directory)),
+         static_cast<unsigned long long>(tree.getUnpackedSize(directory)));
+  if (depth < maxDepth) {
+    for (BSAULong child : tree.getSubdirectories(directory)) {
+      printTree(tree, child, depth + 1, maxDepth);
+    }
+  }
+}
+
+
+int showTree(const Arguments &arguments)
+{
+  if (arguments.positional.empty()) {
+    usage();
+    return 2;
+  }
+
+  Archive archive;
+  if (!openArchive(archive, arguments.positional[0])) {
+    return 1;
+  }
+
+  DirectoryTree tree;
+  tree.build(archive);
+
+  BSAULong directory = DirectoryTree::ROOT;
+  if ((arguments.positional.size() > 1)
+      && !tree.findDirectory(arguments.positional[1], directory)) {
+    fprintf(stderr, "%s not found in %s\n", arguments.positional[1].c_str(),
+            arguments.positional[0].c_str());
+    return 1;
+  }
+
+  if (directory != DirectoryTree::ROOT) {
+    printf("%s\n", tree.getPath(directory).c_str());
+  }
+  printTree(tree, directory, 0, arguments.depth);
+  return 0;
+}
+
+
+int diffArchives(const Arguments &arguments)
+{
+  if (arguments.positional.size() != 2) {
+    usage();
+    return 2;
+  }
+
+  Archive oldArchive;
+  Archive newArchive;
+  if (!openArchive(oldArchive, arguments.positional[0]) || !openArchive(newArchive, arguments.positional[1])) {
+    return 1;
+  }
+
+  ArchiveDiff diff;
+  EErrorCode error = diff.compare(oldArchive, newArchive, arguments.jobs);
+  if (error != ERROR_NONE) {
+    fprintf(stderr, "failed to compare: %s\n",
+            diff.getLastError().empty() ? errorString(error) : diff.getLastError().c_str());
+    return 1;
+  }
+
+  BSAULong counts[3] = { 0, 0, 0 };
+  for (const ArchiveChange &change : diff.getChanges()) {
+    static const char codes[] = { 'A', 'D', 'M' };
+    printf("%c %s\n", codes[change.type], change.name.c_str());
+    ++counts[change.type];
+  }
+  printf("%u added, %u removed, %u modified, %u of %u matched files decompressed\n",
+         counts[CHANGE_ADDED], counts[CHANGE_REMOVED], counts[CHANGE_MODIFIED],
+         diff.getDecompressedCount(), diff.getMatchedCount());
+  return 0;
+}
+
+
+int searchArchives(const Arguments &arguments)
+{
+  if (arguments.positional.size() < 2) {
+    usage();
+    return 2;
+  }
+
+  ContentSearch search;
+  if (!arguments.regex) {
+    search.setLiteral(arguments.positional[0], arguments.ignoreCase);
+  }
+  else if (!search.setRegex(arguments.positional[0], arguments.ignoreCase)) {
+    fprintf(stderr, "invalid regular expression: %s\n", search.getLastError().c_str());
+    return 2;
+  }
+  search.setPrefilter(arguments.prefilter);
+  search.setMaxMatchesPerFile(arguments.maxCount);
+  for (const std::string &extension : arguments.extensions) {
+    search.addExtension(extension);
+  }
+
+  BSAULong matchCount = 0;
+  BSAULong fileCount = 0;
+  int status = 0;
+  for (size_t i = 1; i < arguments.positional.size(); ++i) {
+    const std::string &fileName = arguments.positional[i];
+    Archive archive;
+    if (!openArchive(archive, fileName)) {
+      status = 1;
+      continue;
+    }
+    search.setFilter([&arguments, &archive](BSAULong index, const std::string&) {
+      return matchAny(arguments.includes, archive.getFileKey(index));
+    });
+
+    EErrorCode error = search.search(archive, arguments.jobs);
+    if (error != ERROR_NONE) {
+      fprintf(stderr, "failed to search %s: %s\n", fileName.c_str(),
+              search.getLastError().empty() ? errorString(error) : search.getLastError().c_str());
+      status = 1;
+      continue;
+    }
+
+    std::vector<std::string> files = archive.getFileList();
+    BSAULong lastIndex = UINT_MAX;
+    for (const SearchMatch &match : search.getMatches()) {
+      printf("%s:%s:%llu\n", fileName.c_str(), files[match.index].c_str(),
+             static_cast<unsigned long long>(match.offset));
+      if (match.index != lastIndex) {
+        ++fileCount;
+        lastIndex = match.index;
+      }
+    }
+    matchCount += static_cast<BSAULong>(search.getMatches().size());
+  }
+
+  printf("%u matches in %u files\n", matchCount, fileCount);
+  return status;
+}
+
+
+bool setCompression(const Arguments &arguments, ArchiveWriter &writer)
+{
+  static const std::map<std::string, ECompressionPolicy> policies = {
+    { "adaptive", COMPRESSION_ADAPTIVE },
+    { "always", COMPRESSION_ALWAYS },
+    { "never", COMPRESSION_NEVER }
+  };
+  auto policy = policies.find(arguments.compression);
+  if (policy == policies.end()) {
+    return false;
+  }
+  writer.setCompressionLevel(arguments.level);
+  writer.setCompressionPolicy(policy->second);
+  return true;
+}
+
+
+int packFiles(const Arguments &arguments)
+{
+  if ((arguments.positional.size() != 2) || ((arguments.type != "gnrl") && (arguments.type != "dx10"))) {
+    usage();
+    return 2;
+  }
+
+  ArchiveWriter writer(arguments.type == "dx10" ? TYPE_DX10 : TYPE_GENERAL);
+  if (!setCompression(arguments, writer)) {
+    usage();
+    return 2;
+  }
+  if (!arguments.order.empty()) {
+    std::vector<std::string> order;
+    if (!readOrder(arguments.order, order)) {
+      return 1;
+    }
+    writer.setOrder(order);
+  }
+  if (writer.addDirectory(arguments.positional[1].c_str()) != ERROR_NONE) {
+    fprintf(stderr, "failed to add %s: %s\n", arguments.positional[1].c_str(),
+            writer.getLastError().c_str());
+    return 1;
+  }
+
+  if (writer.write(arguments.positional[0].c_str()) != ERROR_NONE) {
+    fprintf(stderr, "failed to write %s: %s\n", arguments.positional[0].c_str(),
+            writer.getLastError().c_str());
+    return 1;
+  }
+  printf("%u files written to %s, %u duplicates (%llu bytes) stored once, %u files uncompressed\n",
+         writer.getFileCount(), arguments.positional[0].c_str(), writer.getDuplicateCount(),
+         static_cast<unsigned long long>(writer.getDuplicateSize()), writer.getStoredCount());
+  return 0;
+}
+
+
+int updateArchive(const Arguments &arguments)
+{
+  if ((arguments.positional.size() < 1) || (arguments.positional.size() > 2)) {
+    usage();
+    return 2;
+  }
+
+  const std::string &fileName = arguments.positional[0];
+  Archive archive;
+  if (!openArchive(archive, fileName)) {
+    return 1;
+  }
+
+  ArchiveWriter writer(archive.getType());
+  if (!setCompression(arguments, writer)) {
+    usage();
+    return 2;
+  }
+  EErrorCode error = writer.addArchive(archive, [&arguments, &archive](BSAULong index, const std::string&) {
+    return arguments.excludes.empty() || !matchAny(arguments.excludes, archive.getFileKey(index));
+  });
+  if ((error == ERROR_NONE) && (arguments.positional.size() > 1)) {
+    error = writer.addDirectory(arguments.positional[1].c_str());
+  }
+  if (error != ERROR_NONE) {
+    fprintf(stderr, "failed to update %s: %s\n", fileName.c_str(), writer.getLastError().c_str());
+    return 1;
+  }
+
+  error = arguments.compact ? writer.write(fileName.c_str())
+                            : writer.update(archive, fileName.c_str());
+  if (error != ERROR_NONE) {
+    fprintf(stderr, "failed to write %s: %s\n", fileName.c_str(), writer.getLastError().c_str());
+    return 1;
+  }
+  printf("%s now contains %u files\n", fileName.c_str(), writer.getFileCount());
+  return 0;
+}
+
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+
+  std::string command = argv[1];
+  Arguments arguments;
+  if (!parseArguments(argc - 2, argv + 2, arguments)) {
+    usage();
+    return 2;
+  }
+
+  if (command == "list") {
+    return listFiles(arguments);
+  }
+  else if (command == "extract") {
+    return extractFiles(arguments);
+  }
+  else if (command == "verify") {
+    return verifyFiles(arguments);
+  }
+  else if (command == "merge") {
+    return mergeArchives(arguments);
+  }
+  else if (command == "pack") {
+    return packFiles(arguments);
+  }
+  else if (command == "thumbnails") {
+    return createThumbnails(arguments);
+  }
+  else if (command == "tree") {
+    return showTree(arguments);
+  }
+  else if (command == "scan") {
+    return scanArchives(arguments);
+  }
+  else if (command == "grep") {
+    return searchArchives(arguments);
+  }
+  else if (command == "diff") {
+    return diffArchives(arguments);
+  }
+  else if (command == "update") {
+    return updateArchive(arguments);
+  }
+  else {
+    usage();
+    return 2;
+  }
+}
@@ -0,0 +1,91 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2deflater.h"
+#include <climits>
+#include <cstring>
+
+
+namespace BA2 {
+
+Deflater::Deflater()
+  : m_Initialized(false)
+  , m_Level(Z_DEFAULT_COMPRESSION)
+{
+  memset(&m_Stream, 0, sizeof(m_Stream));
+}
+
+
+Deflater::~Deflater()
+{
+  if (m_Initialized) {
+    deflateEnd(&m_Stream);
+  }
+}
+
+
+size_t Deflater::deflate(const BSAUChar *source, size_t sourceLen,
+                         std::vector<BSAUChar> &destination, int level)
+{
+  if (sourceLen > UINT_MAX) {
+    return 0;
+  }
+
+  // the level can't be changed through deflateReset, only by starting over
+  if (m_Initialized && (level != m_Level)) {
+    deflateEnd(&m_Stream);
+    m_Initialized = false;
+  }
+  if (!m_Initialized) {
+    if (deflateInit(&m_Stream, level) != Z_OK) {
+      return 0;
+    }
+    m_Initialized = true;
+    m_Level = level;
+  } else if (deflateReset(&m_Stream) != Z_OK) {
+    return 0;
+  }
+
+  uLong bound = deflateBound(&m_Stream, static_cast<uLong>(sourceLen));
+  if (bound > UINT_MAX) {
+    return 0;
+  }
+  if (destination.size() < bound) {
+    destination.resize(bound);
+  }
+
+  m_Stream.next_in = const_cast<Bytef*>(source);
+  m_Stream.avail_in = static_cast<uInt>(sourceLen);
+  m_Stream.next_out = destination.data();
+  m_Stream.avail_out = static_cast<uInt>(bound);
+
+  if (::deflate(&m_Stream, Z_FINISH) != Z_STREAM_END) {
+    return 0;
+  }
+  return m_Stream.total_out;
+}
+
+
+Deflater &Deflater::local()
+{
+  static thread_local Deflater instance;
+  return instance;
+}
+
+} // namespace BA2
@@ -0,0 +1,74 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_DEFLATER_H
+#define BA2_DEFLATER_H
+
+
+#include "ba2types.h"
+#include <cstddef>
+#include <vector>
+#include <zlib.h>
+
+
+namespace BA2 {
+
+  /**
+   * @brief reusable zlib compression context, the counterpart of Inflater.
+   * An instance must only be used by one thread at a time, use local() to get
+   * the instance belonging to the calling thread.
+   */
+  class Deflater {
+
+  public:
+
+    Deflater();
+    ~Deflater();
+
+    Deflater(const Deflater&) = delete;
+    Deflater &operator=(const Deflater&) = delete;
+
+    /**
+     * compress data into a complete zlib stream
+     * @param source data to compress
+     * @param sourceLen size of the data
+     * @param destination receives the compressed data. It's resized as necessary
+     *                    and may end up larger than the returned size
+     * @param level zlib compression level
+     * @return size of the compressed data or 0 if compression failed
+     */
+    size_t deflate(const BSAUChar *source, size_t sourceLen,
+                   std::vector<BSAUChar> &destination, int level);
+
+    /**
+     * @return the compression context of the calling thread
+     */
+    static Deflater &local();
+
+  private:
+
+    z_stream m_Stream;
+    bool m_Initialized;
+    int m_Level;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_DEFLATER_H
@@ -0,0 +1,255 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2diff.h"
+#include "ba2archive.h"
+#include "ba2entryreader.h"
+#include "ba2exception.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+
+// stored data and decompressed content are compared in pieces of this size
+static const size_t COMPARE_BUFFER_SIZE = 1024 * 1024;
+
+static const BSAULong NO_INDEX = UINT32_MAX;
+
+
+namespace BA2 {
+
+ArchiveDiff::ArchiveDiff()
+  : m_MatchedCount(0)
+  , m_DecompressedCount(0)
+{
+}
+
+
+EErrorCode ArchiveDiff::compare(const Archive &oldArchive, const Archive &newArchive, unsigned int threads)
+{
+  m_Changes.clear();
+  m_MatchedCount = 0;
+  m_DecompressedCount = 0;
+  m_LastError.clear();
+
+  if (oldArchive.getType() != newArchive.getType()) {
+    m_LastError = "archive types differ";
+    return ERROR_INVALIDDATA;
+  }
+
+  const std::vector<std::string> &oldNames = oldArchive.m_TableNames;
+  const std::vector<std::string> &newNames = newArchive.m_TableNames;
+
+  // both archives normalized their names when they were read, matching them
+  // only hashes and compares the keys
+  const std::unordered_map<std::string_view, BSAULong> &oldLookup = oldArchive.m_KeyLookup;
+  const std::vector<std::string> &newKeys = newArchive.m_TableKeys;
+
+  // old index for each file of the new archive
+  std::vector<BSAULong> matches(newNames.size(), NO_INDEX);
+  std::vector<bool> oldMatched(oldNames.size(), false);
+  std::vector<BSAULong> pairs;
+  for (BSAULong i = 0; i < newNames.size(); ++i) {
+    auto iter = oldLookup.find(newKeys[i]);
+    if ((iter != oldLookup.end()) && !oldMatched[iter->second]) {
+      matches[i] = iter->second;
+      oldMatched[iter->second] = true;
+      pairs.push_back(i);
+    }
+  }
+
+  std::vector<char> modified(newNames.size(), 0);
+  std::atomic<size_t> next(0);
+  std::atomic<BSAULong> decompressed(0);
+  std::atomic<int> result(ERROR_NONE);
+  std::mutex errorMutex;
+
+  auto worker = [&]() {
+    std::vector<char> oldBuffer(COMPARE_BUFFER_SIZE);
+    std::vector<char> newBuffer(COMPARE_BUFFER_SIZE);
+    for (size_t position = next++; (position < pairs.size()) && (result.load() == ERROR_NONE);
+         position = next++) {
+      BSAULong newIndex = pairs[position];
+      BSAULong oldIndex = matches[newIndex];
+      try {
+        FileInfo oldInfo;
+        FileInfo newInfo;
+        oldArchive.getFileInfo(oldIndex, oldInfo);
+        newArchive.getFileInfo(newIndex, newInfo);
+        if ((oldInfo.unpackedSize != newInfo.unpackedSize)
+            || !sameHeader(oldArchive, oldIndex, newArchive, newIndex)) {
+          modified[newIndex] = 1;
+          continue;
+        }
+
+        EStoredResult stored = compareStored(oldArchive, getBlocks(oldArchive, oldIndex),
+                                             newArchive, getBlocks(newArchive, newIndex),
+                                             oldBuffer, newBuffer);
+        if (stored == STORED_INCONCLUSIVE) {
+          ++decompressed;
+          modified[newIndex] = compareContent(oldArchive, oldIndex, newArchive, newIndex,
+                                              oldBuffer, newBuffer) ? 0 : 1;
+        }
+        else {
+          modified[newIndex] = stored == STORED_DIFFERENT ? 1 : 0;
+        }
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        int expected = ERROR_NONE;
+        if (result.compare_exchange_strong(expected, ERROR_INVALIDDATA)) {
+          m_LastError = makeString("%s: %s", newNames[newIndex].c_str(), e.what());
+        }
+      }
+    }
+  };
+
+  unsigned int numThreads = static_cast<unsigned int>(
+    std::max<size_t>(1, std::min<size_t>(threads, pairs.size())));
+  std::vector<std::thread> workers;
+  for (unsigned int i = 1; i < numThreads; ++i) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (std::thread &thread : workers) {
+    thread.join();
+  }
+
+  if (result.load() != ERROR_NONE) {
+    return static_cast<EErrorCode>(result.load());
+  }
+
+  m_MatchedCount = static_cast<BSAULong>(pairs.size());
+  m_DecompressedCount = decompressed.load();
+  for (BSAULong i = 0; i < newNames.size(); ++i) {
+    if (matches[i] == NO_INDEX) {
+      m_Changes.push_back({ CHANGE_ADDED, newNames[i], NO_INDEX, i });
+    }
+    else if (modified[i] != 0) {
+      m_Changes.push_back({ CHANGE_MODIFIED, newNames[i], matches[i], i });
+    }
+  }
+  for (BSAULong i = 0; i < oldNames.size(); ++i) {
+    if (!oldMatched[i]) {
+      m_Changes.push_back({ CHANGE_REMOVED, oldNames[i], i, NO_INDEX });
+    }
+  }
+  return ERROR_NONE;
+}
+
+
+std::vector<ArchiveDiff::Block> ArchiveDiff::getBlocks(const Archive &archive, BSAULong index)
+{
+  std::vector<Block> result;
+  if (archive.getType() == TYPE_GENERAL) {
+    const Archive::FileEntry &file = archive.m_Files[index];
+    result.push_back({ file.offset, Archive::packedSize(file), file.unpackedLen });
+  }
+  else {
+    const Archive::ChunkRange &range = archive.m_TextureChunks[index];
+    for (BSAULong i = range.first; i < range.first + range.count; ++i) {
+      const Archive::DX10Chunk &chunk = archive.m_Chunks[i];
+      result.push_back({ chunk.offset, chunk.packedLen, chunk.unpackedLen });
+    }
+  }
+  return result;
+}
+
+
+bool ArchiveDiff::sameHeader(const Archive &oldArchive, BSAULong oldIndex,
+                             const Archive &newArchive, BSAULong newIndex)
+{
+  if (oldArchive.getType() == TYPE_GENERAL) {
+    return true;
+  }
+  // the fields the dds header is generated from
+  const Archive::FileEntry_DX10 &oldHeader = oldArchive.m_TextureHeaders[oldIndex];
+  const Archive::FileEntry_DX10 &newHeader = newArchive.m_TextureHeaders[newIndex];
+  return (oldHeader.height == newHeader.height) && (oldHeader.width == newHeader.width)
+      && (oldHeader.numMips == newHeader.numMips) && (oldHeader.format == newHeader.format)
+      && (oldHeader.unk0C == newHeader.unk0C);
+}
+
+
+ArchiveDiff::EStoredResult ArchiveDiff::compareStored(const Archive &oldArchive, const std::vector<Block> &oldBlocks,
+                                                      const Archive &newArchive, const std::vector<Block> &newBlocks,
+                                                      std::vector<char> &oldBuffer, std::vector<char> &newBuffer)
+{
+  // with a different layout the stored bytes say nothing about the content
+  if (oldBlocks.size() != newBlocks.size()) {
+    return STORED_INCONCLUSIVE;
+  }
+  for (size_t i = 0; i < oldBlocks.size(); ++i) {
+    if ((oldBlocks[i].packedLen != newBlocks[i].packedLen)
+        || (oldBlocks[i].unpackedLen != newBlocks[i].unpackedLen)) {
+      return STORED_INCONCLUSIVE;
+    }
+  }
+
+  for (size_t i = 0; i < oldBlocks.size(); ++i) {
+    const Block &oldBlock = oldBlocks[i];
+    const Block &newBlock = newBlocks[i];
+    BSAHash size = oldBlock.packedLen != 0 ? oldBlock.packedLen : oldBlock.unpackedLen;
+    for (BSAHash pos = 0; pos < size; pos += oldBuffer.size()) {
+      size_t count = static_cast<size_t>(std::min<BSAHash>(size - pos, oldBuffer.size()));
+      oldArchive.m_File.readAt(oldBlock.offset + pos, oldBuffer.data(), count);
+      newArchive.m_File.readAt(newBlock.offset + pos, newBuffer.data(), count);
+      if (memcmp(oldBuffer.data(), newBuffer.data(), count) != 0) {
+        // uncompressed bytes are the content, compressed ones might just be
+        // compressed differently
+        return oldBlock.packedLen == 0 ? STORED_DIFFERENT : STORED_INCONCLUSIVE;
+      }
+    }
+  }
+  return STORED_EQUAL;
+}
+
+
+bool ArchiveDiff::compareContent(const Archive &oldArchive, BSAULong oldIndex,
+                                 const Archive &newArchive, BSAULong newIndex,
+                                 std::vector<char> &oldBuffer, std::vector<char> &newBuffer)
+{
+  EntryReader oldReader;
+  EntryReader newReader;
+  if ((oldReader.open(oldArchive, oldIndex) != ERROR_NONE)
+      || (newReader.open(newArchive, newIndex) != ERROR_NONE)) {
+    throw data_invalid_exception("failed to read file");
+  }
+
+  // streamed so files are decompressed only up to the first difference
+  for (BSAHash pos = 0; pos < oldReader.size(); pos += oldBuffer.size()) {
+    size_t count = static_cast<size_t>(std::min<BSAHash>(oldReader.size() - pos, oldBuffer.size()));
+    size_t oldRead = 0;
+    size_t newRead = 0;
+    if ((oldReader.read(pos, oldBuffer.data(), count, oldRead) != ERROR_NONE)
+        || (newReader.read(pos, newBuffer.data(), count, newRead) != ERROR_NONE)
+        || (oldRead != count) || (newRead != count)) {
+      throw data_invalid_exception("failed to read file");
+    }
+    if (memcmp(oldBuffer.data(), newBuffer.data(), count) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace BA2
@@ -0,0 +1,136 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_DIFF_H
+#define BA2_DIFF_H
+
+
+#include "errorcodes.h"
+#include "ba2types.h"
+#include <string>
+#include <vector>
+
+
+namespace BA2 {
+
+  class Archive;
+
+  enum EChangeType {
+    CHANGE_ADDED,
+    CHANGE_REMOVED,
+    CHANGE_MODIFIED
+  };
+
+  /**
+   * @brief a file that differs between two versions of an archive
+   */
+  struct ArchiveChange {
+    EChangeType type;
+    /// name of the file, as stored in the new archive unless it was removed
+    std::string name;
+    /// index in the old archive, UINT32_MAX for added files
+    BSAULong oldIndex;
+    /// index in the new archive, UINT32_MAX for removed files
+    BSAULong newIndex;
+  };
+
+  /**
+   * @brief compares two versions of an archive without extracting them.
+   * Files are matched by name (case insensitively, '/' and '\' are the same).
+   * A matched pair is modified if the sizes or the texture header fields differ.
+   * Otherwise the data stored in the archives is compared as is, identical bytes
+   * mean identical content and so do different bytes if both sides are stored
+   * uncompressed. Only compressed data that differs (the same content may be
+   * compressed differently) is decompressed to compare the content.
+   */
+  class ArchiveDiff {
+
+  public:
+
+    ArchiveDiff();
+
+    /**
+     * compare two archives of the same type
+     * @param oldArchive the old version
+     * @param newArchive the new version
+     * @param threads number of threads comparing files
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode compare(const Archive &oldArchive, const Archive &newArchive, unsigned int threads = 1);
+
+    /**
+     * @return the changes found by the last compare: added and modified files in
+     *         the order of the new archive, followed by removed files in the order
+     *         of the old one
+     */
+    const std::vector<ArchiveChange> &getChanges() const { return m_Changes; }
+
+    /**
+     * @return number of files found in both archives
+     */
+    BSAULong getMatchedCount() const { return m_MatchedCount; }
+
+    /**
+     * @return number of matched files that had to be decompressed to be compared
+     */
+    BSAULong getDecompressedCount() const { return m_DecompressedCount; }
+
+    /**
+     * @return description of the problem encountered by the last failed call
+     */
+    const std::string &getLastError() const { return m_LastError; }
+
+  private:
+
+    // result of comparing the stored data of a file
+    enum EStoredResult {
+      STORED_EQUAL,
+      STORED_DIFFERENT,
+      STORED_INCONCLUSIVE
+    };
+
+    // one block of stored data: a general file or a texture chunk
+    struct Block {
+      BSAHash offset;
+      BSAULong packedLen;
+      BSAULong unpackedLen;
+    };
+
+    static std::vector<Block> getBlocks(const Archive &archive, BSAULong index);
+    static bool sameHeader(const Archive &oldArchive, BSAULong oldIndex,
+                           const Archive &newArchive, BSAULong newIndex);
+    static EStoredResult compareStored(const Archive &oldArchive, const std::vector<Block> &oldBlocks,
+                                       const Archive &newArchive, const std::vector<Block> &newBlocks,
+                                       std::vector<char> &oldBuffer, std::vector<char> &newBuffer);
+    static bool compareContent(const Archive &oldArchive, BSAULong oldIndex,
+                               const Archive &newArchive, BSAULong newIndex,
+                               std::vector<char> &oldBuffer, std::vector<char> &newBuffer);
+
+  private:
+
+    std::vector<ArchiveChange> m_Changes;
+    BSAULong m_MatchedCount;
+    BSAULong m_DecompressedCount;
+    std::string m_LastError;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_DIFF_H
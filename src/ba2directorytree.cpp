@@ -0,0 +1,228 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2directorytree.h"
+#include "ba2archive.h"
+#include "ba2pathkey.h"
+#include <algorithm>
+
+
+namespace BA2 {
+
+// sorts below every character that appears in names, so sorting full keys orders
+// each directory's content by component and keeps subtrees contiguous
+static const char KEY_SEPARATOR = '\x01';
+
+
+// split a name into its components, ignoring empty ones. key is the PathKey of
+// name, keys receives its components and components the same ranges of name
+static void splitPath(const std::string &name, const std::string &key,
+                      std::vector<std::string> &components, std::vector<std::string> &keys)
+{
+  components.clear();
+  keys.clear();
+  size_t start = 0;
+  while (start <= key.size()) {
+    size_t end = key.find('\\', start);
+    if (end == std::string::npos) {
+      end = key.size();
+    }
+    if (end > start) {
+      components.push_back(name.substr(start, end - start));
+      keys.push_back(key.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+}
+
+
+DirectoryTree::DirectoryTree()
+{
+  m_Directories.push_back(Directory{ std::string(), std::string(), ROOT, 0, 0, 0, 0, 0, 0 });
+  m_PackedSums.push_back(0);
+  m_UnpackedSums.push_back(0);
+}
+
+
+void DirectoryTree::build(const Archive &archive)
+{
+  const std::vector<std::string> &names = archive.m_TableNames;
+  const std::vector<std::string> &nameKeys = archive.m_TableKeys;
+
+  std::vector<std::string> sortKeys(names.size());
+  std::vector<std::string> components;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < names.size(); ++i) {
+    splitPath(names[i], nameKeys[i], components, keys);
+    for (const std::string &key : keys) {
+      if (!sortKeys[i].empty()) {
+        sortKeys[i].push_back(KEY_SEPARATOR);
+      }
+      sortKeys[i].append(key);
+    }
+  }
+
+  m_SortedFiles.resize(names.size());
+  for (BSAULong i = 0; i < names.size(); ++i) {
+    m_SortedFiles[i] = i;
+  }
+  std::sort(m_SortedFiles.begin(), m_SortedFiles.end(), [&sortKeys](BSAULong lhs, BSAULong rhs) {
+    return sortKeys[lhs] < sortKeys[rhs];
+  });
+
+  m_Directories.assign(1, Directory{ std::string(), std::string(), ROOT, 0, 0, 0, 0, 0, 0 });
+  std::vector<std::vector<BSAULong>> children(1);
+  std::vector<std::vector<BSAULong>> files(1);
+
+  // directories from the root to the one the previous file was in. Files are
+  // sorted, so once a directory is left it's complete
+  std::vector<BSAULong> open(1, ROOT);
+  for (BSAULong position = 0; position < m_SortedFiles.size(); ++position) {
+    BSAULong index = m_SortedFiles[position];
+    splitPath(names[index], nameKeys[index], components, keys);
+    size_t depth = keys.empty() ? 0 : keys.size() - 1;
+
+    size_t common = 0;
+    while ((common + 1 < open.size()) && (common < depth)
+           && (m_Directories[open[common + 1]].key == keys[common])) {
+      ++common;
+    }
+    while (open.size() > common + 1) {
+      m_Directories[open.back()].subtreeEnd = position;
+      open.pop_back();
+    }
+    for (size_t level = common; level < depth; ++level) {
+      BSAULong directory = static_cast<BSAULong>(m_Directories.size());
+      m_Directories.push_back(Directory{ components[level], keys[level], open.back(), 0, 0, 0, 0, position, 0 });
+      children[open.back()].push_back(directory);
+      children.emplace_back();
+      files.emplace_back();
+      open.push_back(directory);
+    }
+    files[open.back()].push_back(index);
+  }
+  for (BSAULong directory : open) {
+    m_Directories[directory].subtreeEnd = static_cast<BSAULong>(m_SortedFiles.size());
+  }
+
+  m_Children.clear();
+  m_DirectFiles.clear();
+  for (size_t i = 0; i < m_Directories.size(); ++i) {
+    Directory &directory = m_Directories[i];
+    directory.firstChild = static_cast<BSAULong>(m_Children.size());
+    directory.childCount = static_cast<BSAULong>(children[i].size());
+    m_Children.insert(m_Children.end(), children[i].begin(), children[i].end());
+    directory.firstFile = static_cast<BSAULong>(m_DirectFiles.size());
+    directory.fileCount = static_cast<BSAULong>(files[i].size());
+    m_DirectFiles.insert(m_DirectFiles.end(), files[i].begin(), files[i].end());
+  }
+
+  m_PackedSums.assign(1, 0);
+  m_UnpackedSums.assign(1, 0);
+  for (BSAULong index : m_SortedFiles) {
+    FileInfo info;
+    archive.getFileInfo(index, info);
+    m_PackedSums.push_back(m_PackedSums.back() + info.packedSize);
+    m_UnpackedSums.push_back(m_UnpackedSums.back() + info.unpackedSize);
+  }
+}
+
+
+bool DirectoryTree::findDirectory(const std::string &path, BSAULong &directory) const
+{
+  std::vector<std::string> components;
+  std::vector<std::string> keys;
+  splitPath(path, PathKey::normalize(path), components, keys);
+
+  BSAULong current = ROOT;
+  for (const std::string &key : keys) {
+    const Directory &parent = m_Directories[current];
+    auto begin = m_Children.begin() + parent.firstChild;
+    auto end = begin + parent.childCount;
+    auto iter = std::lower_bound(begin, end, key, [this](BSAULong child, const std::string &value) {
+      return m_Directories[child].key < value;
+    });
+    if ((iter == end) || (m_Directories[*iter].key != key)) {
+      return false;
+    }
+    current = *iter;
+  }
+  directory = current;
+  return true;
+}
+
+
+std::string DirectoryTree::getPath(BSAULong directory) const
+{
+  std::vector<BSAULong> chain;
+  for (; directory != ROOT; directory = m_Directories[directory].parent) {
+    chain.push_back(directory);
+  }
+  std::string result;
+  for (auto iter = chain.rbegin(); iter != chain.rend(); ++iter) {
+    if (!result.empty()) {
+      result.push_back('\\');
+    }
+    result.append(m_Directories[*iter].name);
+  }
+  return result;
+}
+
+
+std::vector<BSAULong> DirectoryTree::getSubdirectories(BSAULong directory) const
+{
+  const Directory &entry = m_Directories[directory];
+  return std::vector<BSAULong>(m_Children.begin() + entry.firstChild,
+                               m_Children.begin() + entry.firstChild + entry.childCount);
+}
+
+
+std::vector<BSAULong> DirectoryTree::getFiles(BSAULong directory, bool recursive) const
+{
+  const Directory &entry = m_Directories[directory];
+  if (recursive) {
+    return std::vector<BSAULong>(m_SortedFiles.begin() + entry.subtreeBegin,
+                                 m_SortedFiles.begin() + entry.subtreeEnd);
+  }
+  return std::vector<BSAULong>(m_DirectFiles.begin() + entry.firstFile,
+                               m_DirectFiles.begin() + entry.firstFile + entry.fileCount);
+}
+
+
+BSAULong DirectoryTree::getFileCount(BSAULong directory, bool recursive) const
+{
+  const Directory &entry = m_Directories[directory];
+  return recursive ? entry.subtreeEnd - entry.subtreeBegin : entry.fileCount;
+}
+
+
+BSAHash DirectoryTree::getPackedSize(BSAULong directory) const
+{
+  const Directory &entry = m_Directories[directory];
+  return m_PackedSums[entry.subtreeEnd] - m_PackedSums[entry.subtreeBegin];
+}
+
+
+BSAHash DirectoryTree::getUnpackedSize(BSAULong directory) const
+{
+  const Directory &entry = m_Directories[directory];
+  return m_UnpackedSums[entry.subtreeEnd] - m_UnpackedSums[entry.subtreeBegin];
+}
+
+} // namespace BA2
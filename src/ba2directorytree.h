@@ -0,0 +1,158 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_DIRECTORYTREE_H
+#define BA2_DIRECTORYTREE_H
+
+
+#include "ba2types.h"
+#include <string>
+#include <vector>
+
+
+namespace BA2 {
+
+  class Archive;
+
+  /**
+   * @brief directory hierarchy of the files in an archive.
+   * Archives only store a flat list of full names, the tree is built from it once
+   * and then allows navigating, listing directories and querying whole subtrees
+   * without scanning all names. Lookups walk the path one component at a time
+   * with a binary search per level, names are compared case insensitively and
+   * '/' is treated like '\'.
+   * Files are kept sorted by path so the files below a directory form one
+   * contiguous range, which makes subtree counts and sizes available in
+   * constant time.
+   * The tree refers to files by their index in the archive and doesn't need the
+   * archive after build() returned.
+   */
+  class DirectoryTree {
+
+  public:
+
+    /// the root directory, which contains everything
+    static constexpr BSAULong ROOT = 0;
+
+    DirectoryTree();
+
+    /**
+     * build the tree for an archive, replacing the previous content
+     * @param archive the archive, which has to be open
+     */
+    void build(const Archive &archive);
+
+    /**
+     * @return number of directories including the root
+     */
+    BSAULong getDirectoryCount() const { return static_cast<BSAULong>(m_Directories.size()); }
+
+    /**
+     * find a directory
+     * @param path path of the directory, empty for the root. A trailing separator is allowed
+     * @param directory receives the directory
+     * @return true if the directory exists
+     */
+    bool findDirectory(const std::string &path, BSAULong &directory) const;
+
+    /**
+     * @param directory a directory
+     * @return name of the directory as stored in the archive, empty for the root
+     */
+    const std::string &getName(BSAULong directory) const { return m_Directories[directory].name; }
+
+    /**
+     * @param directory a directory
+     * @return full path of the directory with '\' as separator, empty for the root
+     */
+    std::string getPath(BSAULong directory) const;
+
+    /**
+     * @param directory a directory
+     * @return parent of the directory, the root is its own parent
+     */
+    BSAULong getParent(BSAULong directory) const { return m_Directories[directory].parent; }
+
+    /**
+     * @param directory a directory
+     * @return the directories directly inside it, sorted by name
+     */
+    std::vector<BSAULong> getSubdirectories(BSAULong directory) const;
+
+    /**
+     * @param directory a directory
+     * @param recursive true to include the files of all subdirectories
+     * @return indices of the files in the archive, sorted by path
+     */
+    std::vector<BSAULong> getFiles(BSAULong directory, bool recursive = false) const;
+
+    /**
+     * @param directory a directory
+     * @param recursive true to include the files of all subdirectories
+     * @return number of files
+     */
+    BSAULong getFileCount(BSAULong directory, bool recursive = false) const;
+
+    /**
+     * @param directory a directory
+     * @return number of bytes all files below the directory occupy in the archive
+     */
+    BSAHash getPackedSize(BSAULong directory) const;
+
+    /**
+     * @param directory a directory
+     * @return size of all files below the directory once extracted
+     */
+    BSAHash getUnpackedSize(BSAULong directory) const;
+
+  private:
+
+    struct Directory {
+      std::string name;
+      // lower case name the children are sorted by
+      std::string key;
+      BSAULong parent;
+      // range in m_Children
+      BSAULong firstChild;
+      BSAULong childCount;
+      // range in m_DirectFiles
+      BSAULong firstFile;
+      BSAULong fileCount;
+      // range in m_SortedFiles covering the whole subtree
+      BSAULong subtreeBegin;
+      BSAULong subtreeEnd;
+    };
+
+  private:
+
+    std::vector<Directory> m_Directories;
+    std::vector<BSAULong> m_Children;
+    // files directly in each directory, grouped by directory
+    std::vector<BSAULong> m_DirectFiles;
+    // all files sorted by path
+    std::vector<BSAULong> m_SortedFiles;
+    // running totals over m_SortedFiles, one more element than files
+    std::vector<BSAHash> m_PackedSums;
+    std::vector<BSAHash> m_UnpackedSums;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_DIRECTORYTREE_H
@@ -0,0 +1,279 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2entryreader.h"
+#include "ba2archive.h"
+#include "ba2exception.h"
+#include "ba2inflater.h"
+#include "dds.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+
+// compressed data is read in pieces of this size while streaming
+static const size_t STREAM_INPUT_SIZE = 64 * 1024;
+
+// data inflated only to get to the requested offset is written here
+static const size_t DISCARD_SIZE = 64 * 1024;
+
+static const BSAULong NO_CHUNK = UINT32_MAX;
+
+
+namespace BA2 {
+
+EntryReader::EntryReader()
+  : m_Archive(nullptr)
+  , m_Index(0)
+  , m_Size(0)
+  , m_DataOffset(0)
+  , m_PackedLen(0)
+  , m_StreamInitialized(false)
+  , m_StreamValid(false)
+  , m_InputPos(0)
+  , m_OutputPos(0)
+  , m_FirstChunk(0)
+  , m_CachedChunk(NO_CHUNK)
+{
+  memset(&m_Stream, 0, sizeof(m_Stream));
+}
+
+
+EntryReader::~EntryReader()
+{
+  if (m_StreamInitialized) {
+    inflateEnd(&m_Stream);
+  }
+}
+
+
+EErrorCode EntryReader::open(const Archive &archive, BSAULong index)
+{
+  close();
+
+  if (index >= archive.countFiles()) {
+    return ERROR_FILENOTFOUND;
+  }
+
+  if (archive.m_Type == TYPE_GENERAL) {
+    const Archive::FileEntry &file = archive.m_Files[index];
+    m_DataOffset = file.offset;
+    m_PackedLen = Archive::packedSize(file);
+    m_Size = Archive::unpackedSize(file);
+  }
+  else {
+    m_Header.resize(sizeof(BSAULong) + sizeof(DDS_HEADER));
+    if (!archive.writeDDSHeader(archive.m_TextureHeaders[index], &m_Header[0])) {
+      // the format has no dds header, the chunks are still readable
+      m_Header.clear();
+    }
+    const Archive::ChunkRange &range = archive.m_TextureChunks[index];
+    m_FirstChunk = range.first;
+    m_ChunkStart.resize(range.count + 1);
+    m_ChunkStart[0] = m_Header.size();
+    for (BSAULong i = 0; i < range.count; ++i) {
+      m_ChunkStart[i + 1] = m_ChunkStart[i] + archive.m_Chunks[range.first + i].unpackedLen;
+    }
+    m_Size = m_ChunkStart.back();
+  }
+
+  m_Archive = &archive;
+  m_Index = index;
+  return ERROR_NONE;
+}
+
+
+void EntryReader::close()
+{
+  m_Archive = nullptr;
+  m_Size = 0;
+  m_StreamValid = false;
+  m_CachedChunk = NO_CHUNK;
+  m_Header.clear();
+  m_ChunkStart.clear();
+  std::vector<BSAUChar>().swap(m_Input);
+  std::vector<BSAUChar>().swap(m_Discard);
+  m_ChunkData = EntryCache::Buffer();
+}
+
+
+EErrorCode EntryReader::read(BSAHash offset, void *buffer, size_t length, size_t &bytesRead)
+{
+  bytesRead = 0;
+  if (m_Archive == nullptr) {
+    return ERROR_ACCESSFAILED;
+  }
+  if (offset >= m_Size) {
+    return ERROR_NONE;
+  }
+  length = static_cast<size_t>(std::min<BSAHash>(length, m_Size - offset));
+
+  try {
+    if (m_Archive->m_Type == TYPE_GENERAL) {
+      readGeneral(offset, static_cast<BSAUChar*>(buffer), length);
+    }
+    else {
+      readDX10(offset, static_cast<BSAUChar*>(buffer), length);
+    }
+  } catch (const data_invalid_exception&) {
+    m_StreamValid = false;
+    m_CachedChunk = NO_CHUNK;
+    return ERROR_INVALIDDATA;
+  } catch (const std::bad_alloc&) {
+    m_StreamValid = false;
+    m_CachedChunk = NO_CHUNK;
+    return ERROR_INVALIDDATA;
+  }
+  bytesRead = length;
+  return ERROR_NONE;
+}
+
+
+void EntryReader::readGeneral(BSAHash offset, BSAUChar *buffer, size_t length)
+{
+  if (m_PackedLen == 0) {
+    m_Archive->m_File.readAt(m_DataOffset + offset, buffer, length);
+    return;
+  }
+
+  // zlib streams can only be decoded forward
+  if (!m_StreamValid || (offset < m_OutputPos)) {
+    restartStream();
+  }
+  if (m_OutputPos < offset) {
+    m_Discard.resize(DISCARD_SIZE);
+    while (m_OutputPos < offset) {
+      inflateStream(&m_Discard[0], static_cast<size_t>(std::min<BSAHash>(DISCARD_SIZE, offset - m_OutputPos)));
+    }
+  }
+  inflateStream(buffer, length);
+}
+
+
+void EntryReader::restartStream()
+{
+  m_StreamValid = false;
+  if (!m_StreamInitialized) {
+    if (inflateInit(&m_Stream) != Z_OK) {
+      throw data_invalid_exception("failed to initialize zlib");
+    }
+    m_StreamInitialized = true;
+  }
+  else if (inflateReset(&m_Stream) != Z_OK) {
+    throw data_invalid_exception("failed to reset zlib");
+  }
+  m_Stream.avail_in = 0;
+  m_InputPos = 0;
+  m_OutputPos = 0;
+  m_Input.resize(std::min<size_t>(STREAM_INPUT_SIZE, m_PackedLen));
+  m_StreamValid = true;
+}
+
+
+void EntryReader::inflateStream(BSAUChar *buffer, size_t length)
+{
+  while (length > 0) {
+    size_t piece = std::min<size_t>(length, UINT_MAX);
+    m_Stream.next_out = buffer;
+    m_Stream.avail_out = static_cast<uInt>(piece);
+    while (m_Stream.avail_out > 0) {
+      if (m_Stream.avail_in == 0) {
+        size_t inputLen = static_cast<size_t>(std::min<BSAHash>(m_Input.size(), m_PackedLen - m_InputPos));
+        if (inputLen == 0) {
+          throw data_invalid_exception(makeString("compressed data of file %u is truncated", m_Index));
+        }
+        m_Archive->m_File.readAt(m_DataOffset + m_InputPos, &m_Input[0], inputLen);
+        m_InputPos += inputLen;
+        m_Stream.next_in = &m_Input[0];
+        m_Stream.avail_in = static_cast<uInt>(inputLen);
+      }
+      int result = ::inflate(&m_Stream, Z_NO_FLUSH);
+      if ((result == Z_STREAM_END) && (m_Stream.avail_out > 0)) {
+        throw data_invalid_exception(makeString("compressed data of file %u ends early", m_Index));
+      }
+      else if ((result != Z_OK) && (result != Z_STREAM_END)) {
+        throw data_invalid_exception(makeString("failed to decompress file %u", m_Index));
+      }
+    }
+    m_OutputPos += piece;
+    buffer += piece;
+    length -= piece;
+  }
+}
+
+
+void EntryReader::readDX10(BSAHash offset, BSAUChar *buffer, size_t length)
+{
+  if (offset < m_Header.size()) {
+    size_t count = std::min(length, static_cast<size_t>(m_Header.size() - offset));
+    memcpy(buffer, &m_Header[static_cast<size_t>(offset)], count);
+    offset += count;
+    buffer += count;
+    length -= count;
+  }
+
+  // first chunk ending after the offset
+  BSAULong chunk = static_cast<BSAULong>(
+    std::upper_bound(m_ChunkStart.begin() + 1, m_ChunkStart.end(), offset) - m_ChunkStart.begin() - 1);
+  while (length > 0) {
+    const Archive::DX10Chunk &info = m_Archive->m_Chunks[m_FirstChunk + chunk];
+    BSAHash inner = offset - m_ChunkStart[chunk];
+    size_t count = static_cast<size_t>(std::min<BSAHash>(length, info.unpackedLen - inner));
+    if (count == 0) {
+      // empty chunk
+    }
+    else if (info.packedLen == 0) {
+      m_Archive->m_File.readAt(info.offset + inner, buffer, count);
+    }
+    else {
+      loadChunk(chunk);
+      memcpy(buffer, m_ChunkData.first.get() + inner, count);
+    }
+    offset += count;
+    buffer += count;
+    length -= count;
+    ++chunk;
+  }
+}
+
+
+void EntryReader::loadChunk(BSAULong chunk)
+{
+  if (chunk == m_CachedChunk) {
+    return;
+  }
+  m_CachedChunk = NO_CHUNK;
+  BSAHash cacheKey = EntryCache::makeKey(m_Index, static_cast<int>(chunk));
+  if (!m_Archive->m_Cache.get(cacheKey, m_ChunkData)) {
+    const Archive::DX10Chunk &info = m_Archive->m_Chunks[m_FirstChunk + chunk];
+    m_Input.resize(info.packedLen);
+    m_ChunkData = EntryCache::Buffer(std::shared_ptr<unsigned char>(new unsigned char[info.unpackedLen],
+                                                                    array_deleter<unsigned char>()),
+                                     info.unpackedLen);
+    m_Archive->m_File.readAt(info.offset, &m_Input[0], info.packedLen);
+    if (!Inflater::local().inflate(&m_Input[0], info.packedLen, m_ChunkData.first.get(), info.unpackedLen)) {
+      throw data_invalid_exception(makeString("failed to decompress chunk %u of texture %u",
+                                              chunk, m_Index));
+    }
+    m_Archive->m_Cache.put(cacheKey, m_ChunkData);
+  }
+  m_CachedChunk = chunk;
+}
+
+} // namespace BA2
@@ -0,0 +1,133 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_ENTRYREADER_H
+#define BA2_ENTRYREADER_H
+
+
+#include "errorcodes.h"
+#include "ba2types.h"
+#include "ba2cache.h"
+#include <cstddef>
+#include <vector>
+#include <zlib.h>
+
+
+namespace BA2 {
+
+  class Archive;
+
+  /**
+   * @brief random access to the content of a single file in an archive.
+   * Reads only decompress what's necessary to serve the requested range:
+   * - uncompressed general files are read directly
+   * - textures are decompressed chunk by chunk, only chunks overlapping the
+   *   range are touched and the most recently used one is kept. Chunks go through
+   *   the archive's cache if it's enabled
+   * - compressed general files are inflated as a stream that continues from the
+   *   end of the previous read. Reading backwards restarts the stream
+   *
+   * The content is the same as Archive::readFile produces, textures include their
+   * dds header. Textures in formats a dds header can't describe, which readFile
+   * rejects, are served as their mip data without a header, so they can still be
+   * compared and searched. The archive has to stay open while the reader is in use. Multiple
+   * readers may be used on the same archive concurrently but a single reader must
+   * only be used by one thread at a time.
+   */
+  class EntryReader {
+
+  public:
+
+    EntryReader();
+    ~EntryReader();
+
+    EntryReader(const EntryReader&) = delete;
+    EntryReader &operator=(const EntryReader&) = delete;
+
+    /**
+     * prepare reading a file
+     * @param archive the archive containing the file
+     * @param index index of the file, corresponding to Archive::getFileList()
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode open(const Archive &archive, BSAULong index);
+
+    /**
+     * @brief release buffers and the decompression state
+     */
+    void close();
+
+    /**
+     * @return size of the file content in bytes
+     */
+    BSAHash size() const { return m_Size; }
+
+    /**
+     * read part of the file
+     * @param offset position in the file content to start reading at
+     * @param buffer buffer receiving the data, needs to be at least length bytes large
+     * @param length number of bytes to read
+     * @param bytesRead receives the number of bytes read. This is less than length
+     *                  only if the range exceeds the end of the file
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode read(BSAHash offset, void *buffer, size_t length, size_t &bytesRead);
+
+  private:
+
+    void readGeneral(BSAHash offset, BSAUChar *buffer, size_t length);
+    void readDX10(BSAHash offset, BSAUChar *buffer, size_t length);
+
+    void restartStream();
+    void inflateStream(BSAUChar *buffer, size_t length);
+    void loadChunk(BSAULong chunk);
+
+  private:
+
+    const Archive *m_Archive;
+    BSAULong m_Index;
+    BSAHash m_Size;
+
+    // general files
+    BSAHash m_DataOffset;
+    BSAULong m_PackedLen;
+
+    // streaming decompression of compressed general files. m_OutputPos is the
+    // position in the file content the stream has reached
+    z_stream m_Stream;
+    bool m_StreamInitialized;
+    bool m_StreamValid;
+    BSAHash m_InputPos;
+    BSAHash m_OutputPos;
+    std::vector<BSAUChar> m_Input;
+    std::vector<BSAUChar> m_Discard;
+
+    // textures: dds header, start of each chunk in the file content and the
+    // most recently decompressed chunk, possibly shared with the archive's cache
+    std::vector<BSAUChar> m_Header;
+    std::vector<BSAHash> m_ChunkStart;
+    BSAULong m_FirstChunk;
+    BSAULong m_CachedChunk;
+    EntryCache::Buffer m_ChunkData;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_ENTRYREADER_H
@@ -33,6 +33,33 @@ std::string makeString(const char *format, ...)
 }
 
 
+std::string makeJSONString(const std::string &value)
+{
+  std::string result("\"");
+  for (char ch : value) {
+    switch (ch) {
+      case '"':  result.append("\\\""); break;
+      case '\\': result.append("\\\\"); break;
+      case '\n': result.append("\\n"); break;
+      case '\r': result.append("\\r"); break;
+      case '\t': result.append("\\t"); break;
+      default: {
+        if (static_cast<unsigned char>(ch) < 0x20) {
+          char buffer[8];
+          snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned int>(ch));
+          result.append(buffer);
+        }
+        else {
+          result.push_back(ch);
+        }
+      } break;
+    }
+  }
+  result.push_back('"');
+  return result;
+}
+
+
 data_invalid_exception::data_invalid_exception(const std::string &message)
   : m_Message(message)
 {
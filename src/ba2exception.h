@@ -32,6 +32,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 std::string makeString(const char *format, ...);
 
 
+/**
+ * quote a string for JSON output, escaping quotes, backslashes and control characters
+ * @param value the string, bytes from 0x80 up are passed through unchanged
+ * @return the string in double quotes
+ */
+std::string makeJSONString(const std::string &value);
+
+
 /**
  * custom exception to be thrown when invalid data is encountered
  */
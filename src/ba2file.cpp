@@ -0,0 +1,464 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2file.h"
+#include "ba2exception.h"
+#include "ba2statistics.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+
+
+namespace BA2 {
+
+#ifdef _WIN32
+
+InputFile::InputFile()
+  : m_Handle(INVALID_HANDLE_VALUE)
+  , m_Size(0)
+{
+}
+
+
+bool InputFile::open(const char *fileName)
+{
+  close();
+  m_Handle = ::CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  return initSize();
+}
+
+
+bool InputFile::open(const wchar_t *fileName)
+{
+  close();
+  m_Handle = ::CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  return initSize();
+}
+
+
+bool InputFile::initSize()
+{
+  if (m_Handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(m_Handle, &size)) {
+    close();
+    return false;
+  }
+  m_Size = static_cast<BSAHash>(size.QuadPart);
+  return true;
+}
+
+
+void InputFile::close()
+{
+  if (m_Handle != INVALID_HANDLE_VALUE) {
+    ::CloseHandle(m_Handle);
+    m_Handle = INVALID_HANDLE_VALUE;
+  }
+  m_Size = 0;
+}
+
+
+bool InputFile::isOpen() const
+{
+  return m_Handle != INVALID_HANDLE_VALUE;
+}
+
+
+void InputFile::readAt(BSAHash offset, void *buffer, size_t size,
+                       StatisticsCollector *statistics) const
+{
+  char *pos = static_cast<char*>(buffer);
+  while (size > 0) {
+    // ReadFile with an OVERLAPPED structure reads from the given offset without relying
+    // on the file pointer of the handle
+    OVERLAPPED overlapped = { 0 };
+    overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD toRead = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+    DWORD bytesRead = 0;
+    BOOL success = ::ReadFile(m_Handle, pos, toRead, &bytesRead, &overlapped);
+    if (statistics != nullptr) {
+      statistics->addRead(bytesRead);
+    }
+    if (!success || (bytesRead == 0)) {
+      throw data_invalid_exception(makeString("can't read from ba2 at offset %llu",
+                                              static_cast<unsigned long long>(offset)));
+    }
+    pos += bytesRead;
+    offset += bytesRead;
+    size -= bytesRead;
+  }
+}
+
+#else // _WIN32
+
+InputFile::InputFile()
+  : m_Descriptor(-1)
+  , m_Size(0)
+{
+}
+
+
+bool InputFile::open(const char *fileName)
+{
+  close();
+  m_Descriptor = ::open(fileName, O_RDONLY | O_CLOEXEC);
+  return initSize();
+}
+
+
+bool InputFile::initSize()
+{
+  if (m_Descriptor == -1) {
+    return false;
+  }
+  struct stat info;
+  if (::fstat(m_Descriptor, &info) != 0) {
+    close();
+    return false;
+  }
+  m_Size = static_cast<BSAHash>(info.st_size);
+  return true;
+}
+
+
+void InputFile::close()
+{
+  if (m_Descriptor != -1) {
+    ::close(m_Descriptor);
+    m_Descriptor = -1;
+  }
+  m_Size = 0;
+}
+
+
+bool InputFile::isOpen() const
+{
+  return m_Descriptor != -1;
+}
+
+
+void InputFile::readAt(BSAHash offset, void *buffer, size_t size,
+                       StatisticsCollector *statistics) const
+{
+  char *pos = static_cast<char*>(buffer);
+  while (size > 0) {
+    ssize_t bytesRead = ::pread(m_Descriptor, pos, size, static_cast<off_t>(offset));
+    if (statistics != nullptr) {
+      statistics->addRead(bytesRead > 0 ? bytesRead : 0);
+    }
+    if (bytesRead < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      bytesRead = 0;
+    }
+    if (bytesRead == 0) {
+      throw data_invalid_exception(makeString("can't read from ba2 at offset %llu",
+                                              static_cast<unsigned long long>(offset)));
+    }
+    pos += bytesRead;
+    offset += bytesRead;
+    size -= bytesRead;
+  }
+}
+
+#endif // _WIN32
+
+
+InputFile::~InputFile()
+{
+  close();
+}
+
+
+#ifdef _WIN32
+
+bool DirectOutputBuffer::open(const char *fileName, BSAHash size)
+{
+  close();
+  m_Handle = ::CreateFileA(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+  m_Direct = m_Handle != INVALID_HANDLE_VALUE;
+  if (!m_Direct) {
+    m_Handle = ::CreateFileA(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+  }
+  if (m_Handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  // reserving the space up front keeps the file from fragmenting, failure is harmless
+  FILE_ALLOCATION_INFO allocation;
+  allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+  ::SetFileInformationByHandle(m_Handle, FileAllocationInfo, &allocation, sizeof(allocation));
+
+  m_Failed = false;
+  m_Written = 0;
+  setp(m_Buffer, m_Buffer + BUFFER_SIZE);
+  return true;
+}
+
+
+bool DirectOutputBuffer::isOpen() const
+{
+  return m_Handle != INVALID_HANDLE_VALUE;
+}
+
+
+void DirectOutputBuffer::closeHandle()
+{
+  ::CloseHandle(m_Handle);
+  m_Handle = INVALID_HANDLE_VALUE;
+}
+
+
+bool DirectOutputBuffer::writeAll(const char *data, size_t size)
+{
+  while (size > 0) {
+    DWORD toWrite = size > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size);
+    DWORD written = 0;
+    if (!::WriteFile(m_Handle, data, toWrite, &written, nullptr) || (written == 0)) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+
+bool DirectOutputBuffer::truncate(BSAHash size)
+{
+  FILE_END_OF_FILE_INFO endOfFile;
+  endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+  return ::SetFileInformationByHandle(m_Handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)) != FALSE;
+}
+
+#else // _WIN32
+
+bool DirectOutputBuffer::open(const char *fileName, BSAHash size)
+{
+  close();
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  m_Direct = false;
+#ifdef O_DIRECT
+  m_Descriptor = ::open(fileName, flags | O_DIRECT, 0644);
+  m_Direct = m_Descriptor != -1;
+#endif
+  if (m_Descriptor == -1) {
+    // file systems like tmpfs refuse O_DIRECT
+    m_Descriptor = ::open(fileName, flags, 0644);
+#ifdef F_NOCACHE
+    m_Direct = (m_Descriptor != -1) && (::fcntl(m_Descriptor, F_NOCACHE, 1) == 0);
+#endif
+  }
+  if (m_Descriptor == -1) {
+    return false;
+  }
+
+#ifdef __linux__
+  // reserving the space up front keeps the file from fragmenting, failure is harmless
+  if (size > 0) {
+    ::fallocate(m_Descriptor, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+  }
+#else
+  (void)size;
+#endif
+
+  m_Failed = false;
+  m_Written = 0;
+  setp(m_Buffer, m_Buffer + BUFFER_SIZE);
+  return true;
+}
+
+
+bool DirectOutputBuffer::isOpen() const
+{
+  return m_Descriptor != -1;
+}
+
+
+void DirectOutputBuffer::closeHandle()
+{
+  ::close(m_Descriptor);
+  m_Descriptor = -1;
+}
+
+
+bool DirectOutputBuffer::writeAll(const char *data, size_t size)
+{
+  while (size > 0) {
+    ssize_t written = ::write(m_Descriptor, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+#ifdef O_DIRECT
+      // some file systems accept O_DIRECT when opening but fail the writes
+      int flags = ::fcntl(m_Descriptor, F_GETFL);
+      if (m_Direct && (errno == EINVAL) && (flags != -1)
+          && (::fcntl(m_Descriptor, F_SETFL, flags & ~O_DIRECT) == 0)) {
+        m_Direct = false;
+        continue;
+      }
+#endif
+      return false;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+
+bool DirectOutputBuffer::truncate(BSAHash size)
+{
+  int result;
+  do {
+    result = ::ftruncate(m_Descriptor, static_cast<off_t>(size));
+  } while ((result != 0) && (errno == EINTR));
+  return result == 0;
+}
+
+#endif // _WIN32
+
+
+DirectOutputBuffer::DirectOutputBuffer()
+#ifdef _WIN32
+  : m_Handle(INVALID_HANDLE_VALUE)
+#else
+  : m_Descriptor(-1)
+#endif
+  , m_Direct(false)
+  , m_Failed(false)
+  , m_Written(0)
+  , m_Memory(BUFFER_SIZE + ALIGNMENT)
+{
+  uintptr_t address = reinterpret_cast<uintptr_t>(m_Memory.data());
+  m_Buffer = m_Memory.data() + (ALIGNMENT - address % ALIGNMENT) % ALIGNMENT;
+}
+
+
+DirectOutputBuffer::~DirectOutputBuffer()
+{
+  close();
+}
+
+
+bool DirectOutputBuffer::close()
+{
+  if (!isOpen()) {
+    return false;
+  }
+  bool success = flushBuffer(true);
+  // removes the padding of the last block and preallocated space that wasn't used
+  success = truncate(m_Written) && success && !m_Failed;
+  closeHandle();
+  setp(nullptr, nullptr);
+  return success;
+}
+
+
+DirectOutputBuffer::int_type DirectOutputBuffer::overflow(int_type ch)
+{
+  if (!isOpen() || !flushBuffer(false)) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+
+bool DirectOutputBuffer::flushBuffer(bool final)
+{
+  size_t used = static_cast<size_t>(pptr() - pbase());
+  size_t size = used - used % ALIGNMENT;
+  if (final) {
+    size = used;
+    if (m_Direct && (used % ALIGNMENT != 0)) {
+      // unbuffered writes have to cover whole blocks, close cuts the padding off
+      size = used + ALIGNMENT - used % ALIGNMENT;
+      memset(m_Buffer + used, 0, size - used);
+    }
+  }
+
+  bool success = (size == 0) || writeAll(m_Buffer, size);
+  if (!success) {
+    m_Failed = true;
+  }
+  size_t consumed = std::min(size, used);
+  m_Written += consumed;
+  memmove(m_Buffer, m_Buffer + consumed, used - consumed);
+  setp(m_Buffer, m_Buffer + BUFFER_SIZE);
+  pbump(static_cast<int>(used - consumed));
+  return success;
+}
+
+#ifdef _WIN32
+
+bool syncFile(const char *fileName)
+{
+  HANDLE handle = ::CreateFileA(fileName, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  bool success = ::FlushFileBuffers(handle) != FALSE;
+  ::CloseHandle(handle);
+  return success;
+}
+
+#else // _WIN32
+
+bool syncFile(const char *fileName)
+{
+  int descriptor = ::open(fileName, O_RDONLY | O_CLOEXEC);
+  if (descriptor == -1) {
+    return false;
+  }
+#ifdef F_FULLFSYNC
+  // on macOS fsync doesn't flush the cache of the drive
+  bool success = (::fcntl(descriptor, F_FULLFSYNC) == 0) || (::fsync(descriptor) == 0);
+#else
+  bool success = ::fsync(descriptor) == 0;
+#endif
+  ::close(descriptor);
+  return success;
+}
+
+#endif // _WIN32
+
+} // namespace BA2
@@ -0,0 +1,191 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_FILE_H
+#define BA2_FILE_H
+
+
+#include "ba2types.h"
+#include <cstddef>
+#include <streambuf>
+#include <vector>
+
+
+namespace BA2 {
+
+  class StatisticsCollector;
+
+  /**
+   * @brief read-only file handle using positional reads.
+   * All reads take an explicit offset and don't touch a shared file position,
+   * so a single instance can be read from by multiple threads concurrently.
+   * open/close must not run concurrently with reads.
+   */
+  class InputFile {
+
+  public:
+
+    InputFile();
+    ~InputFile();
+
+    InputFile(const InputFile&) = delete;
+    InputFile &operator=(const InputFile&) = delete;
+
+    /**
+     * open a file for reading
+     * @param fileName name of the file to open
+     * @return true on success
+     */
+    bool open(const char *fileName);
+
+#ifdef _WIN32
+    /**
+     * open a file for reading
+     * @param fileName name of the file to open
+     * @return true on success
+     */
+    bool open(const wchar_t *fileName);
+#endif
+
+    /**
+     * @brief close the file. Does nothing if the file isn't open
+     */
+    void close();
+
+    /**
+     * @return true if the file is open
+     */
+    bool isOpen() const;
+
+    /**
+     * @return size of the file in bytes
+     */
+    BSAHash size() const { return m_Size; }
+
+    /**
+     * read exactly size bytes starting at offset
+     * @param offset absolute position in the file
+     * @param buffer buffer to read into, needs to be at least size bytes large
+     * @param size number of bytes to read
+     * @param statistics optional collector counting the bytes read and system calls
+     * @throw data_invalid_exception if the file ends before size bytes were read
+     */
+    void readAt(BSAHash offset, void *buffer, size_t size,
+                StatisticsCollector *statistics = nullptr) const;
+
+  private:
+
+    bool initSize();
+
+  private:
+
+#ifdef _WIN32
+    void *m_Handle;
+#else
+    int m_Descriptor;
+#endif
+    BSAHash m_Size;
+
+  };
+
+  /**
+   * @brief stream buffer writing a file with unbuffered I/O (O_DIRECT,
+   * FILE_FLAG_NO_BUFFERING), so large outputs don't push other data out of the
+   * page cache and aren't copied into it first.
+   * Data is collected in an aligned buffer and written in whole blocks, the last
+   * block is padded and the file cut to its real size on close. The file is
+   * preallocated to the expected size where the file system supports it.
+   * If the file system doesn't support unbuffered I/O the file is written
+   * normally. Use with a std::ostream.
+   */
+  class DirectOutputBuffer : public std::streambuf {
+
+  public:
+
+    /// alignment of buffers, offsets and sizes of unbuffered writes
+    static const size_t ALIGNMENT = 4096;
+
+    /// size of the buffer, a multiple of ALIGNMENT
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+
+    DirectOutputBuffer();
+    ~DirectOutputBuffer();
+
+    DirectOutputBuffer(const DirectOutputBuffer&) = delete;
+    DirectOutputBuffer &operator=(const DirectOutputBuffer&) = delete;
+
+    /**
+     * create a file, replacing an existing one
+     * @param fileName name of the file
+     * @param size expected size of the file, used to preallocate it
+     * @return true on success
+     */
+    bool open(const char *fileName, BSAHash size);
+
+    /**
+     * write the remaining data and close the file
+     * @return true if all data was written
+     */
+    bool close();
+
+    /**
+     * @return true if the file is written unbuffered, false after falling back to
+     *         normal I/O
+     */
+    bool isDirect() const { return m_Direct; }
+
+  protected:
+
+    int_type overflow(int_type ch) override;
+
+  private:
+
+    bool isOpen() const;
+    void closeHandle();
+    // writes the buffered data. Unless final, only whole blocks are written
+    bool flushBuffer(bool final);
+    bool writeAll(const char *data, size_t size);
+    bool truncate(BSAHash size);
+
+  private:
+
+#ifdef _WIN32
+    void *m_Handle;
+#else
+    int m_Descriptor;
+#endif
+    bool m_Direct;
+    bool m_Failed;
+    BSAHash m_Written;
+    std::vector<char> m_Memory;
+    char *m_Buffer;
+
+  };
+
+  /**
+   * write the data of a file, and the size recorded for it, through to the storage
+   * device (fsync, FlushFileBuffers). Other handles to the file may still be open
+   * @param fileName name of the file
+   * @return true on success
+   */
+  bool syncFile(const char *fileName);
+
+} // namespace BA2
+
+#endif // BA2_FILE_H
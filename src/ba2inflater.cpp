@@ -0,0 +1,115 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2inflater.h"
+#include <climits>
+#include <cstring>
+
+
+namespace BA2 {
+
+Inflater::Inflater()
+  : m_Initialized(false)
+{
+  memset(&m_Stream, 0, sizeof(m_Stream));
+}
+
+
+Inflater::~Inflater()
+{
+  if (m_Initialized) {
+    inflateEnd(&m_Stream);
+  }
+}
+
+
+bool Inflater::inflate(const BSAUChar *source, size_t sourceLen,
+                       BSAUChar *destination, size_t destinationLen)
+{
+  if ((sourceLen > UINT_MAX) || (destinationLen > UINT_MAX)) {
+    return false;
+  }
+
+  if (!reset()) {
+    return false;
+  }
+
+  m_Stream.next_in = const_cast<Bytef*>(source);
+  m_Stream.avail_in = static_cast<uInt>(sourceLen);
+  m_Stream.next_out = destination;
+  m_Stream.avail_out = static_cast<uInt>(destinationLen);
+
+  int result = ::inflate(&m_Stream, Z_FINISH);
+  return (result == Z_STREAM_END) && (m_Stream.total_out == destinationLen);
+}
+
+
+bool Inflater::inflatePrefix(const std::function<size_t(const BSAUChar *&data)> &fetch,
+                             BSAUChar *destination, size_t destinationLen)
+{
+  if ((destinationLen > UINT_MAX) || !reset()) {
+    return false;
+  }
+
+  m_Stream.avail_in = 0;
+  m_Stream.next_out = destination;
+  m_Stream.avail_out = static_cast<uInt>(destinationLen);
+
+  while (m_Stream.avail_out > 0) {
+    if (m_Stream.avail_in == 0) {
+      const BSAUChar *data = nullptr;
+      size_t size = fetch(data);
+      if ((size == 0) || (size > UINT_MAX)) {
+        return false;
+      }
+      m_Stream.next_in = const_cast<Bytef*>(data);
+      m_Stream.avail_in = static_cast<uInt>(size);
+    }
+    int result = ::inflate(&m_Stream, Z_NO_FLUSH);
+    if (result == Z_STREAM_END) {
+      return m_Stream.avail_out == 0;
+    }
+    else if (result != Z_OK) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+bool Inflater::reset()
+{
+  if (!m_Initialized) {
+    if (inflateInit(&m_Stream) != Z_OK) {
+      return false;
+    }
+    m_Initialized = true;
+    return true;
+  }
+  return inflateReset(&m_Stream) == Z_OK;
+}
+
+
+Inflater &Inflater::local()
+{
+  static thread_local Inflater instance;
+  return instance;
+}
+
+} // namespace BA2
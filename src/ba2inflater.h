@@ -0,0 +1,89 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_INFLATER_H
+#define BA2_INFLATER_H
+
+
+#include "ba2types.h"
+#include <cstddef>
+#include <functional>
+#include <zlib.h>
+
+
+namespace BA2 {
+
+  /**
+   * @brief reusable zlib decompression context.
+   * Unlike uncompress() this keeps the inflate state allocated between calls.
+   * An instance must only be used by one thread at a time, use local() to get
+   * the instance belonging to the calling thread.
+   */
+  class Inflater {
+
+  public:
+
+    Inflater();
+    ~Inflater();
+
+    Inflater(const Inflater&) = delete;
+    Inflater &operator=(const Inflater&) = delete;
+
+    /**
+     * decompress a complete zlib stream
+     * @param source compressed data
+     * @param sourceLen size of the compressed data
+     * @param destination buffer receiving the decompressed data
+     * @param destinationLen expected size of the decompressed data
+     * @return true if the stream was valid and decompressed to exactly destinationLen bytes
+     */
+    bool inflate(const BSAUChar *source, size_t sourceLen,
+                 BSAUChar *destination, size_t destinationLen);
+
+    /**
+     * decompress only the beginning of a zlib stream. Compressed data is requested
+     * piece by piece so that no more of it needs to be read than necessary
+     * @param fetch called whenever more compressed data is needed. It sets its parameter
+     *              to the next piece and returns its size, or 0 if there is no more data
+     * @param destination buffer receiving the decompressed data
+     * @param destinationLen number of bytes to decompress
+     * @return true if the stream was valid and produced at least destinationLen bytes
+     */
+    bool inflatePrefix(const std::function<size_t(const BSAUChar *&data)> &fetch,
+                       BSAUChar *destination, size_t destinationLen);
+
+    /**
+     * @return the decompression context of the calling thread
+     */
+    static Inflater &local();
+
+  private:
+
+    bool reset();
+
+  private:
+
+    z_stream m_Stream;
+    bool m_Initialized;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_INFLATER_H
@@ -0,0 +1,142 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2journal.h"
+#include "ba2file.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+
+namespace BA2 {
+
+static std::string makeHeader(BSAULong fileCount, BSAHash archiveSize)
+{
+  return "ba2 extract journal 1 " + std::to_string(fileCount) + " " + std::to_string(archiveSize);
+}
+
+
+ExtractJournal::ExtractJournal()
+{
+}
+
+
+ExtractJournal::~ExtractJournal()
+{
+  close(false);
+}
+
+
+void ExtractJournal::load(const std::string &fileName, BSAULong fileCount, BSAHash archiveSize,
+                          std::vector<BSAULong> &completed)
+{
+  completed.clear();
+
+  std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    return;
+  }
+
+  std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::string header = makeHeader(fileCount, archiveSize);
+  if ((content.compare(0, header.size(), header) != 0)
+      || (content.size() == header.size()) || (content[header.size()] != '\n')) {
+    return;
+  }
+
+  // only complete lines count, the last one may have been cut off
+  size_t pos = header.size() + 1;
+  for (size_t end = content.find('\n', pos); end != std::string::npos;
+       pos = end + 1, end = content.find('\n', pos)) {
+    if (end == pos) {
+      continue;
+    }
+    char *parseEnd = nullptr;
+    unsigned long index = strtoul(content.c_str() + pos, &parseEnd, 10);
+    if ((parseEnd == content.c_str() + end) && (index < fileCount)) {
+      completed.push_back(static_cast<BSAULong>(index));
+    }
+  }
+}
+
+
+bool ExtractJournal::create(const std::string &fileName, BSAULong fileCount, BSAHash archiveSize,
+                            const std::vector<BSAULong> &completed)
+{
+  close(false);
+  m_FileName = fileName;
+  m_File.open(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!m_File.is_open()) {
+    return false;
+  }
+  m_File << makeHeader(fileCount, archiveSize) << '\n';
+  for (BSAULong index : completed) {
+    m_File << index << '\n';
+  }
+  return write();
+}
+
+
+void ExtractJournal::add(BSAULong index)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Pending.push_back(index);
+}
+
+
+bool ExtractJournal::flush()
+{
+  if (!m_File.is_open()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Writing.swap(m_Pending);
+  }
+  if (m_Writing.empty()) {
+    return !m_File.fail();
+  }
+  for (BSAULong index : m_Writing) {
+    m_File << index << '\n';
+  }
+  m_Writing.clear();
+  return write();
+}
+
+
+bool ExtractJournal::write()
+{
+  m_File.flush();
+  return !m_File.fail() && syncFile(m_FileName.c_str());
+}
+
+
+void ExtractJournal::close(bool remove)
+{
+  if (!m_File.is_open()) {
+    return;
+  }
+  flush();
+  m_File.close();
+  if (remove) {
+    std::remove(m_FileName.c_str());
+  }
+}
+
+} // namespace BA2
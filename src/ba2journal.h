@@ -0,0 +1,109 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_JOURNAL_H
+#define BA2_JOURNAL_H
+
+
+#include "ba2types.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace BA2 {
+
+  /**
+   * @brief record of the files an extraction completed, which lets an interrupted
+   * extraction resume. The journal is a text file starting with a line that
+   * identifies the archive, followed by the index of each completed file on a
+   * line of its own. A line cut off by a crash is ignored when reading.
+   * Workers add files from any thread; they are buffered and only written by flush,
+   * which syncs the journal to disk. Callers have to sync a file before adding it.
+   */
+  class ExtractJournal {
+
+  public:
+
+    ExtractJournal();
+    ~ExtractJournal();
+
+    ExtractJournal(const ExtractJournal&) = delete;
+    ExtractJournal &operator=(const ExtractJournal&) = delete;
+
+    /**
+     * read the journal of an earlier run
+     * @param fileName name of the journal file
+     * @param fileCount number of files in the archive
+     * @param archiveSize size of the archive file
+     * @param completed receives the files recorded as completed. It stays empty if
+     *                  the journal doesn't exist or belongs to another archive
+     */
+    static void load(const std::string &fileName, BSAULong fileCount, BSAHash archiveSize,
+                     std::vector<BSAULong> &completed);
+
+    /**
+     * start a new journal, replacing an existing one
+     * @param fileName name of the journal file
+     * @param fileCount number of files in the archive
+     * @param archiveSize size of the archive file
+     * @param completed files already known to be complete
+     * @return false if the journal can't be written
+     */
+    bool create(const std::string &fileName, BSAULong fileCount, BSAHash archiveSize,
+                const std::vector<BSAULong> &completed);
+
+    /**
+     * record a completed file. Thread safe
+     * @param index index of the file
+     */
+    void add(BSAULong index);
+
+    /**
+     * write the files added since the last flush and sync the journal to disk
+     * @return false if writing failed
+     */
+    bool flush();
+
+    /**
+     * flush and close the journal
+     * @param remove if true, the journal file is deleted
+     */
+    void close(bool remove);
+
+  private:
+
+    // flushes the stream and syncs the file
+    bool write();
+
+  private:
+
+    std::string m_FileName;
+    std::ofstream m_File;
+    std::mutex m_Mutex;
+    std::vector<BSAULong> m_Pending;
+    // indices flush took from m_Pending, kept to reuse the memory
+    std::vector<BSAULong> m_Writing;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_JOURNAL_H
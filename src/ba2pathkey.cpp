@@ -0,0 +1,73 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2pathkey.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BA2_PATHKEY_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace BA2 {
+
+static inline char normalizeCharacter(char ch)
+{
+  if ((ch >= 'A') && (ch <= 'Z')) {
+    return static_cast<char>(ch | 0x20);
+  }
+  return ch == '/' ? '\\' : ch;
+}
+
+
+std::string PathKey::normalize(const std::string &name)
+{
+  std::string key;
+  normalize(name.data(), name.size(), key);
+  return key;
+}
+
+
+void PathKey::normalize(const char *name, size_t length, std::string &key)
+{
+  key.resize(length);
+  char *output = &key[0];
+  size_t pos = 0;
+#ifdef BA2_PATHKEY_SSE2
+  // shifting 'A' to -128 turns the range check into a single signed compare
+  const __m128i shift = _mm_set1_epi8(static_cast<char>(0x80 - 'A'));
+  const __m128i upperLimit = _mm_set1_epi8(static_cast<char>(-128 + 26));
+  const __m128i caseBit = _mm_set1_epi8(0x20);
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i slashToBackslash = _mm_set1_epi8('/' ^ '\\');
+  for (; pos + 16 <= length; pos += 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(name + pos));
+    __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(chars, shift), upperLimit);
+    __m128i slashes = _mm_cmpeq_epi8(chars, slash);
+    chars = _mm_or_si128(chars, _mm_and_si128(upper, caseBit));
+    chars = _mm_xor_si128(chars, _mm_and_si128(slashes, slashToBackslash));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + pos), chars);
+  }
+#endif
+  for (; pos < length; ++pos) {
+    output[pos] = normalizeCharacter(name[pos]);
+  }
+}
+
+} // namespace BA2
@@ -0,0 +1,59 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_PATHKEY_H
+#define BA2_PATHKEY_H
+
+
+#include <cstddef>
+#include <string>
+
+
+namespace BA2 {
+
+  /**
+   * @brief normalized form of file names used to compare them.
+   * Names in archives are case insensitive and may use '/' or '\' as separator.
+   * A key is the name with ASCII letters in lower case and '\' as the only
+   * separator, so names can be compared, hashed and sorted as plain bytes. Keys
+   * have the same length as the name and every character stays at its position.
+   */
+  class PathKey {
+
+  public:
+
+    /**
+     * @param name a file name
+     * @return the key of the name
+     */
+    static std::string normalize(const std::string &name);
+
+    /**
+     * normalize a name into an existing string, reusing its memory
+     * @param name a file name
+     * @param length length of the name
+     * @param key receives the key
+     */
+    static void normalize(const char *name, size_t length, std::string &key);
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_PATHKEY_H
@@ -0,0 +1,336 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2search.h"
+#include "ba2entryreader.h"
+#include "ba2exception.h"
+#include "ba2pathkey.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+// literal searches decompress files in pieces of this size
+static const size_t PIECE_SIZE = 1024 * 1024;
+
+// std::regex backtracks recursively, with a stack frame for every character a match
+// attempt advances over. Regular expressions are therefore run on single lines and
+// long lines are cut into windows of this size, overlapping by REGEX_OVERLAP bytes
+static const size_t REGEX_WINDOW = 1024;
+static const size_t REGEX_OVERLAP = 256;
+
+
+namespace BA2 {
+
+typedef std::boyer_moore_horspool_searcher<std::string::const_iterator> Searcher;
+
+
+static void foldCase(char *data, size_t size)
+{
+  for (size_t i = 0; i < size; ++i) {
+    if ((data[i] >= 'A') && (data[i] <= 'Z')) {
+      data[i] = static_cast<char>(data[i] | 0x20);
+    }
+  }
+}
+
+
+static std::string foldCase(const std::string &value)
+{
+  std::string result(value);
+  if (!result.empty()) {
+    foldCase(&result[0], result.size());
+  }
+  return result;
+}
+
+
+// streams the file through a buffer that keeps the last literal.size() - 1 bytes
+// of each piece, so matches crossing pieces are found
+static void searchLiteral(EntryReader &reader, BSAULong index, const std::string &literal,
+                          const Searcher &searcher, bool ignoreCase, BSAULong maxMatches,
+                          std::vector<char> &buffer, std::vector<SearchMatch> &matches)
+{
+  size_t overlap = literal.size() - 1;
+  buffer.resize(overlap + PIECE_SIZE);
+
+  // position of buffer[0] in the file and where the next match may start at the earliest
+  BSAHash base = 0;
+  BSAHash next = 0;
+  size_t kept = 0;
+  BSAULong found = 0;
+  for (BSAHash pos = 0; pos < reader.size();) {
+    size_t count = static_cast<size_t>(std::min<BSAHash>(reader.size() - pos, PIECE_SIZE));
+    size_t read = 0;
+    if ((reader.read(pos, buffer.data() + kept, count, read) != ERROR_NONE) || (read != count)) {
+      throw data_invalid_exception("failed to read file");
+    }
+    if (ignoreCase) {
+      foldCase(buffer.data() + kept, count);
+    }
+    pos += count;
+
+    const char *begin = buffer.data();
+    const char *end = begin + kept + count;
+    const char *iter = begin + std::min<BSAHash>(next > base ? next - base : 0, kept + count);
+    while ((iter = std::search(iter, end, searcher)) != end) {
+      BSAHash offset = base + static_cast<BSAHash>(iter - begin);
+      matches.push_back({ index, offset, static_cast<BSAULong>(literal.size()) });
+      if ((maxMatches != 0) && (++found >= maxMatches)) {
+        return;
+      }
+      next = offset + literal.size();
+      iter += literal.size();
+    }
+
+    size_t keep = std::min(overlap, kept + count);
+    memmove(buffer.data(), end - keep, keep);
+    base += kept + count - keep;
+    kept = keep;
+  }
+}
+
+
+// returns false if the prefilter rejected the file
+static bool searchRegex(EntryReader &reader, BSAULong index, const std::regex &regex,
+                        const std::string &prefilter, const Searcher &prefilterSearcher,
+                        bool ignoreCase, BSAULong maxMatches, std::vector<char> &buffer,
+                        std::vector<SearchMatch> &matches)
+{
+  // the prefilter is streamed like a literal search, only files containing it
+  // are decompressed as a whole
+  if (!prefilter.empty()) {
+    std::vector<SearchMatch> hit;
+    searchLiteral(reader, index, prefilter, prefilterSearcher, ignoreCase, 1, buffer, hit);
+    if (hit.empty()) {
+      return false;
+    }
+  }
+
+  size_t size = static_cast<size_t>(reader.size());
+  buffer.resize(size);
+  size_t read = 0;
+  if ((size > 0) && ((reader.read(0, buffer.data(), size, read) != ERROR_NONE) || (read != size))) {
+    throw data_invalid_exception("failed to read file");
+  }
+  // the expression ignores case as well, folding the content doesn't change its matches
+  if (ignoreCase) {
+    foldCase(buffer.data(), size);
+  }
+
+  const char *begin = buffer.data();
+  const char *end = begin + size;
+
+  BSAULong found = 0;
+  // where the next match may start at the earliest
+  const char *resume = begin;
+  for (const char *line = begin; line < end;) {
+    const char *lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+    if (lineEnd == nullptr) {
+      lineEnd = end;
+    }
+
+    for (const char *window = line;;) {
+      bool lastWindow = static_cast<size_t>(lineEnd - window) <= REGEX_WINDOW;
+      const char *windowEnd = lastWindow ? lineEnd : window + REGEX_WINDOW;
+      // matches starting in the overlap are left to the next window, which sees more of them
+      const char *limit = lastWindow ? lineEnd : windowEnd - REGEX_OVERLAP;
+      const char *start = std::max(window, resume);
+
+      // '^' and '$' only match at the ends of the line, not of a window
+      std::regex_constants::match_flag_type flags = std::regex_constants::match_default;
+      if (start != line) {
+        flags |= std::regex_constants::match_prev_avail;
+      }
+      if (!lastWindow) {
+        flags |= std::regex_constants::match_not_eol;
+      }
+      for (std::cregex_iterator iter(start, windowEnd, regex, flags), last; iter != last; ++iter) {
+        const char *match = start + iter->position(0);
+        if (!lastWindow && (match >= limit)) {
+          break;
+        }
+        if (iter->length(0) == 0) {
+          continue;
+        }
+        matches.push_back({ index, static_cast<BSAHash>(match - begin),
+                            static_cast<BSAULong>(iter->length(0)) });
+        if ((maxMatches != 0) && (++found >= maxMatches)) {
+          return true;
+        }
+        resume = match + iter->length(0);
+      }
+      if (lastWindow) {
+        break;
+      }
+      window = limit;
+    }
+    line = lineEnd + 1;
+  }
+  return true;
+}
+
+
+ContentSearch::ContentSearch()
+  : m_UseRegex(false)
+  , m_IgnoreCase(false)
+  , m_MaxMatches(0)
+  , m_SearchedCount(0)
+  , m_RejectedCount(0)
+{
+}
+
+
+void ContentSearch::setLiteral(const std::string &bytes, bool ignoreCase)
+{
+  m_Literal = ignoreCase ? foldCase(bytes) : bytes;
+  m_UseRegex = false;
+  m_IgnoreCase = ignoreCase;
+}
+
+
+bool ContentSearch::setRegex(const std::string &pattern, bool ignoreCase)
+{
+  try {
+    std::regex::flag_type flags = std::regex::ECMAScript | std::regex::optimize;
+    if (ignoreCase) {
+      flags |= std::regex::icase;
+    }
+    m_Regex.assign(pattern, flags);
+  } catch (const std::regex_error &e) {
+    m_LastError = e.what();
+    return false;
+  }
+  m_UseRegex = true;
+  m_IgnoreCase = ignoreCase;
+  return true;
+}
+
+
+void ContentSearch::addExtension(const std::string &extension)
+{
+  m_Extensions.push_back(PathKey::normalize(extension));
+}
+
+
+bool ContentSearch::selected(const Archive &archive, BSAULong index) const
+{
+  if (!m_Extensions.empty()) {
+    const std::string &key = archive.getFileKey(index);
+    bool match = std::any_of(m_Extensions.begin(), m_Extensions.end(), [&key](const std::string &extension) {
+      return (key.size() >= extension.size())
+          && (key.compare(key.size() - extension.size(), extension.size(), extension) == 0);
+    });
+    if (!match) {
+      return false;
+    }
+  }
+  return !m_Filter || m_Filter(index, archive.m_TableNames[index]);
+}
+
+
+EErrorCode ContentSearch::search(const Archive &archive, unsigned int threads)
+{
+  m_Matches.clear();
+  m_SearchedCount = 0;
+  m_RejectedCount = 0;
+  m_LastError.clear();
+
+  if (!m_UseRegex && m_Literal.empty()) {
+    m_LastError = "nothing to search for";
+    return ERROR_INVALIDDATA;
+  }
+
+  const std::vector<std::string> &names = archive.m_TableNames;
+  std::vector<BSAULong> selection;
+  for (BSAULong i = 0; i < names.size(); ++i) {
+    if (selected(archive, i)) {
+      selection.push_back(i);
+    }
+  }
+
+  std::string prefilter = m_IgnoreCase ? foldCase(m_Prefilter) : m_Prefilter;
+  Searcher literalSearcher(m_Literal.begin(), m_Literal.end());
+  Searcher prefilterSearcher(prefilter.begin(), prefilter.end());
+
+  std::atomic<size_t> next(0);
+  std::atomic<BSAULong> rejected(0);
+  std::atomic<int> result(ERROR_NONE);
+  std::mutex mutex;
+
+  auto worker = [&]() {
+    std::vector<char> buffer;
+    std::vector<SearchMatch> matches;
+    EntryReader reader;
+    for (size_t position = next++; (position < selection.size()) && (result.load() == ERROR_NONE);
+         position = next++) {
+      BSAULong index = selection[position];
+      try {
+        if (reader.open(archive, index) != ERROR_NONE) {
+          throw data_invalid_exception("failed to read file");
+        }
+        if (!m_UseRegex) {
+          searchLiteral(reader, index, m_Literal, literalSearcher, m_IgnoreCase, m_MaxMatches,
+                        buffer, matches);
+        }
+        else if (!searchRegex(reader, index, m_Regex, prefilter, prefilterSearcher, m_IgnoreCase,
+                              m_MaxMatches, buffer, matches)) {
+          ++rejected;
+        }
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int expected = ERROR_NONE;
+        if (result.compare_exchange_strong(expected, ERROR_INVALIDDATA)) {
+          m_LastError = makeString("%s: %s", names[index].c_str(), e.what());
+        }
+      }
+    }
+    reader.close();
+    std::lock_guard<std::mutex> lock(mutex);
+    m_Matches.insert(m_Matches.end(), matches.begin(), matches.end());
+  };
+
+  unsigned int numThreads = static_cast<unsigned int>(
+    std::max<size_t>(1, std::min<size_t>(threads, selection.size())));
+  std::vector<std::thread> workers;
+  for (unsigned int i = 1; i < numThreads; ++i) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (std::thread &thread : workers) {
+    thread.join();
+  }
+
+  if (result.load() != ERROR_NONE) {
+    m_Matches.clear();
+    return static_cast<EErrorCode>(result.load());
+  }
+
+  std::sort(m_Matches.begin(), m_Matches.end(), [](const SearchMatch &lhs, const SearchMatch &rhs) {
+    return (lhs.index < rhs.index) || ((lhs.index == rhs.index) && (lhs.offset < rhs.offset));
+  });
+  m_SearchedCount = static_cast<BSAULong>(selection.size());
+  m_RejectedCount = rejected.load();
+  return ERROR_NONE;
+}
+
+} // namespace BA2
@@ -0,0 +1,163 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_SEARCH_H
+#define BA2_SEARCH_H
+
+
+#include "errorcodes.h"
+#include "ba2types.h"
+#include "ba2archive.h"
+#include <regex>
+#include <string>
+#include <vector>
+
+
+namespace BA2 {
+
+  /**
+   * @brief a match found by ContentSearch
+   */
+  struct SearchMatch {
+    /// index of the file in the archive
+    BSAULong index;
+    /// position of the match in the file content
+    BSAHash offset;
+    /// length of the match in bytes
+    BSAULong length;
+  };
+
+  /**
+   * @brief searches the content of the files in an archive for a byte sequence
+   * or a regular expression, without extracting anything.
+   * Files are selected by name first (filter and extensions), then decompressed
+   * in memory by several threads. Literal searches stream each file in pieces and
+   * don't need it in memory as a whole. Regular expressions are run on the
+   * complete content. Files are streamed for the prefilter first, those that
+   * don't contain it are rejected without being decompressed as a whole.
+   * Textures are searched including their dds header.
+   * Matches don't overlap.
+   */
+  class ContentSearch {
+
+  public:
+
+    ContentSearch();
+
+    /**
+     * search for a byte sequence
+     * @param bytes the bytes to find, must not be empty
+     * @param ignoreCase if true, ASCII letters match regardless of case
+     */
+    void setLiteral(const std::string &bytes, bool ignoreCase = false);
+
+    /**
+     * search for a regular expression in ECMAScript syntax. Each byte of the
+     * content is matched as a character. Like grep, the expression is applied to
+     * each line on its own, '^' and '$' match at line boundaries and matches don't
+     * span lines. Lines longer than 1 KiB are searched in overlapping windows, in
+     * those only matches of up to 256 bytes are certain to be found in full
+     * @param pattern the regular expression
+     * @param ignoreCase if true, letters match regardless of case
+     * @return false if the expression is invalid, see getLastError
+     */
+    bool setRegex(const std::string &pattern, bool ignoreCase = false);
+
+    /**
+     * set bytes every match of the regular expression contains, usually a literal
+     * part of it. Files are searched for them in pieces first, files that don't
+     * contain them are skipped without being read as a whole or running the
+     * expression. Compared case insensitively if the expression is. Ignored by
+     * literal searches
+     * @param bytes the bytes, empty to search all files with the expression
+     */
+    void setPrefilter(const std::string &bytes) { m_Prefilter = bytes; }
+
+    /**
+     * @param filter only files it accepts are searched
+     */
+    void setFilter(const ExtractFilter &filter) { m_Filter = filter; }
+
+    /**
+     * restrict the search to files with an extension. Can be called repeatedly,
+     * files with any of the extensions are searched
+     * @param extension the extension including the dot, case insensitive
+     */
+    void addExtension(const std::string &extension);
+
+    /**
+     * @param count maximum number of matches reported per file, 0 for all. With 1
+     *              the search of a file ends at its first match
+     */
+    void setMaxMatchesPerFile(BSAULong count) { m_MaxMatches = count; }
+
+    /**
+     * search an archive
+     * @param archive the archive
+     * @param threads number of threads searching files
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode search(const Archive &archive, unsigned int threads = 1);
+
+    /**
+     * @return matches found by the last search, sorted by file index and offset
+     */
+    const std::vector<SearchMatch> &getMatches() const { return m_Matches; }
+
+    /**
+     * @return number of files the last search read
+     */
+    BSAULong getSearchedCount() const { return m_SearchedCount; }
+
+    /**
+     * @return number of files the prefilter rejected in the last search
+     */
+    BSAULong getRejectedCount() const { return m_RejectedCount; }
+
+    /**
+     * @return description of the problem encountered by the last failed call
+     */
+    const std::string &getLastError() const { return m_LastError; }
+
+  private:
+
+    bool selected(const Archive &archive, BSAULong index) const;
+
+  private:
+
+    // the literal, in lower case if case is ignored
+    std::string m_Literal;
+    bool m_UseRegex;
+    std::regex m_Regex;
+    std::string m_Prefilter;
+    bool m_IgnoreCase;
+    ExtractFilter m_Filter;
+    std::vector<std::string> m_Extensions;
+    BSAULong m_MaxMatches;
+
+    std::vector<SearchMatch> m_Matches;
+    BSAULong m_SearchedCount;
+    BSAULong m_RejectedCount;
+    std::string m_LastError;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_SEARCH_H
@@ -0,0 +1,86 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2statistics.h"
+
+
+namespace BA2 {
+
+Statistics::Statistics()
+  : bytesRead(0)
+  , readCalls(0)
+  , bytesInflated(0)
+  , bytesWritten(0)
+  , indexTime(0)
+  , nameTableTime(0)
+  , inflateTime(0)
+  , outputOpenTime(0)
+  , outputWriteTime(0)
+  , peakBufferMemory(0)
+{
+}
+
+
+StatisticsCollector::StatisticsCollector()
+{
+  reset();
+}
+
+
+void StatisticsCollector::reset()
+{
+  m_BytesRead = 0;
+  m_ReadCalls = 0;
+  m_BytesInflated = 0;
+  m_BytesWritten = 0;
+  for (int i = 0; i < NUM_PHASES; ++i) {
+    m_Time[i] = 0;
+  }
+  m_BufferMemory = 0;
+  m_PeakBufferMemory = 0;
+}
+
+
+void StatisticsCollector::addBufferMemory(int64_t bytes)
+{
+  int64_t current = m_BufferMemory.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t peak = m_PeakBufferMemory.load(std::memory_order_relaxed);
+  while ((current > peak)
+         && !m_PeakBufferMemory.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+  }
+}
+
+
+Statistics StatisticsCollector::snapshot() const
+{
+  Statistics result;
+  result.bytesRead = m_BytesRead;
+  result.readCalls = m_ReadCalls;
+  result.bytesInflated = m_BytesInflated;
+  result.bytesWritten = m_BytesWritten;
+  result.indexTime = std::chrono::nanoseconds(m_Time[PHASE_INDEX]);
+  result.nameTableTime = std::chrono::nanoseconds(m_Time[PHASE_NAMETABLE]);
+  result.inflateTime = std::chrono::nanoseconds(m_Time[PHASE_INFLATE]);
+  result.outputOpenTime = std::chrono::nanoseconds(m_Time[PHASE_OUTPUTOPEN]);
+  result.outputWriteTime = std::chrono::nanoseconds(m_Time[PHASE_OUTPUTWRITE]);
+  result.peakBufferMemory = static_cast<BSAHash>(m_PeakBufferMemory.load());
+  return result;
+}
+
+} // namespace BA2
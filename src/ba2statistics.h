@@ -0,0 +1,153 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_STATISTICS_H
+#define BA2_STATISTICS_H
+
+
+#include "ba2types.h"
+#include <atomic>
+#include <chrono>
+
+
+namespace BA2 {
+
+  /**
+   * @brief performance counters of opening an archive or extracting from it.
+   * Times are summed over all threads involved so with multiple worker threads
+   * they may exceed the wall clock time of the operation.
+   */
+  struct Statistics {
+    Statistics();
+
+    /// number of bytes read from the archive
+    BSAHash bytesRead;
+    /// number of read system calls
+    BSAHash readCalls;
+    /// number of bytes produced by decompression
+    BSAHash bytesInflated;
+    /// number of bytes written to output files
+    BSAHash bytesWritten;
+    /// time spent reading and parsing the header and file index
+    std::chrono::nanoseconds indexTime;
+    /// time spent reading and parsing the name table
+    std::chrono::nanoseconds nameTableTime;
+    /// time spent decompressing
+    std::chrono::nanoseconds inflateTime;
+    /// time spent creating directories and opening output files
+    std::chrono::nanoseconds outputOpenTime;
+    /// time spent writing output files
+    std::chrono::nanoseconds outputWriteTime;
+    /// largest amount of buffer memory held at the same time
+    BSAHash peakBufferMemory;
+  };
+
+  enum EStatisticsPhase {
+    PHASE_INDEX,
+    PHASE_NAMETABLE,
+    PHASE_INFLATE,
+    PHASE_OUTPUTOPEN,
+    PHASE_OUTPUTWRITE,
+    NUM_PHASES
+  };
+
+  /**
+   * @brief thread safe accumulator for Statistics. Code collecting statistics
+   * receives a pointer to a collector which is null if collection is disabled.
+   */
+  class StatisticsCollector {
+
+  public:
+
+    StatisticsCollector();
+
+    StatisticsCollector(const StatisticsCollector&) = delete;
+    StatisticsCollector &operator=(const StatisticsCollector&) = delete;
+
+    void reset();
+
+    void addRead(BSAHash bytes) {
+      m_BytesRead.fetch_add(bytes, std::memory_order_relaxed);
+      m_ReadCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void addInflated(BSAHash bytes) { m_BytesInflated.fetch_add(bytes, std::memory_order_relaxed); }
+
+    void addWritten(BSAHash bytes) { m_BytesWritten.fetch_add(bytes, std::memory_order_relaxed); }
+
+    void addTime(EStatisticsPhase phase, std::chrono::nanoseconds time) {
+      m_Time[phase].fetch_add(time.count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * track buffer memory. Call with a negative value when releasing memory
+     */
+    void addBufferMemory(int64_t bytes);
+
+    Statistics snapshot() const;
+
+  private:
+
+    std::atomic<BSAHash> m_BytesRead;
+    std::atomic<BSAHash> m_ReadCalls;
+    std::atomic<BSAHash> m_BytesInflated;
+    std::atomic<BSAHash> m_BytesWritten;
+    std::atomic<int64_t> m_Time[NUM_PHASES];
+    std::atomic<int64_t> m_BufferMemory;
+    std::atomic<int64_t> m_PeakBufferMemory;
+
+  };
+
+  /**
+   * @brief adds the time between construction and destruction to a phase.
+   * Doesn't even query the clock if collection is disabled
+   */
+  class StatisticsTimer {
+
+  public:
+
+    StatisticsTimer(StatisticsCollector *collector, EStatisticsPhase phase)
+      : m_Collector(collector)
+      , m_Phase(phase)
+    {
+      if (m_Collector != nullptr) {
+        m_Start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~StatisticsTimer() {
+      if (m_Collector != nullptr) {
+        m_Collector->addTime(m_Phase, std::chrono::steady_clock::now() - m_Start);
+      }
+    }
+
+    StatisticsTimer(const StatisticsTimer&) = delete;
+    StatisticsTimer &operator=(const StatisticsTimer&) = delete;
+
+  private:
+
+    StatisticsCollector *m_Collector;
+    EStatisticsPhase m_Phase;
+    std::chrono::steady_clock::time_point m_Start;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_STATISTICS_H
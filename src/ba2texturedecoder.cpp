@@ -0,0 +1,552 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2texturedecoder.h"
+#include "dds.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BA2_TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace BA2 {
+
+// pixels of a 4x4 block, row major, RGBA with red in the lowest byte
+typedef uint32_t BlockPixels[16];
+
+static inline uint32_t makePixel(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+  return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+
+static inline uint64_t readBits64(const BSAUChar *data)
+{
+  uint64_t result;
+  memcpy(&result, data, sizeof(result));
+  return result;
+}
+
+
+// pixels[i] |= palette[index of pixel i], with indices of indexBits bits each
+// stored consecutively starting at the lowest bit
+static void orPalette(const uint32_t *palette, int indexBits, uint64_t indices, BlockPixels pixels)
+{
+#ifdef BA2_TEXTURE_SSE2
+  // a row of the block is 4 indices, each lane masks out the index of its pixel
+  // and compares it against each palette entry shifted into the same position
+  const int count = 1 << indexBits;
+  const uint32_t mask = static_cast<uint32_t>(count - 1);
+  const __m128i laneMask = _mm_set_epi32(static_cast<int>(mask << (3 * indexBits)),
+                                         static_cast<int>(mask << (2 * indexBits)),
+                                         static_cast<int>(mask << indexBits),
+                                         static_cast<int>(mask));
+  for (int row = 0; row < 4; ++row) {
+    uint32_t rowIndices = static_cast<uint32_t>(indices >> (4 * indexBits * row));
+    __m128i lanes = _mm_and_si128(_mm_set1_epi32(static_cast<int>(rowIndices)), laneMask);
+    __m128i *target = reinterpret_cast<__m128i*>(pixels + 4 * row);
+    __m128i result = _mm_loadu_si128(target);
+    for (int k = 0; k < count; ++k) {
+      const uint32_t key = static_cast<uint32_t>(k);
+      __m128i keys = _mm_set_epi32(static_cast<int>(key << (3 * indexBits)),
+                                   static_cast<int>(key << (2 * indexBits)),
+                                   static_cast<int>(key << indexBits),
+                                   static_cast<int>(key));
+      __m128i selected = _mm_cmpeq_epi32(lanes, keys);
+      result = _mm_or_si128(result, _mm_and_si128(selected, _mm_set1_epi32(static_cast<int>(palette[k]))));
+    }
+    _mm_storeu_si128(target, result);
+  }
+#else
+  const uint64_t mask = (1u << indexBits) - 1;
+  for (int i = 0; i < 16; ++i) {
+    pixels[i] |= palette[(indices >> (indexBits * i)) & mask];
+  }
+#endif
+}
+
+
+// color block shared by BC1, BC2 and BC3. Only BC1 uses the 3 color mode with
+// transparent black, the others always interpolate 4 colors
+static void decodeColorBlock(const BSAUChar *block, bool bc1, BlockPixels pixels)
+{
+  uint32_t color0 = block[0] | (block[1] << 8);
+  uint32_t color1 = block[2] | (block[3] << 8);
+  uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+
+  uint32_t r[4], g[4], b[4];
+  // 565 to 888 by replicating the top bits
+  const uint32_t colors[2] = { color0, color1 };
+  for (int i = 0; i < 2; ++i) {
+    uint32_t red = (colors[i] >> 11) & 0x1F;
+    uint32_t green = (colors[i] >> 5) & 0x3F;
+    uint32_t blue = colors[i] & 0x1F;
+    r[i] = (red << 3) | (red >> 2);
+    g[i] = (green << 2) | (green >> 4);
+    b[i] = (blue << 3) | (blue >> 2);
+  }
+
+  uint32_t alpha = bc1 ? 0xFF : 0;
+  uint32_t palette[4];
+  palette[0] = makePixel(r[0], g[0], b[0], alpha);
+  palette[1] = makePixel(r[1], g[1], b[1], alpha);
+  if (!bc1 || (color0 > color1)) {
+    palette[2] = makePixel((2 * r[0] + r[1]) / 3, (2 * g[0] + g[1]) / 3, (2 * b[0] + b[1]) / 3, alpha);
+    palette[3] = makePixel((r[0] + 2 * r[1]) / 3, (g[0] + 2 * g[1]) / 3, (b[0] + 2 * b[1]) / 3, alpha);
+  }
+  else {
+    palette[2] = makePixel((r[0] + r[1]) / 2, (g[0] + g[1]) / 2, (b[0] + b[1]) / 2, alpha);
+    palette[3] = 0;
+  }
+  orPalette(palette, 2, indices, pixels);
+}
+
+
+// single channel block as used for BC3 alpha and the BC5 channels, the channel is
+// shifted into place
+static void decodeChannelBlock(const BSAUChar *block, int shift, BlockPixels pixels)
+{
+  uint32_t value0 = block[0];
+  uint32_t value1 = block[1];
+  uint32_t palette[8];
+  palette[0] = value0;
+  palette[1] = value1;
+  if (value0 > value1) {
+    for (uint32_t i = 1; i < 7; ++i) {
+      palette[i + 1] = ((7 - i) * value0 + i * value1) / 7;
+    }
+  }
+  else {
+    for (uint32_t i = 1; i < 5; ++i) {
+      palette[i + 1] = ((5 - i) * value0 + i * value1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+  for (uint32_t &entry : palette) {
+    entry <<= shift;
+  }
+  orPalette(palette, 3, readBits64(block) >> 16, pixels);
+}
+
+
+static void decodeBC1(const BSAUChar *block, BlockPixels pixels)
+{
+  memset(pixels, 0, sizeof(BlockPixels));
+  decodeColorBlock(block, true, pixels);
+}
+
+
+static void decodeBC2(const BSAUChar *block, BlockPixels pixels)
+{
+  static const uint32_t alphaPalette[16] = {
+    0x00u << 24, 0x11u << 24, 0x22u << 24, 0x33u << 24, 0x44u << 24, 0x55u << 24, 0x66u << 24, 0x77u << 24,
+    0x88u << 24, 0x99u << 24, 0xAAu << 24, 0xBBu << 24, 0xCCu << 24, 0xDDu << 24, 0xEEu << 24, 0xFFu << 24
+  };
+  memset(pixels, 0, sizeof(BlockPixels));
+  orPalette(alphaPalette, 4, readBits64(block), pixels);
+  decodeColorBlock(block + 8, false, pixels);
+}
+
+
+static void decodeBC3(const BSAUChar *block, BlockPixels pixels)
+{
+  memset(pixels, 0, sizeof(BlockPixels));
+  decodeChannelBlock(block, 24, pixels);
+  decodeColorBlock(block + 8, false, pixels);
+}
+
+
+static void decodeBC5(const BSAUChar *block, BlockPixels pixels)
+{
+  std::fill(pixels, pixels + 16, 0xFF000000u);
+  decodeChannelBlock(block, 0, pixels);
+  decodeChannelBlock(block + 8, 8, pixels);
+}
+
+
+// BC7
+
+struct BC7Mode {
+  int subsets;
+  int partitionBits;
+  int rotationBits;
+  int indexSelectionBits;
+  int colorBits;
+  int alphaBits;
+  int endpointPBits;
+  int sharedPBits;
+  int indexBits;
+  int secondaryIndexBits;
+};
+
+static const BC7Mode BC7_MODES[8] = {
+  { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+  { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+  { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+  { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+  { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+  { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+  { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+  { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+};
+
+// pixels belonging to the second subset of the two subset partitions
+static const uint16_t BC7_PARTITIONS2[64] = {
+  0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+  0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+  0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+  0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+  0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+  0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+  0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+  0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+};
+
+static const BSAUChar BC7_PARTITIONS3[64][16] = {
+  { 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 1, 2, 2, 2, 2 }, { 0, 0, 0, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 2, 1 },
+  { 0, 0, 0, 0, 2, 0, 0, 1, 2, 2, 1, 1, 2, 2, 1, 1 }, { 0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 1, 0, 1, 1, 1 },
+  { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2 }, { 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 2, 2 },
+  { 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1 }, { 0, 0, 1, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1 },
+  { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2 }, { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2 },
+  { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2 }, { 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2 },
+  { 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2 }, { 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2 },
+  { 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2, 1, 2, 2, 2 }, { 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0, 2, 2, 2, 0 },
+  { 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2 }, { 0, 1, 1, 1, 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0 },
+  { 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2 }, { 0, 0, 2, 2, 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1 },
+  { 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2, 0, 2, 2, 2 }, { 0, 0, 0, 1, 0, 0, 0, 1, 2, 2, 2, 1, 2, 2, 2, 1 },
+  { 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2 }, { 0, 0, 0, 0, 1, 1, 0, 0, 2, 2, 1, 0, 2, 2, 1, 0 },
+  { 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1, 0, 0, 0, 0 }, { 0, 0, 1, 2, 0, 0, 1, 2, 1, 1, 2, 2, 2, 2, 2, 2 },
+  { 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1, 0, 1, 1, 0 }, { 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1 },
+  { 0, 0, 2, 2, 1, 1, 0, 2, 1, 1, 0, 2, 0, 0, 2, 2 }, { 0, 1, 1, 0, 0, 1, 1, 0, 2, 0, 0, 2, 2, 2, 2, 2 },
+  { 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1 }, { 0, 0, 0, 0, 2, 0, 0, 0, 2, 2, 1, 1, 2, 2, 2, 1 },
+  { 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 2, 2, 2 }, { 0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 2, 0, 0, 1, 1 },
+  { 0, 0, 1, 1, 0, 0, 1, 2, 0, 0, 2, 2, 0, 2, 2, 2 }, { 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0 },
+  { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0 }, { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0 },
+  { 0, 1, 2, 0, 2, 0, 1, 2, 1, 2, 0, 1, 0, 1, 2, 0 }, { 0, 0, 1, 1, 2, 2, 0, 0, 1, 1, 2, 2, 0, 0, 1, 1 },
+  { 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0, 1, 1 }, { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2 },
+  { 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1 }, { 0, 0, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2, 1, 1, 2, 2 },
+  { 0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 1, 1 }, { 0, 2, 2, 0, 1, 2, 2, 1, 0, 2, 2, 0, 1, 2, 2, 1 },
+  { 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 0, 1, 0, 1 }, { 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1 },
+  { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 }, { 0, 2, 2, 2, 0, 1, 1, 1, 0, 2, 2, 2, 0, 1, 1, 1 },
+  { 0, 0, 0, 2, 1, 1, 1, 2, 0, 0, 0, 2, 1, 1, 1, 2 }, { 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2 },
+  { 0, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2 }, { 0, 0, 0, 2, 1, 1, 1, 2, 1, 1, 1, 2, 0, 0, 0, 2 },
+  { 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2 }, { 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2 },
+  { 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2, 2, 2, 2, 2 }, { 0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2 },
+  { 0, 0, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2 }, { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2 },
+  { 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1 }, { 0, 2, 2, 2, 1, 2, 2, 2, 0, 2, 2, 2, 1, 2, 2, 2 },
+  { 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 }, { 0, 1, 1, 1, 2, 0, 1, 1, 2, 2, 0, 1, 2, 2, 2, 0 }
+};
+
+// index of the pixel whose index has an implicit top bit, for the second subset of
+// two subset partitions and the second and third subset of three subset partitions
+static const BSAUChar BC7_ANCHORS2[64] = {
+  15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+  15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+  15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+   6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+};
+
+static const BSAUChar BC7_ANCHORS3A[64] = {
+   3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+   3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+   8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+   3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3
+};
+
+static const BSAUChar BC7_ANCHORS3B[64] = {
+  15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+  15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+  15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+  15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8
+};
+
+static const BSAUChar BC7_WEIGHTS2[4] = { 0, 21, 43, 64 };
+static const BSAUChar BC7_WEIGHTS3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const BSAUChar BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+
+// reads the 128 bits of a block from the lowest bit up
+class BitReader {
+public:
+  explicit BitReader(const BSAUChar *block)
+    : m_Low(readBits64(block)), m_High(readBits64(block + 8)), m_Position(0) {}
+
+  uint32_t read(int count) {
+    uint32_t result = 0;
+    for (int i = 0; i < count; ++i, ++m_Position) {
+      uint64_t bit = m_Position < 64 ? (m_Low >> m_Position) : (m_High >> (m_Position - 64));
+      result |= static_cast<uint32_t>(bit & 1) << i;
+    }
+    return result;
+  }
+
+private:
+  uint64_t m_Low;
+  uint64_t m_High;
+  int m_Position;
+};
+
+
+static inline uint32_t bc7Interpolate(uint32_t e0, uint32_t e1, uint32_t weight)
+{
+  return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+
+static inline const BSAUChar *bc7Weights(int bits)
+{
+  return bits == 2 ? BC7_WEIGHTS2 : (bits == 3 ? BC7_WEIGHTS3 : BC7_WEIGHTS4);
+}
+
+
+static void decodeBC7(const BSAUChar *block, BlockPixels pixels)
+{
+  int modeIndex = 0;
+  while ((modeIndex < 8) && ((block[0] & (1 << modeIndex)) == 0)) {
+    ++modeIndex;
+  }
+  if (modeIndex == 8) {
+    // reserved, decodes to transparent black
+    memset(pixels, 0, sizeof(BlockPixels));
+    return;
+  }
+
+  const BC7Mode &mode = BC7_MODES[modeIndex];
+  BitReader bits(block);
+  bits.read(modeIndex + 1);
+  uint32_t partition = bits.read(mode.partitionBits);
+  uint32_t rotation = bits.read(mode.rotationBits);
+  uint32_t indexSelection = bits.read(mode.indexSelectionBits);
+
+  // endpoints[subset * 2 + endpoint][channel]
+  uint32_t endpoints[6][4];
+  int numEndpoints = mode.subsets * 2;
+  for (int channel = 0; channel < 3; ++channel) {
+    for (int i = 0; i < numEndpoints; ++i) {
+      endpoints[i][channel] = bits.read(mode.colorBits);
+    }
+  }
+  for (int i = 0; i < numEndpoints; ++i) {
+    endpoints[i][3] = mode.alphaBits > 0 ? bits.read(mode.alphaBits) : 255;
+  }
+
+  int colorBits = mode.colorBits;
+  int alphaBits = mode.alphaBits;
+  if ((mode.endpointPBits != 0) || (mode.sharedPBits != 0)) {
+    uint32_t pBits[6];
+    if (mode.endpointPBits != 0) {
+      for (int i = 0; i < numEndpoints; ++i) {
+        pBits[i] = bits.read(1);
+      }
+    }
+    else {
+      for (int subset = 0; subset < mode.subsets; ++subset) {
+        pBits[subset * 2] = pBits[subset * 2 + 1] = bits.read(1);
+      }
+    }
+    for (int i = 0; i < numEndpoints; ++i) {
+      for (int channel = 0; channel < (alphaBits > 0 ? 4 : 3); ++channel) {
+        endpoints[i][channel] = (endpoints[i][channel] << 1) | pBits[i];
+      }
+    }
+    ++colorBits;
+    if (alphaBits > 0) {
+      ++alphaBits;
+    }
+  }
+
+  // expand to 8 bits by replicating the top bits
+  for (int i = 0; i < numEndpoints; ++i) {
+    for (int channel = 0; channel < 4; ++channel) {
+      int channelBits = channel < 3 ? colorBits : alphaBits;
+      if (channelBits > 0) {
+        uint32_t value = endpoints[i][channel] << (8 - channelBits);
+        endpoints[i][channel] = value | (value >> channelBits);
+      }
+    }
+  }
+
+  int subsetOf[16];
+  int anchors[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; ++i) {
+    if (mode.subsets == 2) {
+      subsetOf[i] = (BC7_PARTITIONS2[partition] >> i) & 1;
+    }
+    else if (mode.subsets == 3) {
+      subsetOf[i] = BC7_PARTITIONS3[partition][i];
+    }
+    else {
+      subsetOf[i] = 0;
+    }
+  }
+  if (mode.subsets == 2) {
+    anchors[1] = BC7_ANCHORS2[partition];
+  }
+  else if (mode.subsets == 3) {
+    anchors[1] = BC7_ANCHORS3A[partition];
+    anchors[2] = BC7_ANCHORS3B[partition];
+  }
+
+  uint32_t indices[16];
+  for (int i = 0; i < 16; ++i) {
+    bool anchor = (i == anchors[subsetOf[i]]);
+    indices[i] = bits.read(anchor ? mode.indexBits - 1 : mode.indexBits);
+  }
+  uint32_t secondaryIndices[16];
+  if (mode.secondaryIndexBits > 0) {
+    for (int i = 0; i < 16; ++i) {
+      secondaryIndices[i] = bits.read(i == 0 ? mode.secondaryIndexBits - 1 : mode.secondaryIndexBits);
+    }
+  }
+
+  const BSAUChar *colorWeights = bc7Weights(mode.indexBits);
+  const BSAUChar *alphaWeights = colorWeights;
+  const uint32_t *colorIndices = indices;
+  const uint32_t *alphaIndices = indices;
+  if (mode.secondaryIndexBits > 0) {
+    alphaWeights = bc7Weights(mode.secondaryIndexBits);
+    alphaIndices = secondaryIndices;
+    if (indexSelection != 0) {
+      std::swap(colorWeights, alphaWeights);
+      std::swap(colorIndices, alphaIndices);
+    }
+  }
+
+  for (int i = 0; i < 16; ++i) {
+    const uint32_t *e0 = endpoints[subsetOf[i] * 2];
+    const uint32_t *e1 = endpoints[subsetOf[i] * 2 + 1];
+    uint32_t colorWeight = colorWeights[colorIndices[i]];
+    uint32_t alphaWeight = alphaWeights[alphaIndices[i]];
+    uint32_t channels[4] = {
+      bc7Interpolate(e0[0], e1[0], colorWeight),
+      bc7Interpolate(e0[1], e1[1], colorWeight),
+      bc7Interpolate(e0[2], e1[2], colorWeight),
+      bc7Interpolate(e0[3], e1[3], alphaWeight)
+    };
+    if (rotation != 0) {
+      std::swap(channels[3], channels[rotation - 1]);
+    }
+    pixels[i] = makePixel(channels[0], channels[1], channels[2], channels[3]);
+  }
+}
+
+
+typedef void (*BlockDecoder)(const BSAUChar *block, BlockPixels pixels);
+
+static bool blockFormat(BSAULong format, BlockDecoder &decoder, size_t &blockSize)
+{
+  switch (format) {
+    case DXGI_FORMAT_BC1_UNORM: decoder = decodeBC1; blockSize = 8; return true;
+    case DXGI_FORMAT_BC2_UNORM: decoder = decodeBC2; blockSize = 16; return true;
+    case DXGI_FORMAT_BC3_UNORM: decoder = decodeBC3; blockSize = 16; return true;
+    case DXGI_FORMAT_BC5_UNORM: decoder = decodeBC5; blockSize = 16; return true;
+    case DXGI_FORMAT_BC7_UNORM: decoder = decodeBC7; blockSize = 16; return true;
+    default: return false;
+  }
+}
+
+
+bool TextureDecoder::isSupported(BSAULong format)
+{
+  return surfaceSize(format, 1, 1) != 0;
+}
+
+
+BSAHash TextureDecoder::surfaceSize(BSAULong format, BSAULong width, BSAULong height)
+{
+  BlockDecoder decoder;
+  size_t blockSize;
+  if (blockFormat(format, decoder, blockSize)) {
+    return static_cast<BSAHash>(std::max<BSAULong>(1, (width + 3) / 4))
+         * std::max<BSAULong>(1, (height + 3) / 4) * blockSize;
+  }
+  switch (format) {
+    case DXGI_FORMAT_B8G8R8A8_UNORM: return static_cast<BSAHash>(width) * height * 4;
+    case DXGI_FORMAT_R8_UNORM: return static_cast<BSAHash>(width) * height;
+    default: return 0;
+  }
+}
+
+
+BSAULong TextureDecoder::maxMipCount(BSAULong width, BSAULong height)
+{
+  BSAULong count = 1;
+  for (BSAULong size = std::max(width, height); size > 1; size >>= 1) {
+    ++count;
+  }
+  return count;
+}
+
+
+bool TextureDecoder::decode(BSAULong format, const BSAUChar *data, size_t size,
+                            BSAULong width, BSAULong height, BSAUChar *rgba)
+{
+  BSAHash required = surfaceSize(format, width, height);
+  if ((required == 0) || (size < required)) {
+    return false;
+  }
+
+  BlockDecoder decoder;
+  size_t blockSize;
+  if (blockFormat(format, decoder, blockSize)) {
+    BSAULong blocksX = std::max<BSAULong>(1, (width + 3) / 4);
+    BSAULong blocksY = std::max<BSAULong>(1, (height + 3) / 4);
+    alignas(16) BlockPixels pixels;
+    for (BSAULong blockY = 0; blockY < blocksY; ++blockY) {
+      for (BSAULong blockX = 0; blockX < blocksX; ++blockX) {
+        decoder(data, pixels);
+        data += blockSize;
+        // blocks at the right and bottom edge may extend past the surface
+        BSAULong columns = std::min<BSAULong>(4, width - blockX * 4);
+        BSAULong rows = std::min<BSAULong>(4, height - blockY * 4);
+        for (BSAULong row = 0; row < rows; ++row) {
+          size_t offset = (static_cast<size_t>(blockY * 4 + row) * width + blockX * 4) * 4;
+          memcpy(rgba + offset, pixels + row * 4, columns * 4);
+        }
+      }
+    }
+    return true;
+  }
+
+  size_t count = static_cast<size_t>(width) * height;
+  if (format == DXGI_FORMAT_B8G8R8A8_UNORM) {
+    for (size_t i = 0; i < count; ++i, data += 4, rgba += 4) {
+      rgba[0] = data[2];
+      rgba[1] = data[1];
+      rgba[2] = data[0];
+      rgba[3] = data[3];
+    }
+  }
+  else {
+    for (size_t i = 0; i < count; ++i, rgba += 4) {
+      rgba[0] = data[i];
+      rgba[1] = 0;
+      rgba[2] = 0;
+      rgba[3] = 255;
+    }
+  }
+  return true;
+}
+
+} // namespace BA2
@@ -0,0 +1,79 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_TEXTUREDECODER_H
+#define BA2_TEXTUREDECODER_H
+
+
+#include "ba2types.h"
+#include <cstddef>
+
+
+namespace BA2 {
+
+  /**
+   * @brief converts texture data in the formats used by BA2 archives (BC1, BC2,
+   * BC3, BC5, BC7, B8G8R8A8 and R8) to 8 bit RGBA pixels.
+   * Channels a format doesn't have are filled in like Direct3D samples them:
+   * 0 for missing colors, 255 for missing alpha.
+   */
+  class TextureDecoder {
+
+  public:
+
+    /**
+     * @param format DXGI_FORMAT of the texture
+     * @return true if textures in this format can be decoded
+     */
+    static bool isSupported(BSAULong format);
+
+    /**
+     * @param format DXGI_FORMAT of the texture
+     * @param width width of the surface in pixels
+     * @param height height of the surface in pixels
+     * @return size of the data of one surface (mip map) in bytes, 0 if the format isn't supported
+     */
+    static BSAHash surfaceSize(BSAULong format, BSAULong width, BSAULong height);
+
+    /**
+     * @param width width of the texture in pixels
+     * @param height height of the texture in pixels
+     * @return number of mip maps in a full chain down to 1x1 pixels,
+     *         floor(log2(max(width, height))) + 1
+     */
+    static BSAULong maxMipCount(BSAULong width, BSAULong height);
+
+    /**
+     * decode one surface
+     * @param format DXGI_FORMAT of the texture
+     * @param data the surface data
+     * @param size size of data in bytes, at least surfaceSize(format, width, height)
+     * @param width width of the surface in pixels
+     * @param height height of the surface in pixels
+     * @param rgba receives width * height pixels of 4 bytes each, rows from top to bottom
+     * @return false if the format isn't supported or there isn't enough data
+     */
+    static bool decode(BSAULong format, const BSAUChar *data, size_t size,
+                       BSAULong width, BSAULong height, BSAUChar *rgba);
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_TEXTUREDECODER_H
@@ -0,0 +1,470 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2trace.h"
+#include "ba2exception.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace BA2 {
+
+// kinds of spans the library records, loaded spans refer to these names
+static const char *const SPAN_NAMES[] = { "entry", "open", "read", "inflate", "write" };
+
+// objects and arrays the reader skips may be nested this deep. The trace itself
+// needs three levels, the limit keeps hostile input from exhausting the stack
+static const unsigned int MAX_NESTING = 64;
+
+
+// reads back the json written by writeChromeTrace. Any valid json nested up to
+// MAX_NESTING levels is accepted, events that aren't complete spans of a known
+// kind are ignored
+class TraceReader {
+
+public:
+
+  explicit TraceReader(const std::string &text)
+    : m_Text(text)
+    , m_Pos(0)
+  {
+  }
+
+  bool read(std::vector<TraceSpan> &spans)
+  {
+    if (!consume('{')) {
+      return false;
+    }
+    if (consume('}')) {
+      return true;
+    }
+    do {
+      std::string key;
+      if (!parseString(key) || !consume(':')) {
+        return false;
+      }
+      if (key != "traceEvents") {
+        if (!skipValue()) {
+          return false;
+        }
+        continue;
+      }
+      if (!consume('[')) {
+        return false;
+      }
+      if (consume(']')) {
+        continue;
+      }
+      do {
+        TraceSpan span;
+        bool complete = false;
+        if (!parseEvent(span, complete)) {
+          return false;
+        }
+        if (complete) {
+          spans.push_back(span);
+        }
+      } while (consume(','));
+      if (!consume(']')) {
+        return false;
+      }
+    } while (consume(','));
+    return consume('}');
+  }
+
+private:
+
+  void skipSpace()
+  {
+    while ((m_Pos < m_Text.size()) && isspace(static_cast<unsigned char>(m_Text[m_Pos]))) {
+      ++m_Pos;
+    }
+  }
+
+  bool consume(char ch)
+  {
+    skipSpace();
+    if ((m_Pos < m_Text.size()) && (m_Text[m_Pos] == ch)) {
+      ++m_Pos;
+      return true;
+    }
+    return false;
+  }
+
+  bool parseString(std::string &value)
+  {
+    if (!consume('"')) {
+      return false;
+    }
+    value.clear();
+    while (m_Pos < m_Text.size()) {
+      char ch = m_Text[m_Pos++];
+      if (ch == '"') {
+        return true;
+      }
+      if (ch != '\\') {
+        value.push_back(ch);
+        continue;
+      }
+      if (m_Pos >= m_Text.size()) {
+        return false;
+      }
+      switch (ch = m_Text[m_Pos++]) {
+        case 'b': value.push_back('\b'); break;
+        case 'f': value.push_back('\f'); break;
+        case 'n': value.push_back('\n'); break;
+        case 'r': value.push_back('\r'); break;
+        case 't': value.push_back('\t'); break;
+        case 'u': {
+          // the recorder only escapes control characters this way
+          if (m_Pos + 4 > m_Text.size()) {
+            return false;
+          }
+          value.push_back(static_cast<char>(strtoul(m_Text.substr(m_Pos, 4).c_str(), nullptr, 16)));
+          m_Pos += 4;
+        } break;
+        default: value.push_back(ch); break;
+      }
+    }
+    return false;
+  }
+
+  bool parseNumber(double &value)
+  {
+    skipSpace();
+    const char *begin = m_Text.c_str() + m_Pos;
+    char *end = nullptr;
+    value = strtod(begin, &end);
+    if (end == begin) {
+      return false;
+    }
+    m_Pos += end - begin;
+    return true;
+  }
+
+  bool skipValue(unsigned int depth = 0)
+  {
+    skipSpace();
+    if ((m_Pos >= m_Text.size()) || (depth >= MAX_NESTING)) {
+      return false;
+    }
+    std::string text;
+    double number;
+    switch (m_Text[m_Pos]) {
+      case '"': return parseString(text);
+      case '{': {
+        ++m_Pos;
+        if (consume('}')) {
+          return true;
+        }
+        do {
+          if (!parseString(text) || !consume(':') || !skipValue(depth + 1)) {
+            return false;
+          }
+        } while (consume(','));
+        return consume('}');
+      }
+      case '[': {
+        ++m_Pos;
+        if (consume(']')) {
+          return true;
+        }
+        do {
+          if (!skipValue(depth + 1)) {
+            return false;
+          }
+        } while (consume(','));
+        return consume(']');
+      }
+      default: {
+        for (const char *literal : { "true", "false", "null" }) {
+          if (m_Text.compare(m_Pos, strlen(literal), literal) == 0) {
+            m_Pos += strlen(literal);
+            return true;
+          }
+        }
+        return parseNumber(number);
+      }
+    }
+  }
+
+  // the args object of a span, holding entry and chunk
+  bool parseArguments(double &entry, double &chunk)
+  {
+    skipSpace();
+    if ((m_Pos >= m_Text.size()) || (m_Text[m_Pos] != '{')) {
+      return skipValue();
+    }
+    ++m_Pos;
+    if (consume('}')) {
+      return true;
+    }
+    do {
+      std::string key;
+      bool ok = parseString(key) && consume(':');
+      if (ok && (key == "entry")) {
+        ok = parseNumber(entry);
+      }
+      else if (ok && (key == "chunk")) {
+        ok = parseNumber(chunk);
+      }
+      else if (ok) {
+        ok = skipValue();
+      }
+      if (!ok) {
+        return false;
+      }
+    } while (consume(','));
+    return consume('}');
+  }
+
+  bool parseEvent(TraceSpan &span, bool &complete)
+  {
+    if (!consume('{')) {
+      return false;
+    }
+    std::string name;
+    std::string category;
+    std::string phase;
+    double start = -1.0;
+    double duration = 0.0;
+    double thread = 0.0;
+    double entry = -1.0;
+    double chunk = -1.0;
+    if (!consume('}')) {
+      do {
+        std::string key;
+        if (!parseString(key) || !consume(':')) {
+          return false;
+        }
+        bool ok = true;
+        if (key == "name") {
+          ok = parseString(name);
+        }
+        else if (key == "cat") {
+          ok = parseString(category);
+        }
+        else if (key == "ph") {
+          ok = parseString(phase);
+        }
+        else if (key == "ts") {
+          ok = parseNumber(start);
+        }
+        else if (key == "dur") {
+          ok = parseNumber(duration);
+        }
+        else if (key == "tid") {
+          ok = parseNumber(thread);
+        }
+        else if (key == "args") {
+          ok = parseArguments(entry, chunk);
+        }
+        else {
+          ok = skipValue();
+        }
+        if (!ok) {
+          return false;
+        }
+      } while (consume(','));
+      if (!consume('}')) {
+        return false;
+      }
+    }
+
+    span.name = nullptr;
+    for (const char *known : SPAN_NAMES) {
+      if (category == known) {
+        span.name = known;
+      }
+    }
+    complete = (span.name != nullptr) && (phase == "X") && (start >= 0.0) && (entry >= 0.0);
+    if (complete) {
+      // spans are named after their file if they have one
+      if (name != category) {
+        span.label = name;
+      }
+      span.entry = static_cast<BSAULong>(entry);
+      span.chunk = static_cast<int>(chunk);
+      span.thread = static_cast<BSAULong>(thread);
+      // timestamps are in microseconds
+      span.start = static_cast<int64_t>(start * 1000.0 + 0.5);
+      span.duration = static_cast<int64_t>(duration * 1000.0 + 0.5);
+    }
+    return true;
+  }
+
+  const std::string &m_Text;
+  size_t m_Pos;
+
+};
+
+
+TraceRecorder::TraceRecorder()
+  : m_Origin(std::chrono::steady_clock::now())
+  , m_NextThread(0)
+{
+}
+
+
+void TraceRecorder::clear()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Spans.clear();
+}
+
+
+std::vector<TraceSpan> TraceRecorder::getSpans() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Spans;
+}
+
+
+std::vector<std::string> TraceRecorder::getAccessOrder() const
+{
+  std::vector<const TraceSpan*> entries;
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (const TraceSpan &span : m_Spans) {
+    if (!span.label.empty() && (strcmp(span.name, "entry") == 0)) {
+      entries.push_back(&span);
+    }
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](const TraceSpan *lhs, const TraceSpan *rhs) {
+    return lhs->start < rhs->start;
+  });
+
+  std::vector<std::string> result;
+  std::set<std::string> seen;
+  for (const TraceSpan *span : entries) {
+    if (seen.insert(span->label).second) {
+      result.push_back(span->label);
+    }
+  }
+  return result;
+}
+
+
+void TraceRecorder::append(std::vector<TraceSpan> &spans)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Spans.insert(m_Spans.end(), spans.begin(), spans.end());
+}
+
+
+bool TraceRecorder::writeChromeTrace(const char *fileName) const
+{
+  std::fstream file;
+  file.open(fileName, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  char buffer[64];
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  std::set<BSAULong> threads;
+  for (const TraceSpan &span : m_Spans) {
+    file << (first ? "\n" : ",\n");
+    first = false;
+    threads.insert(span.thread);
+
+    file << "{\"name\":";
+    file << makeJSONString(span.label.empty() ? std::string(span.name) : span.label);
+    file << ",\"cat\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread;
+    // timestamps are in microseconds
+    snprintf(buffer, sizeof(buffer), ",\"ts\":%.3f,\"dur\":%.3f",
+             span.start / 1000.0, span.duration / 1000.0);
+    file << buffer << ",\"args\":{\"entry\":" << span.entry;
+    if (span.chunk >= 0) {
+      file << ",\"chunk\":" << span.chunk;
+    }
+    file << "}}";
+  }
+  for (BSAULong thread : threads) {
+    file << (first ? "\n" : ",\n");
+    first = false;
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+         << ",\"args\":{\"name\":\"worker " << thread << "\"}}";
+  }
+  file << "\n]}\n";
+
+  return !file.fail();
+}
+
+
+bool TraceRecorder::readChromeTrace(const char *fileName)
+{
+  std::ifstream file(fileName, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::vector<TraceSpan> spans;
+  if (file.bad() || !TraceReader(text).read(spans)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Spans.swap(spans);
+  return true;
+}
+
+
+TraceBuffer::TraceBuffer(TraceRecorder *recorder)
+  : m_Recorder(recorder)
+  , m_Thread(recorder != nullptr ? recorder->registerThread() : 0)
+{
+}
+
+
+TraceBuffer::~TraceBuffer()
+{
+  if ((m_Recorder != nullptr) && !m_Spans.empty()) {
+    m_Recorder->append(m_Spans);
+  }
+}
+
+
+void TraceBuffer::add(const char *name, BSAULong entry, int chunk,
+                      std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end,
+                      const std::string *label)
+{
+  TraceSpan span;
+  span.name = name;
+  if (label != nullptr) {
+    span.label = *label;
+  }
+  span.entry = entry;
+  span.chunk = chunk;
+  span.thread = m_Thread;
+  span.start = m_Recorder->toOffset(start);
+  span.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  m_Spans.push_back(span);
+}
+
+} // namespace BA2
@@ -0,0 +1,197 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_TRACE_H
+#define BA2_TRACE_H
+
+
+#include "ba2types.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace BA2 {
+
+  /**
+   * @brief one timed operation on a worker thread
+   */
+  struct TraceSpan {
+    /// kind of operation ("entry", "open", "read", "inflate", "write")
+    const char *name;
+    /// name of the file for spans covering a whole entry, empty otherwise
+    std::string label;
+    /// index of the file the operation belongs to
+    BSAULong entry;
+    /// index of the texture chunk or -1
+    int chunk;
+    /// number of the worker thread
+    BSAULong thread;
+    /// start and duration in nanoseconds, relative to the creation of the recorder
+    int64_t start;
+    int64_t duration;
+  };
+
+  /**
+   * @brief collects a timeline of extraction runs and exports it in the chrome
+   * trace event format, which can be loaded into chrome://tracing or Perfetto.
+   * Workers buffer their spans locally and hand them over when they finish, so
+   * recording doesn't synchronize threads.
+   */
+  class TraceRecorder {
+
+  public:
+
+    TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder &operator=(const TraceRecorder&) = delete;
+
+    /**
+     * @brief discard all recorded spans
+     */
+    void clear();
+
+    /**
+     * @return copy of all spans recorded so far
+     */
+    std::vector<TraceSpan> getSpans() const;
+
+    /**
+     * @return names of the files whose entries were recorded, each once, in the
+     *         order they were first accessed. Can be passed to ArchiveWriter::setOrder
+     */
+    std::vector<std::string> getAccessOrder() const;
+
+    /**
+     * write all spans recorded so far as a chrome trace json file
+     * @param fileName name of the file to write
+     * @return true on success
+     */
+    bool writeChromeTrace(const char *fileName) const;
+
+    /**
+     * replace the recorded spans with those of a file written by writeChromeTrace,
+     * for example to get the access order of an earlier run
+     * @param fileName name of the file to read
+     * @return true on success, false if the file can't be read or isn't valid json
+     */
+    bool readChromeTrace(const char *fileName);
+
+    /**
+     * @return a new, unique number identifying a worker thread
+     */
+    BSAULong registerThread() { return m_NextThread++; }
+
+    /**
+     * @brief take over spans recorded by a worker
+     */
+    void append(std::vector<TraceSpan> &spans);
+
+    /**
+     * @return nanoseconds between the creation of the recorder and timePoint
+     */
+    int64_t toOffset(std::chrono::steady_clock::time_point timePoint) const {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint - m_Origin).count();
+    }
+
+  private:
+
+    std::chrono::steady_clock::time_point m_Origin;
+    std::atomic<BSAULong> m_NextThread;
+
+    mutable std::mutex m_Mutex;
+    std::vector<TraceSpan> m_Spans;
+
+  };
+
+  /**
+   * @brief spans recorded by one worker thread. Flushed to the recorder on destruction.
+   * With a null recorder all calls are no-ops
+   */
+  class TraceBuffer {
+
+  public:
+
+    explicit TraceBuffer(TraceRecorder *recorder);
+    ~TraceBuffer();
+
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer &operator=(const TraceBuffer&) = delete;
+
+    bool enabled() const { return m_Recorder != nullptr; }
+
+    void add(const char *name, BSAULong entry, int chunk,
+             std::chrono::steady_clock::time_point start,
+             std::chrono::steady_clock::time_point end,
+             const std::string *label = nullptr);
+
+  private:
+
+    TraceRecorder *m_Recorder;
+    BSAULong m_Thread;
+    std::vector<TraceSpan> m_Spans;
+
+  };
+
+  /**
+   * @brief records the time between construction and destruction as a span
+   */
+  class TraceScope {
+
+  public:
+
+    TraceScope(TraceBuffer &buffer, const char *name, BSAULong entry, int chunk = -1,
+               const std::string *label = nullptr)
+      : m_Buffer(buffer)
+      , m_Name(name)
+      , m_Entry(entry)
+      , m_Chunk(chunk)
+      , m_Label(label)
+    {
+      if (m_Buffer.enabled()) {
+        m_Start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~TraceScope() {
+      if (m_Buffer.enabled()) {
+        m_Buffer.add(m_Name, m_Entry, m_Chunk, m_Start, std::chrono::steady_clock::now(), m_Label);
+      }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope &operator=(const TraceScope&) = delete;
+
+  private:
+
+    TraceBuffer &m_Buffer;
+    const char *m_Name;
+    BSAULong m_Entry;
+    int m_Chunk;
+    const std::string *m_Label;
+    std::chrono::steady_clock::time_point m_Start;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_TRACE_H
@@ -0,0 +1,850 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2writer.h"
+#include "ba2deflater.h"
+#include "ba2exception.h"
+#include "ba2file.h"
+#include "ba2pathkey.h"
+#include "ba2texturedecoder.h"
+#include "dds.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <zlib.h>
+
+using std::fstream;
+
+
+// size of the buffer used to copy file data
+static const size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+static const BSAULong ARCHIVE_VERSION = 1;
+
+// mip maps at least this large get a chunk of their own, smaller ones share the
+// last chunk of a texture
+static const BSAULong TEXTURE_CHUNK_SIZE = 64 * 1024;
+
+// the adaptive compression policy compresses up to SAMPLE_COUNT slices of
+// SAMPLE_SIZE bytes spread over the file at the fastest level and stores the file
+// unless that saves at least 1/MIN_SAVING_FRACTION of the sample
+static const BSAULong SAMPLE_SIZE = 16 * 1024;
+static const BSAULong SAMPLE_COUNT = 4;
+static const BSAULong MIN_SAVING_FRACTION = 32;
+
+
+namespace BA2 {
+
+ArchiveWriter::ArchiveWriter(EType type)
+  : m_Type(type)
+  , m_CompressionLevel(Z_DEFAULT_COMPRESSION)
+  , m_CompressionPolicy(COMPRESSION_ADAPTIVE)
+  , m_StoredExtensions({ ".xwm", ".fuz", ".wem", ".ogg", ".mp3", ".bk2", ".png", ".jpg", ".jpeg",
+                         ".zip", ".7z", ".gz", ".rar", ".ba2", ".bsa" })
+  , m_StoredCount(0)
+  , m_DuplicateCount(0)
+  , m_DuplicateSize(0)
+{
+}
+
+
+static BSAULong hashString(const std::string &value)
+{
+  return static_cast<BSAULong>(crc32(0, reinterpret_cast<const Bytef*>(value.data()),
+                                     static_cast<uInt>(value.size())));
+}
+
+
+// 64 bit multiply-xorshift hash over 8 byte words. Collisions are resolved by
+// comparing content so this only needs to be fast and reasonably well distributed
+static BSAHash contentHash(const BSAUChar *data, size_t size)
+{
+  const BSAHash prime = 0x9E3779B97F4A7C15ULL;
+  BSAHash hash = size * prime;
+  size_t pos = 0;
+  for (; pos + sizeof(BSAHash) <= size; pos += sizeof(BSAHash)) {
+    BSAHash word;
+    memcpy(&word, data + pos, sizeof(BSAHash));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 32;
+  }
+  BSAHash tail = 0;
+  memcpy(&tail, data + pos, size - pos);
+  hash = (hash ^ tail) * prime;
+  return hash ^ (hash >> 29);
+}
+
+
+void ArchiveWriter::updateHashes(const std::string &name, Entry &entry)
+{
+  // hashes are crc32 of the lower case directory and file name without extension
+  std::string key = PathKey::normalize(name);
+  size_t separator = key.find_last_of('\\');
+  std::string directory = separator != std::string::npos ? key.substr(0, separator) : std::string();
+  std::string fileName = separator != std::string::npos ? key.substr(separator + 1) : key;
+  size_t dot = fileName.find_last_of('.');
+  std::string stem = fileName.substr(0, dot);
+  std::string extension = dot != std::string::npos ? fileName.substr(dot + 1) : std::string();
+
+  char ext[4] = { 0 };
+  memcpy(ext, extension.data(), std::min<size_t>(extension.size(), sizeof(ext)));
+
+  entry.general.unk00 = hashString(stem);
+  memcpy(entry.general.ext, ext, sizeof(ext));
+  entry.general.unk08 = hashString(directory);
+  entry.texture.nameHash = hashString(stem);
+  memcpy(entry.texture.ext, ext, sizeof(ext));
+  entry.texture.dirHash = hashString(directory);
+}
+
+
+BSAULong ArchiveWriter::storedSize(const Archive::FileEntry &file)
+{
+  BSAULong packedLen = Archive::packedSize(file);
+  return packedLen != 0 ? packedLen : Archive::unpackedSize(file);
+}
+
+
+BSAULong ArchiveWriter::storedSize(const Archive::DX10Chunk &chunk)
+{
+  return chunk.packedLen != 0 ? chunk.packedLen : chunk.unpackedLen;
+}
+
+
+EErrorCode ArchiveWriter::addFile(const Archive &source, BSAULong index, const std::string &name)
+{
+  m_LastError.clear();
+  if (source.getType() != m_Type) {
+    m_LastError = "files can only be copied between archives of the same type";
+    return ERROR_INVALIDDATA;
+  }
+  if (index >= source.countFiles()) {
+    m_LastError = makeString("there is no file %u in the source archive", index);
+    return ERROR_FILENOTFOUND;
+  }
+  if (name.empty() && (index >= source.m_TableNames.size())) {
+    m_LastError = "the source archive has no name table";
+    return ERROR_INVALIDDATA;
+  }
+
+  Entry entry;
+  entry.removed = false;
+  entry.source = &source.m_File;
+  memset(&entry.general, 0, sizeof(entry.general));
+  memset(&entry.texture, 0, sizeof(entry.texture));
+  if (m_Type == TYPE_GENERAL) {
+    entry.general = source.m_Files[index];
+  }
+  else {
+    entry.texture = source.m_TextureHeaders[index];
+    const Archive::ChunkRange &range = source.m_TextureChunks[index];
+    entry.chunks.assign(source.m_Chunks.begin() + range.first,
+                        source.m_Chunks.begin() + range.first + range.count);
+  }
+
+  if (name.empty()) {
+    entry.name = source.m_TableNames[index];
+  }
+  else {
+    entry.name = name;
+    std::replace(entry.name.begin(), entry.name.end(), '/', '\\');
+    bool renamed = (index >= source.m_TableNames.size())
+                || (PathKey::normalize(entry.name) != source.m_TableKeys[index]);
+    if (renamed) {
+      updateHashes(entry.name, entry);
+    }
+  }
+  if (entry.name.size() > UINT16_MAX) {
+    m_LastError = "file name is too long";
+    return ERROR_INVALIDDATA;
+  }
+
+  addEntry(std::move(entry));
+  return ERROR_NONE;
+}
+
+
+EErrorCode ArchiveWriter::addArchive(const Archive &source, const ExtractFilter &filter)
+{
+  if (source.m_TableNames.size() != source.countFiles()) {
+    m_LastError = "the source archive has no name table";
+    return ERROR_INVALIDDATA;
+  }
+  for (BSAULong i = 0; i < source.countFiles(); ++i) {
+    if (filter && !filter(i, source.m_TableNames[i])) {
+      continue;
+    }
+    EErrorCode error = addFile(source, i);
+    if (error != ERROR_NONE) {
+      return error;
+    }
+  }
+  return ERROR_NONE;
+}
+
+
+void ArchiveWriter::addStoredExtension(const std::string &extension)
+{
+  std::string key = extension;
+  std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+  m_StoredExtensions.insert(key);
+}
+
+
+EErrorCode ArchiveWriter::addLooseFile(const std::string &name, const char *fileName)
+{
+  m_LastError.clear();
+  InputFile file;
+  if (!file.open(fileName)) {
+    m_LastError = makeString("failed to open %s", fileName);
+    return ERROR_FILENOTFOUND;
+  }
+  if (file.size() > UINT32_MAX) {
+    m_LastError = makeString("%s is too large", fileName);
+    return ERROR_INVALIDDATA;
+  }
+
+  Payload content;
+  content.fileName = std::make_shared<const std::string>(fileName);
+  content.offset = 0;
+  content.size = static_cast<BSAULong>(file.size());
+  return addContent(name, content);
+}
+
+
+EErrorCode ArchiveWriter::addDirectory(const char *directory)
+{
+  namespace fs = std::filesystem;
+  m_LastError.clear();
+
+  // sorted so the archive doesn't depend on the order the file system lists files in
+  std::vector<fs::path> files;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator iter(directory, ec), end; !ec && (iter != end); iter.increment(ec)) {
+    if (iter->is_regular_file(ec)) {
+      files.push_back(iter->path());
+    }
+  }
+  if (ec) {
+    m_LastError = makeString("failed to list %s: %s", directory, ec.message().c_str());
+    return ERROR_ACCESSFAILED;
+  }
+  std::sort(files.begin(), files.end());
+
+  for (const fs::path &file : files) {
+    std::string name = file.lexically_relative(directory).generic_string();
+    EErrorCode error = addLooseFile(name, file.string().c_str());
+    if (error != ERROR_NONE) {
+      return error;
+    }
+  }
+  return ERROR_NONE;
+}
+
+
+EErrorCode ArchiveWriter::addData(const std::string &name, const Archive::DataBuffer &data)
+{
+  m_LastError.clear();
+  Payload content;
+  content.buffer = data;
+  content.offset = 0;
+  content.size = data.second;
+  return addContent(name, content);
+}
+
+
+EErrorCode ArchiveWriter::addContent(const std::string &name, const Payload &content)
+{
+  if (name.size() > UINT16_MAX) {
+    m_LastError = "file name is too long";
+    return ERROR_INVALIDDATA;
+  }
+
+  try {
+    std::vector<BSAUChar> data;
+    readPayload(content, data);
+
+    Entry entry;
+    entry.removed = false;
+    entry.source = nullptr;
+    memset(&entry.general, 0, sizeof(entry.general));
+    memset(&entry.texture, 0, sizeof(entry.texture));
+    entry.name = name;
+    std::replace(entry.name.begin(), entry.name.end(), '/', '\\');
+    updateHashes(entry.name, entry);
+
+    bool compress = shouldCompress(entry.name, data.data(), content.size);
+
+    if (m_Type == TYPE_GENERAL) {
+      entry.general.unk0C = 0x00100100;
+      entry.general.unk20 = 0xBAADF00D;
+      Payload payload = content;
+      payload.compress = compress;
+      entry.payloads.push_back(addPayload(payload, data.data()));
+    }
+    else {
+      std::vector<Payload> chunks;
+      parseTexture(data.data(), content.size, entry, chunks);
+      for (Payload &chunk : chunks) {
+        chunk.fileName = content.fileName;
+        chunk.buffer = content.buffer;
+        chunk.compress = compress;
+        entry.payloads.push_back(addPayload(chunk, data.data() + chunk.offset));
+      }
+    }
+
+    addEntry(std::move(entry));
+    return ERROR_NONE;
+  } catch (const data_invalid_exception &e) {
+    m_LastError = makeString("%s: %s", name.c_str(), e.what());
+    return ERROR_INVALIDDATA;
+  } catch (const std::bad_alloc&) {
+    m_LastError = makeString("%s: out of memory", name.c_str());
+    return ERROR_INVALIDDATA;
+  }
+}
+
+
+void ArchiveWriter::parseTexture(const BSAUChar *data, BSAULong size, Entry &entry,
+                                 std::vector<Payload> &chunks) const
+{
+  BSAULong headerSize = sizeof(BSAULong) + sizeof(DDS_HEADER);
+  BSAULong magic = 0;
+  if (size >= sizeof(BSAULong)) {
+    memcpy(&magic, data, sizeof(BSAULong));
+  }
+  if ((size < headerSize) || (magic != DDS_MAGIC)) {
+    throw data_invalid_exception("not a dds file");
+  }
+  DDS_HEADER header;
+  memcpy(&header, data + sizeof(BSAULong), sizeof(DDS_HEADER));
+
+  if ((header.dwCubemapFlags != 0) || ((header.dwHeaderFlags & DDS_HEADER_FLAGS_VOLUME) != 0)) {
+    throw data_invalid_exception("cube maps and volume textures aren't supported");
+  }
+
+  // formats are limited to those Archive can write dds headers for
+  const DDS_PIXELFORMAT &pixelFormat = header.ddspf;
+  BSAULong format = DXGI_FORMAT_UNKNOWN;
+  if ((pixelFormat.dwFlags & DDS_FOURCC) != 0) {
+    switch (pixelFormat.dwFourCC) {
+      case MAKEFOURCC('D', 'X', 'T', '1'): format = DXGI_FORMAT_BC1_UNORM; break;
+      case MAKEFOURCC('D', 'X', 'T', '3'): format = DXGI_FORMAT_BC2_UNORM; break;
+      case MAKEFOURCC('D', 'X', 'T', '5'): format = DXGI_FORMAT_BC3_UNORM; break;
+      case MAKEFOURCC('A', 'T', 'I', '2'): format = DXGI_FORMAT_BC5_UNORM; break;
+      case MAKEFOURCC('B', 'C', '5', 'U'): format = DXGI_FORMAT_BC5_UNORM; break;
+      case MAKEFOURCC('B', 'C', '7', '\0'): format = DXGI_FORMAT_BC7_UNORM; break;
+      case MAKEFOURCC('D', 'X', '1', '0'): {
+        // DDS_HEADER_DXT10: format, dimension, misc flags, array size, misc flags 2
+        BSAULong extension[5];
+        if (size < headerSize + sizeof(extension)) {
+          throw data_invalid_exception("dds file is truncated");
+        }
+        memcpy(extension, data + headerSize, sizeof(extension));
+        if (extension[3] > 1) {
+          throw data_invalid_exception("texture arrays aren't supported");
+        }
+        format = extension[0];
+        headerSize += sizeof(extension);
+      } break;
+    }
+  }
+  else if (((pixelFormat.dwFlags & DDS_RGB) != 0) && (pixelFormat.dwRGBBitCount == 32)
+           && (pixelFormat.dwRBitMask == 0x00FF0000) && (pixelFormat.dwGBitMask == 0x0000FF00)
+           && (pixelFormat.dwBBitMask == 0x000000FF)) {
+    format = DXGI_FORMAT_B8G8R8A8_UNORM;
+  }
+  else if (((pixelFormat.dwFlags & DDS_RGB) != 0) && (pixelFormat.dwRGBBitCount == 8)
+           && (pixelFormat.dwRBitMask == 0xFF)) {
+    format = DXGI_FORMAT_R8_UNORM;
+  }
+
+  if (!TextureDecoder::isSupported(format)) {
+    throw data_invalid_exception("unsupported texture format");
+  }
+
+  BSAULong numMips = (header.dwHeaderFlags & DDS_HEADER_FLAGS_MIPMAP) != 0
+      ? std::max<BSAULong>(1, header.dwMipMapCount) : 1;
+  if ((header.dwWidth == 0) || (header.dwWidth > UINT16_MAX) || (header.dwHeight == 0)
+      || (header.dwHeight > UINT16_MAX)) {
+    throw data_invalid_exception("invalid texture dimensions");
+  }
+  // mip sizes are computed by shifting the dimensions by the mip level. A full
+  // chain of 16 bit dimensions also fits the 8 bit mip count of the index
+  if (numMips > TextureDecoder::maxMipCount(header.dwWidth, header.dwHeight)) {
+    throw data_invalid_exception(makeString("%u mip maps exceed the chain of a %ux%u texture",
+                                            numMips, header.dwWidth, header.dwHeight));
+  }
+
+  std::vector<BSAULong> mipSizes;
+  BSAHash dataSize = 0;
+  for (BSAULong mip = 0; mip < numMips; ++mip) {
+    BSAHash mipSize = TextureDecoder::surfaceSize(format, std::max<BSAULong>(1, header.dwWidth >> mip),
+                                                  std::max<BSAULong>(1, header.dwHeight >> mip));
+    if (mipSize > UINT32_MAX) {
+      throw data_invalid_exception("texture is too large");
+    }
+    mipSizes.push_back(static_cast<BSAULong>(mipSize));
+    dataSize += mipSize;
+  }
+  if (headerSize + dataSize != size) {
+    throw data_invalid_exception(makeString("file size doesn't match the texture header (%llu bytes expected)",
+                                            static_cast<unsigned long long>(headerSize + dataSize)));
+  }
+
+  // like the official tools, the largest mips get a chunk each and the rest share
+  // the last one
+  BSAULong offset = headerSize;
+  for (BSAULong mip = 0; mip < numMips;) {
+    BSAULong lastMip = mip;
+    if ((mipSizes[mip] < TEXTURE_CHUNK_SIZE) || (mip + 1 == numMips)) {
+      lastMip = numMips - 1;
+    }
+    Payload chunk;
+    chunk.offset = offset;
+    chunk.size = 0;
+    for (BSAULong i = mip; i <= lastMip; ++i) {
+      chunk.size += mipSizes[i];
+    }
+    offset += chunk.size;
+    chunks.push_back(chunk);
+
+    Archive::DX10Chunk record;
+    memset(&record, 0, sizeof(record));
+    record.unpackedLen = chunk.size;
+    record.startMip = static_cast<BSAUShort>(mip);
+    record.endMip = static_cast<BSAUShort>(lastMip);
+    record.unk14 = 0xBAADF00D;
+    entry.chunks.push_back(record);
+    mip = lastMip + 1;
+  }
+
+  entry.texture.numChunks = static_cast<BSAUChar>(entry.chunks.size());
+  entry.texture.chunkHdrLen = sizeof(Archive::DX10Chunk);
+  entry.texture.height = static_cast<BSAUShort>(header.dwHeight);
+  entry.texture.width = static_cast<BSAUShort>(header.dwWidth);
+  entry.texture.numMips = static_cast<BSAUChar>(numMips);
+  entry.texture.format = static_cast<BSAUChar>(format);
+  entry.texture.unk16 = 0x0800;
+}
+
+
+bool ArchiveWriter::shouldCompress(const std::string &name, const BSAUChar *data, BSAULong size) const
+{
+  if (m_CompressionPolicy != COMPRESSION_ADAPTIVE) {
+    return m_CompressionPolicy == COMPRESSION_ALWAYS;
+  }
+
+  size_t separator = name.find_last_of("\\.");
+  if ((separator != std::string::npos) && (name[separator] == '.')) {
+    std::string extension = name.substr(separator);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (m_StoredExtensions.find(extension) != m_StoredExtensions.end()) {
+      return false;
+    }
+  }
+
+  // small files are compressed as a whole when writing anyway
+  if (size <= SAMPLE_SIZE * SAMPLE_COUNT) {
+    return true;
+  }
+
+  std::vector<BSAUChar> sample;
+  sample.reserve(SAMPLE_SIZE * SAMPLE_COUNT);
+  BSAULong stride = (size - SAMPLE_SIZE) / (SAMPLE_COUNT - 1);
+  for (BSAULong i = 0; i < SAMPLE_COUNT; ++i) {
+    const BSAUChar *slice = data + i * stride;
+    sample.insert(sample.end(), slice, slice + SAMPLE_SIZE);
+  }
+
+  std::vector<BSAUChar> packed;
+  size_t packedLen = Deflater::local().deflate(sample.data(), sample.size(), packed, Z_BEST_SPEED);
+  return (packedLen != 0) && (packedLen < sample.size() - sample.size() / MIN_SAVING_FRACTION);
+}
+
+
+size_t ArchiveWriter::addPayload(const Payload &payload, const BSAUChar *data)
+{
+  BSAHash hash = contentHash(data, payload.size);
+
+  auto candidates = m_PayloadLookup.equal_range(hash);
+  std::vector<BSAUChar> existing;
+  for (auto iter = candidates.first; iter != candidates.second; ++iter) {
+    const Payload &candidate = m_Payloads[iter->second];
+    if (candidate.size != payload.size) {
+      continue;
+    }
+    readPayload(candidate, existing);
+    if (memcmp(existing.data(), data, payload.size) == 0) {
+      ++m_DuplicateCount;
+      m_DuplicateSize += payload.size;
+      return iter->second;
+    }
+  }
+
+  Payload result = payload;
+  result.hash = hash;
+  result.written = false;
+  result.archiveOffset = 0;
+  result.packedLen = 0;
+  m_Payloads.push_back(result);
+  m_PayloadLookup.insert(std::make_pair(hash, m_Payloads.size() - 1));
+  return m_Payloads.size() - 1;
+}
+
+
+void ArchiveWriter::readPayload(const Payload &payload, std::vector<BSAUChar> &data) const
+{
+  data.resize(payload.size);
+  if (payload.size == 0) {
+    return;
+  }
+  if (payload.fileName) {
+    InputFile file;
+    if (!file.open(payload.fileName->c_str())) {
+      throw data_invalid_exception(makeString("failed to open %s", payload.fileName->c_str()));
+    }
+    file.readAt(payload.offset, data.data(), payload.size);
+  }
+  else {
+    memcpy(data.data(), payload.buffer.first.get() + payload.offset, payload.size);
+  }
+}
+
+
+void ArchiveWriter::addEntry(Entry &&entry)
+{
+  std::string key = PathKey::normalize(entry.name);
+  auto iter = m_Lookup.find(key);
+  if (iter != m_Lookup.end()) {
+    m_Entries[iter->second].removed = true;
+  }
+  m_Lookup[key] = m_Entries.size();
+  m_Entries.push_back(std::move(entry));
+}
+
+
+bool ArchiveWriter::removeFile(const std::string &name)
+{
+  auto iter = m_Lookup.find(PathKey::normalize(name));
+  if (iter == m_Lookup.end()) {
+    return false;
+  }
+  m_Entries[iter->second].removed = true;
+  m_Lookup.erase(iter);
+  return true;
+}
+
+
+bool ArchiveWriter::hasFile(const std::string &name) const
+{
+  return m_Lookup.find(PathKey::normalize(name)) != m_Lookup.end();
+}
+
+
+EErrorCode ArchiveWriter::write(const char *fileName)
+{
+  m_LastError.clear();
+
+  std::string temporaryName = std::string(fileName) + ".tmp";
+  std::fstream file;
+  file.open(temporaryName.c_str(), fstream::out | fstream::binary | fstream::trunc);
+  if (!file.is_open()) {
+    m_LastError = makeString("failed to create %s", temporaryName.c_str());
+    return ERROR_ACCESSFAILED;
+  }
+
+  try {
+    writeArchive(file, temporaryName.c_str(), nullptr);
+  } catch (const data_invalid_exception &e) {
+    m_LastError = e.what();
+    EErrorCode error = file.fail() ? ERROR_ACCESSFAILED : ERROR_INVALIDDATA;
+    file.close();
+    remove(temporaryName.c_str());
+    return error;
+  } catch (const std::bad_alloc&) {
+    m_LastError = "out of memory";
+    file.close();
+    remove(temporaryName.c_str());
+    return ERROR_INVALIDDATA;
+  }
+
+  file.close();
+  if (file.fail()) {
+    m_LastError = makeString("failed to write %s", temporaryName.c_str());
+    remove(temporaryName.c_str());
+    return ERROR_ACCESSFAILED;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(temporaryName, fileName, ec);
+  if (ec) {
+    m_LastError = makeString("failed to replace %s: %s", fileName, ec.message().c_str());
+    remove(temporaryName.c_str());
+    return ERROR_ACCESSFAILED;
+  }
+  return ERROR_NONE;
+}
+
+
+EErrorCode ArchiveWriter::update(const Archive &target, const char *fileName)
+{
+  m_LastError.clear();
+  if (target.getType() != m_Type) {
+    m_LastError = "archive type doesn't match";
+    return ERROR_INVALIDDATA;
+  }
+
+  std::fstream file;
+  file.open(fileName, fstream::in | fstream::out | fstream::binary);
+  if (!file.is_open()) {
+    m_LastError = makeString("failed to open %s for writing", fileName);
+    return ERROR_ACCESSFAILED;
+  }
+
+  // make sure fileName really is the file target was read from, everything
+  // else would be corrupted. The type field is stored as its id, so it isn't compared
+  Archive::Header header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  file.seekg(0, std::ios::end);
+  if (file.fail() || (header.fileCount != target.m_Header.fileCount)
+      || (header.offsetNameTable != target.m_Header.offsetNameTable)
+      || (static_cast<BSAHash>(file.tellg()) != target.m_File.size())) {
+    m_LastError = makeString("%s isn't the file the archive was read from or it was changed since", fileName);
+    return ERROR_INVALIDDATA;
+  }
+
+  // writeArchive only throws before it rewrites the header, nothing refers to the
+  // appended data yet and cutting it off restores the archive
+  auto discardAppended = [&]() {
+    file.close();
+    std::error_code ec;
+    std::filesystem::resize_file(fileName, target.m_File.size(), ec);
+  };
+
+  try {
+    writeArchive(file, fileName, &target);
+  } catch (const data_invalid_exception &e) {
+    m_LastError = e.what();
+    EErrorCode error = file.fail() ? ERROR_ACCESSFAILED : ERROR_INVALIDDATA;
+    discardAppended();
+    return error;
+  } catch (const std::bad_alloc&) {
+    m_LastError = "out of memory";
+    discardAppended();
+    return ERROR_INVALIDDATA;
+  }
+
+  file.close();
+  if (file.fail() || !syncFile(fileName)) {
+    m_LastError = makeString("failed to write %s", fileName);
+    return ERROR_ACCESSFAILED;
+  }
+  return ERROR_NONE;
+}
+
+
+void ArchiveWriter::writeArchive(std::fstream &file, const char *fileName, const Archive *target)
+{
+  std::vector<const Entry*> entries;
+  entries.reserve(m_Lookup.size());
+  for (const Entry &entry : m_Entries) {
+    if (!entry.removed) {
+      entries.push_back(&entry);
+    }
+  }
+  for (Payload &payload : m_Payloads) {
+    payload.written = false;
+  }
+
+  if (!m_Order.empty()) {
+    std::unordered_map<std::string, size_t> ranks;
+    for (const std::string &name : m_Order) {
+      ranks.insert(std::make_pair(PathKey::normalize(name), ranks.size()));
+    }
+    std::vector<size_t> entryRanks(m_Entries.size(), m_Order.size());
+    for (const Entry *entry : entries) {
+      auto iter = ranks.find(PathKey::normalize(entry->name));
+      if (iter != ranks.end()) {
+        entryRanks[entry - m_Entries.data()] = iter->second;
+      }
+    }
+    std::stable_sort(entries.begin(), entries.end(), [&](const Entry *lhs, const Entry *rhs) {
+      return entryRanks[lhs - m_Entries.data()] < entryRanks[rhs - m_Entries.data()];
+    });
+  }
+
+  // the size of the index is known up front, the records are completed while the
+  // data is written and the index is written last
+  BSAHash indexSize = 0;
+  for (const Entry *entry : entries) {
+    indexSize += m_Type == TYPE_GENERAL
+        ? sizeof(Archive::FileEntry)
+        : sizeof(Archive::FileEntry_DX10) + entry->chunks.size() * sizeof(Archive::DX10Chunk);
+  }
+
+  std::vector<char> index;
+  index.reserve(static_cast<size_t>(indexSize));
+  BSAHash dataStart = sizeof(Archive::Header) + indexSize;
+  BSAHash offset = dataStart;
+  const InputFile *inPlace = target != nullptr ? &target->m_File : nullptr;
+  if (inPlace != nullptr) {
+    // append after everything, so the old archive stays valid until the index is replaced
+    offset = std::max(inPlace->size(), dataStart);
+  }
+  file.seekp(offset);
+
+  // in place updates: data moved away from the space the new index needs,
+  // old offset to new offset
+  std::unordered_map<BSAHash, BSAHash> relocated;
+
+  std::vector<char> buffer(COPY_BUFFER_SIZE);
+  std::vector<BSAUChar> data;
+  std::vector<BSAUChar> packed;
+
+  // writes a block if necessary and returns its offset, packed and unpacked size
+  auto writeBlock = [&](const Entry *entry, size_t block, BSAHash sourceOffset, BSAULong storedLen,
+                        BSAHash &blockOffset, BSAULong &packedLen, BSAULong &unpackedLen) {
+    if ((inPlace != nullptr) && (entry->source == inPlace)) {
+      auto iter = relocated.find(sourceOffset);
+      if (sourceOffset >= dataStart) {
+        blockOffset = sourceOffset;
+        return;
+      }
+      else if (iter != relocated.end()) {
+        blockOffset = iter->second;
+        return;
+      }
+      relocated[sourceOffset] = offset;
+    }
+    if (entry->source != nullptr) {
+      copyData(file, *entry->source, sourceOffset, storedLen, buffer);
+      blockOffset = offset;
+      offset += storedLen;
+      return;
+    }
+    Payload &payload = m_Payloads[entry->payloads[block]];
+    if (!payload.written) {
+      writePayload(file, payload, offset, data, packed);
+      offset += payload.packedLen != 0 ? payload.packedLen : payload.size;
+    }
+    blockOffset = payload.archiveOffset;
+    packedLen = payload.packedLen;
+    unpackedLen = payload.size;
+  };
+
+  for (const Entry *entry : entries) {
+    if (m_Type == TYPE_GENERAL) {
+      Archive::FileEntry record = entry->general;
+      writeBlock(entry, 0, record.offset, storedSize(record),
+                 record.offset, record.packedLen, record.unpackedLen);
+      const char *recordData = reinterpret_cast<const char*>(&record);
+      index.insert(index.end(), recordData, recordData + sizeof(record));
+    }
+    else {
+      Archive::FileEntry_DX10 header = entry->texture;
+      header.numChunks = static_cast<BSAUChar>(entry->chunks.size());
+      header.chunkHdrLen = sizeof(Archive::DX10Chunk);
+      const char *recordData = reinterpret_cast<const char*>(&header);
+      index.insert(index.end(), recordData, recordData + sizeof(header));
+      for (size_t i = 0; i < entry->chunks.size(); ++i) {
+        Archive::DX10Chunk record = entry->chunks[i];
+        writeBlock(entry, i, record.offset, storedSize(record),
+                   record.offset, record.packedLen, record.unpackedLen);
+        recordData = reinterpret_cast<const char*>(&record);
+        index.insert(index.end(), recordData, recordData + sizeof(record));
+      }
+    }
+  }
+
+  for (const Entry *entry : entries) {
+    writeType<BSAUShort>(file, static_cast<BSAUShort>(entry->name.size()));
+    file.write(entry->name.data(), entry->name.size());
+  }
+
+  if (inPlace != nullptr) {
+    // the new index must not refer to data that doesn't survive a crash
+    file.flush();
+    if (!file.fail() && !syncFile(fileName)) {
+      file.setstate(std::ios::failbit);
+    }
+    if (file.fail()) {
+      throw data_invalid_exception(makeString("failed to write %s", fileName));
+    }
+  }
+
+  // counted from what was written, replaced entries and shared payloads included
+  m_StoredCount = 0;
+  for (const Entry *entry : entries) {
+    bool stored = std::all_of(entry->payloads.begin(), entry->payloads.end(), [this](size_t payload) {
+      return m_Payloads[payload].packedLen == 0;
+    });
+    if ((entry->source == nullptr) && stored) {
+      ++m_StoredCount;
+    }
+  }
+
+  file.seekp(0);
+  Archive::writeHeader(file, m_Type, ARCHIVE_VERSION, static_cast<BSAULong>(entries.size()), offset);
+  file.write(index.data(), index.size());
+}
+
+
+void ArchiveWriter::writePayload(std::fstream &file, Payload &payload, BSAHash offset,
+                                 std::vector<BSAUChar> &data, std::vector<BSAUChar> &packed)
+{
+  readPayload(payload, data);
+  // data that doesn't get smaller is stored uncompressed
+  size_t packedLen = (payload.compress && (payload.size > 0))
+      ? Deflater::local().deflate(data.data(), payload.size, packed, m_CompressionLevel) : 0;
+  if ((packedLen != 0) && (packedLen < payload.size)) {
+    file.write(reinterpret_cast<const char*>(packed.data()), packedLen);
+    payload.packedLen = static_cast<BSAULong>(packedLen);
+  }
+  else {
+    file.write(reinterpret_cast<const char*>(data.data()), payload.size);
+    payload.packedLen = 0;
+  }
+  if (file.fail()) {
+    throw data_invalid_exception("failed to write archive data");
+  }
+  payload.archiveOffset = offset;
+  payload.written = true;
+}
+
+
+void ArchiveWriter::copyData(std::fstream &file, const InputFile &source, BSAHash offset,
+                             BSAHash size, std::vector<char> &buffer)
+{
+  while (size > 0) {
+    size_t count = static_cast<size_t>(std::min<BSAHash>(size, buffer.size()));
+    source.readAt(offset, &buffer[0], count);
+    file.write(&buffer[0], count);
+    if (file.fail()) {
+      throw data_invalid_exception("failed to write archive data");
+    }
+    offset += count;
+    size -= count;
+  }
+}
+
+} // namespace BA2
@@ -0,0 +1,303 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_WRITER_H
+#define BA2_WRITER_H
+
+
+#include "errorcodes.h"
+#include "ba2archive.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+namespace BA2 {
+
+  enum ECompressionPolicy {
+    /// compress unless the extension or a sample suggests it doesn't pay off
+    COMPRESSION_ADAPTIVE,
+    /// compress everything that gets smaller
+    COMPRESSION_ALWAYS,
+    /// store everything uncompressed
+    COMPRESSION_NEVER
+  };
+
+  /**
+   * @brief creates archives from loose files, buffers and files of existing archives.
+   * Files copied from other archives keep their data exactly as it's stored,
+   * compressed data is never decompressed or recompressed, so merging archives or
+   * dropping files from one costs little more than copying the bytes.
+   * New content is deduplicated: identical files (or, in texture archives,
+   * identical chunks) are compressed and stored only once and all index records
+   * refer to the same data.
+   *
+   * Files are written in the order they were added unless an order was set
+   * through setOrder. Adding a file with the name
+   * of a file added before replaces it, so when merging, later archives take
+   * precedence. Names are compared case insensitively and '/' is treated like '\'.
+   * Source archives and loose files must stay unchanged until write() returned.
+   */
+  class ArchiveWriter {
+
+  public:
+
+    /**
+     * constructor
+     * @param type type of the archive to create. Files can only be copied from
+     *             archives of the same type
+     */
+    explicit ArchiveWriter(EType type = TYPE_GENERAL);
+
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter &operator=(const ArchiveWriter&) = delete;
+
+    /**
+     * @return type of the archive to create
+     */
+    EType getType() const { return m_Type; }
+
+    /**
+     * copy a file from another archive
+     * @param source archive containing the file
+     * @param index index of the file in the source archive
+     * @param name name of the file in the new archive. If empty, the name in the
+     *             source archive is used
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode addFile(const Archive &source, BSAULong index, const std::string &name = std::string());
+
+    /**
+     * copy all files of another archive
+     * @param source archive to copy from
+     * @param filter optional filter selecting the files to copy
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode addArchive(const Archive &source, const ExtractFilter &filter = ExtractFilter());
+
+    /**
+     * add a file from disk. In texture archives it has to be a dds file, its mip
+     * maps are split into chunks
+     * @param name name of the file in the archive
+     * @param fileName path of the file on disk
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode addLooseFile(const std::string &name, const char *fileName);
+
+    /**
+     * add all files of a directory and its subdirectories. They are named by their
+     * path relative to the directory
+     * @param directory the directory to add
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode addDirectory(const char *directory);
+
+    /**
+     * add a file from memory. In texture archives it has to be a complete dds file.
+     * The buffer is referenced, not copied, and must not be modified afterwards
+     * @param name name of the file in the archive
+     * @param data content of the file
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode addData(const std::string &name, const Archive::DataBuffer &data);
+
+    /**
+     * @param level zlib compression level used for new content
+     */
+    void setCompressionLevel(int level) { m_CompressionLevel = level; }
+
+    /**
+     * set how to decide whether new content is compressed or stored. With
+     * COMPRESSION_ADAPTIVE (the default) files with an extension registered through
+     * addStoredExtension are stored and for other files a sample is compressed
+     * quickly, if that doesn't save enough the file is stored too.
+     * The policy applies to files added afterwards
+     * @param policy the policy
+     */
+    void setCompressionPolicy(ECompressionPolicy policy) { m_CompressionPolicy = policy; }
+
+    /**
+     * register an extension of files that are already compressed and should be
+     * stored by the adaptive policy. Audio (.xwm, .fuz, .wem, .ogg, .mp3), video
+     * (.bk2) and common image and archive formats are registered by default
+     * @param extension the extension including the dot, case insensitive
+     */
+    void addStoredExtension(const std::string &extension);
+
+    /**
+     * @return number of files added as new content that the last write() or
+     *         update() stored uncompressed
+     */
+    BSAULong getStoredCount() const { return m_StoredCount; }
+
+    /**
+     * @return number of files or chunks that were found to duplicate content added before
+     */
+    BSAULong getDuplicateCount() const { return m_DuplicateCount; }
+
+    /**
+     * @return uncompressed size of all duplicates, this much data didn't have to be stored
+     */
+    BSAHash getDuplicateSize() const { return m_DuplicateSize; }
+
+    /**
+     * set the order files are written in. Files are laid out in the order they
+     * appear in names, so files used together end up next to each other and
+     * loading them reads the archive front to back. Files not in the list follow
+     * in the order they were added, names without a file are ignored. The name
+     * table is written in the same order
+     * @param names file names in load order, for example from a list of the files
+     *              a game loads or TraceRecorder::getAccessOrder
+     */
+    void setOrder(const std::vector<std::string> &names) { m_Order = names; }
+
+    /**
+     * remove a file that was added before
+     * @param name name of the file
+     * @return true if the file was found
+     */
+    bool removeFile(const std::string &name);
+
+    /**
+     * @param name name of a file
+     * @return true if a file with this name was added
+     */
+    bool hasFile(const std::string &name) const;
+
+    /**
+     * @return number of files that will be written
+     */
+    BSAULong getFileCount() const { return static_cast<BSAULong>(m_Lookup.size()); }
+
+    /**
+     * write the archive. The output is written to a temporary file next to fileName
+     * which then replaces fileName, so fileName may be one of the source archives
+     * (on systems that allow replacing open files)
+     * @param fileName name of the archive to create
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode write(const char *fileName);
+
+    /**
+     * update an archive in place instead of rewriting it. The writer has to be
+     * filled from target through addArchive/addFile and then changed by adding,
+     * replacing and removing files. Data of files kept from target stays where it
+     * is, everything else is appended, followed by a new name table, and then the
+     * index and header are rewritten. Only if the index grows into the data, the
+     * files stored right after it are moved to the end.
+     * Until the index is rewritten the old archive stays intact. The appended data
+     * is synced to the storage device before the index and header are rewritten
+     * and the file is synced again afterwards, so the new index never refers to
+     * data lost in a crash. The rewrite itself isn't atomic: a crash while it's in
+     * progress can leave a mix of the old and new index, and the archive has to be
+     * restored from elsewhere. Replaced and removed files and old name tables leave
+     * unused space behind, write() to the same file name compacts the archive.
+     * target has to be opened from fileName and must be read again afterwards
+     * @param target the archive to update
+     * @param fileName name of the file target was opened from
+     * @return ERROR_NONE on success or an error code
+     */
+    EErrorCode update(const Archive &target, const char *fileName);
+
+    /**
+     * @return description of the problem encountered by the last failed call
+     */
+    const std::string &getLastError() const { return m_LastError; }
+
+  private:
+
+    // uncompressed new content, read from a file on disk or a buffer
+    struct Payload {
+      std::shared_ptr<const std::string> fileName;
+      Archive::DataBuffer buffer;
+      BSAHash offset = 0;
+      BSAULong size = 0;
+      BSAHash hash = 0;
+      // false if the data is to be stored uncompressed
+      bool compress = false;
+      // location in the archive, set once written
+      bool written = false;
+      BSAHash archiveOffset = 0;
+      BSAULong packedLen = 0;
+    };
+
+    struct Entry {
+      std::string name;
+      bool removed;
+      // file the data is copied from, null for new content
+      const InputFile *source;
+      // index records. For copied files the offsets refer to the source file,
+      // for new content offsets and sizes are set while writing
+      Archive::FileEntry general;
+      Archive::FileEntry_DX10 texture;
+      std::vector<Archive::DX10Chunk> chunks;
+      // new content: one payload for a general file or one per chunk
+      std::vector<size_t> payloads;
+    };
+
+  private:
+
+    static void updateHashes(const std::string &name, Entry &entry);
+
+    EErrorCode addContent(const std::string &name, const Payload &content);
+    void parseTexture(const BSAUChar *data, BSAULong size, Entry &entry,
+                      std::vector<Payload> &chunks) const;
+    bool shouldCompress(const std::string &name, const BSAUChar *data, BSAULong size) const;
+    size_t addPayload(const Payload &payload, const BSAUChar *data);
+    void readPayload(const Payload &payload, std::vector<BSAUChar> &data) const;
+
+    void addEntry(Entry &&entry);
+    static BSAULong storedSize(const Archive::FileEntry &file);
+    static BSAULong storedSize(const Archive::DX10Chunk &chunk);
+
+    // fileName is the name of file. target is the archive that is updated in place
+    // or null if a new archive is written
+    void writeArchive(std::fstream &file, const char *fileName, const Archive *target);
+    void copyData(std::fstream &file, const InputFile &source, BSAHash offset, BSAHash size,
+                  std::vector<char> &buffer);
+    void writePayload(std::fstream &file, Payload &payload, BSAHash offset,
+                      std::vector<BSAUChar> &data, std::vector<BSAUChar> &packed);
+
+  private:
+
+    EType m_Type;
+    int m_CompressionLevel;
+    ECompressionPolicy m_CompressionPolicy;
+    // lower case extensions stored by the adaptive policy
+    std::unordered_set<std::string> m_StoredExtensions;
+    BSAULong m_StoredCount;
+    std::vector<Entry> m_Entries;
+    // PathKey of the name to position in m_Entries
+    std::unordered_map<std::string, size_t> m_Lookup;
+    // requested layout, empty to keep the order files were added in
+    std::vector<std::string> m_Order;
+    std::vector<Payload> m_Payloads;
+    // content hash to positions in m_Payloads
+    std::unordered_multimap<BSAHash, size_t> m_PayloadLookup;
+    BSAULong m_DuplicateCount;
+    BSAHash m_DuplicateSize;
+    std::string m_LastError;
+
+  };
+
+} // namespace BA2
+
+#endif // BA2_WRITER_H
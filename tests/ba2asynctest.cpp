@@ -0,0 +1,94 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2test.h"
+#include "ba2async.h"
+#include <stdexcept>
+
+using namespace BA2;
+
+
+namespace {
+
+void testReturnValue()
+{
+  AsyncOperation operation = AsyncOperation::start([](const std::atomic<bool>&) {
+    return ERROR_FILENOTFOUND;
+  });
+  BA2_CHECK(operation.isValid());
+  BA2_CHECK_EQUAL(operation.wait(), ERROR_FILENOTFOUND);
+  BA2_CHECK(operation.isDone());
+}
+
+
+// the promise has to be fulfilled no matter what the work or the callback throw
+void testExceptions()
+{
+  AsyncOptions options;
+  std::atomic<int> completions(0);
+  options.completion = [&completions](EErrorCode) {
+    ++completions;
+    throw std::runtime_error("completion failed");
+  };
+
+  AsyncOperation failed = AsyncOperation::start([](const std::atomic<bool>&) -> EErrorCode {
+    throw std::runtime_error("work failed");
+  }, options);
+  BA2_CHECK_EQUAL(failed.wait(), ERROR_INVALIDDATA);
+
+  AsyncOperation succeeded = AsyncOperation::start([](const std::atomic<bool>&) {
+    return ERROR_NONE;
+  }, options);
+  BA2_CHECK_EQUAL(succeeded.wait(), ERROR_NONE);
+  BA2_CHECK_EQUAL(completions.load(), 2);
+}
+
+
+void testCancel()
+{
+  // an executor that runs the task only when asked to
+  std::function<void()> pending;
+  AsyncOptions options;
+  options.executor = [&pending](std::function<void()> task) { pending = task; };
+  EErrorCode completed = ERROR_NONE;
+  options.completion = [&completed](EErrorCode result) { completed = result; };
+
+  bool ran = false;
+  AsyncOperation operation = AsyncOperation::start([&ran](const std::atomic<bool>&) {
+    ran = true;
+    return ERROR_NONE;
+  }, options);
+  operation.cancel();
+  BA2_CHECK(!operation.isDone());
+  pending();
+  BA2_CHECK(!ran);
+  BA2_CHECK_EQUAL(completed, ERROR_CANCELED);
+  BA2_CHECK_EQUAL(operation.wait(), ERROR_CANCELED);
+}
+
+} // namespace
+
+
+int main()
+{
+  testReturnValue();
+  testExceptions();
+  testCancel();
+  return testResult("async");
+}
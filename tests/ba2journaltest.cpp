@@ -0,0 +1,137 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2test.h"
+#include "ba2journal.h"
+#include "ba2trace.h"
+#include "ba2writer.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace BA2;
+
+
+namespace {
+
+// journal recording every file of the archive as completed
+void recordAll(const std::string &journalName, const std::string &archiveName, BSAULong fileCount)
+{
+  std::vector<BSAULong> all;
+  for (BSAULong i = 0; i < fileCount; ++i) {
+    all.push_back(i);
+  }
+  ExtractJournal journal;
+  BA2_CHECK(journal.create(journalName, fileCount, std::filesystem::file_size(archiveName), all));
+  journal.close(false);
+}
+
+
+// extracts with the journal and returns the names of the files that were written
+std::vector<std::string> resume(const Archive &archive, const std::string &destination,
+                                const std::string &journalName)
+{
+  TraceRecorder trace;
+  ExtractOptions options;
+  options.journal = journalName;
+  options.trace = &trace;
+  options.threads = 2;
+  BA2_CHECK_EQUAL(archive.extractAll(destination.c_str(), options), ERROR_NONE);
+  BA2_CHECK(!std::filesystem::exists(journalName));
+  return trace.getAccessOrder();
+}
+
+
+std::string readOutput(const TestDirectory &directory, const char *name)
+{
+  std::ifstream file(directory.file(name), std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+
+void testGeneral(const TestDirectory &directory)
+{
+  std::string archiveName = directory.file("general.ba2");
+  std::string journalName = directory.file("general.journal");
+  std::string destination = directory.file("general");
+
+  ArchiveWriter writer(TYPE_GENERAL);
+  std::vector<std::string> contents;
+  for (int i = 0; i < 6; ++i) {
+    contents.push_back(std::string(500 * (i + 1), static_cast<char>('a' + i)));
+    BA2_CHECK_EQUAL(writer.addData("data\\file" + std::to_string(i) + ".txt", makeBuffer(contents.back())),
+                    ERROR_NONE);
+  }
+  BA2_CHECK_EQUAL(writer.write(archiveName.c_str()), ERROR_NONE);
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(archiveName.c_str()), ERROR_NONE);
+  BA2_CHECK_EQUAL(resume(archive, destination, journalName).size(), 6);
+
+  // files the journal lists are only trusted if they have the right size
+  recordAll(journalName, archiveName, archive.getFileCount());
+  std::ofstream(directory.file("general/data/file2.txt"), std::ios::trunc);
+  std::vector<std::string> written = resume(archive, destination, journalName);
+  BA2_CHECK_EQUAL(written.size(), 1);
+  BA2_CHECK(!written.empty() && (written[0] == "data\\file2.txt"));
+  BA2_CHECK(readOutput(directory, "general/data/file2.txt") == contents[2]);
+}
+
+
+// textures in formats a dds header can't be written for are extracted as empty
+// files, which counts as complete
+void testUnsupportedTexture(const TestDirectory &directory)
+{
+  std::string archiveName = directory.file("textures.ba2");
+  std::string journalName = directory.file("textures.journal");
+  std::string destination = directory.file("textures");
+
+  ArchiveWriter writer(TYPE_DX10);
+  BA2_CHECK_EQUAL(writer.addData("textures\\a.dds", makeBuffer(makeTexture(64, 64, 7, 1))), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.addData("textures\\b.dds", makeBuffer(makeTexture(32, 16, 6, 2))), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(archiveName.c_str()), ERROR_NONE);
+
+  // turn the format of the first texture into R16_UNORM
+  {
+    std::fstream file(archiveName, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(24 + 0x15);
+    file.put(static_cast<char>(DXGI_FORMAT_R16_UNORM));
+  }
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(archiveName.c_str()), ERROR_NONE);
+  BA2_CHECK_EQUAL(resume(archive, destination, journalName).size(), 2);
+  std::string unsupported = archive.getFileList()[0];
+  std::replace(unsupported.begin(), unsupported.end(), '\\', '/');
+  BA2_CHECK_EQUAL(std::filesystem::file_size(directory.path() / "textures" / unsupported), 0);
+
+  recordAll(journalName, archiveName, archive.getFileCount());
+  BA2_CHECK(resume(archive, destination, journalName).empty());
+}
+
+} // namespace
+
+
+int main()
+{
+  TestDirectory directory("journal");
+  testGeneral(directory);
+  testUnsupportedTexture(directory);
+  return testResult("journal");
+}
@@ -0,0 +1,193 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2test.h"
+#include "ba2search.h"
+#include "ba2writer.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace BA2;
+
+
+namespace {
+
+const size_t LARGE_SIZE = 2 * 1024 * 1024;
+
+
+bool writeArchive(const std::string &fileName, const std::vector<std::pair<std::string, std::string>> &files)
+{
+  ArchiveWriter writer(TYPE_GENERAL);
+  for (const auto &file : files) {
+    if (writer.addData(file.first, makeBuffer(file.second)) != ERROR_NONE) {
+      return false;
+    }
+  }
+  return writer.write(fileName.c_str()) == ERROR_NONE;
+}
+
+
+// std::regex recurses for every character, a match over the whole entry used to
+// overflow the stack. In a long line it is now split into consecutive matches
+void testRegexLargeEntry(const Archive &archive)
+{
+  ContentSearch search;
+  BA2_CHECK(search.setRegex("a(a|b)*b"));
+  search.addExtension(".bin");
+  for (unsigned int threads : { 1u, 2u }) {
+    BA2_CHECK_EQUAL(search.search(archive, threads), ERROR_NONE);
+    const std::vector<SearchMatch> &matches = search.getMatches();
+    BA2_CHECK(!matches.empty());
+    BSAHash end = 0;
+    for (const SearchMatch &match : matches) {
+      BA2_CHECK_EQUAL(match.offset, end);
+      end = match.offset + match.length;
+    }
+    BA2_CHECK_EQUAL(end, LARGE_SIZE);
+  }
+}
+
+
+void testRegexWindows(const Archive &archive)
+{
+  ContentSearch search;
+  BA2_CHECK(search.setRegex("needle[0-9]"));
+  search.addExtension(".txt");
+  BA2_CHECK_EQUAL(search.search(archive), ERROR_NONE);
+  const std::vector<SearchMatch> &matches = search.getMatches();
+  std::vector<BSAHash> expected = { 1020, 3000, 5010 };
+  BA2_CHECK_EQUAL(matches.size(), expected.size());
+  for (size_t i = 0; i < std::min(matches.size(), expected.size()); ++i) {
+    BA2_CHECK_EQUAL(matches[i].offset, expected[i]);
+    BA2_CHECK_EQUAL(matches[i].length, 7);
+  }
+}
+
+
+void testRegexAnchors(const Archive &archive)
+{
+  ContentSearch search;
+  BA2_CHECK(search.setRegex("^line[0-9]$", true));
+  search.addExtension(".psc");
+  BA2_CHECK_EQUAL(search.search(archive), ERROR_NONE);
+  const std::vector<SearchMatch> &matches = search.getMatches();
+  BA2_CHECK_EQUAL(matches.size(), 2);
+  if (matches.size() == 2) {
+    BA2_CHECK_EQUAL(matches[0].offset, 0);
+    BA2_CHECK_EQUAL(matches[1].offset, 15);
+  }
+}
+
+
+// files without the prefilter are rejected before they are read as a whole
+void testRegexPrefilter(const Archive &archive)
+{
+  ContentSearch search;
+  BA2_CHECK(search.setRegex("needle[0-9]"));
+  search.setPrefilter("needle");
+  BA2_CHECK_EQUAL(search.search(archive, 2), ERROR_NONE);
+  BA2_CHECK_EQUAL(search.getMatches().size(), 3);
+  BA2_CHECK_EQUAL(search.getRejectedCount(), 2);
+
+  BA2_CHECK(search.setRegex("^line[0-9]$", true));
+  search.setPrefilter("LINE");
+  BA2_CHECK_EQUAL(search.search(archive), ERROR_NONE);
+  BA2_CHECK_EQUAL(search.getMatches().size(), 2);
+  BA2_CHECK_EQUAL(search.getRejectedCount(), 2);
+}
+
+
+void testLiteral(const Archive &archive)
+{
+  ContentSearch search;
+  search.setLiteral("NEEDLE", true);
+  BA2_CHECK_EQUAL(search.search(archive, 2), ERROR_NONE);
+  BA2_CHECK_EQUAL(search.getMatches().size(), 3);
+  BA2_CHECK_EQUAL(search.getSearchedCount(), 3);
+}
+
+
+// textures in formats a dds header can't describe are searched without a header
+// instead of failing the search
+void testUnsupportedTexture(const TestDirectory &directory)
+{
+  std::string fileName = directory.file("textures.ba2");
+  std::string texture = makeTexture(32, 32, 6, 1);
+  ArchiveWriter writer(TYPE_DX10);
+  BA2_CHECK_EQUAL(writer.addData("textures\\a.dds", makeBuffer(texture)), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.addData("textures\\b.dds", makeBuffer(texture)), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+
+  // turn the format of the first texture into R16_UNORM
+  {
+    std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(24 + 0x15);
+    file.put(static_cast<char>(DXGI_FORMAT_R16_UNORM));
+  }
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  size_t headerSize = sizeof(BSAULong) + sizeof(DDS_HEADER);
+  ContentSearch search;
+  search.setLiteral(texture.substr(headerSize, 16));
+  BA2_CHECK_EQUAL(search.search(archive, 2), ERROR_NONE);
+  const std::vector<SearchMatch> &matches = search.getMatches();
+  BA2_CHECK_EQUAL(matches.size(), 2);
+  for (const SearchMatch &match : matches) {
+    BSAULong unsupported = 0;
+    BA2_CHECK(archive.findFile("textures\\a.dds", unsupported));
+    BA2_CHECK_EQUAL(match.offset, match.index == unsupported ? 0 : headerSize);
+  }
+}
+
+} // namespace
+
+
+int main()
+{
+  TestDirectory directory("search");
+  std::string fileName = directory.file("search.ba2");
+
+  std::string large;
+  while (large.size() < LARGE_SIZE) {
+    large.append("ab");
+  }
+  // one long line with matches crossing the windows the regular expression is run on
+  std::string windows(6000, 'x');
+  windows.replace(1020, 7, "needle1");
+  windows.replace(3000, 7, "needle2");
+  windows.replace(5010, 7, "needle3");
+
+  BA2_CHECK(writeArchive(fileName, {
+    { "data\\large.bin", large },
+    { "data\\windows.txt", windows },
+    { "scripts\\lines.psc", "line1\nline22 x\nLINE3\nxline4\n" },
+  }));
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  testRegexLargeEntry(archive);
+  testRegexWindows(archive);
+  testRegexAnchors(archive);
+  testRegexPrefilter(archive);
+  testLiteral(archive);
+  testUnsupportedTexture(directory);
+  return testResult("search");
+}
@@ -0,0 +1,172 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BA2_TEST_H
+#define BA2_TEST_H
+
+
+#include "ba2archive.h"
+#include "dds.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+
+namespace BA2 {
+
+  /// number of failed checks, the exit code of a test is 1 if there is any
+  inline int &testFailures()
+  {
+    static int failures = 0;
+    return failures;
+  }
+
+#define BA2_CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++BA2::testFailures(); \
+    } \
+  } while (false)
+
+// for integers and enumerations, both are printed if they differ
+#define BA2_CHECK_EQUAL(actual, expected) \
+  do { \
+    unsigned long long actualValue = static_cast<unsigned long long>(actual); \
+    unsigned long long expectedValue = static_cast<unsigned long long>(expected); \
+    if (actualValue != expectedValue) { \
+      fprintf(stderr, "%s:%d: check failed: %s == %s (%llu != %llu)\n", __FILE__, __LINE__, \
+              #actual, #expected, actualValue, expectedValue); \
+      ++BA2::testFailures(); \
+    } \
+  } while (false)
+
+  /**
+   * @brief a directory for the files of a test, removed with everything in it
+   * when the object is destroyed
+   */
+  class TestDirectory {
+  public:
+    explicit TestDirectory(const char *name)
+    {
+      static std::atomic<int> counter(0);
+      long long stamp = static_cast<long long>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+      m_Path = std::filesystem::temp_directory_path()
+             / (std::string("ba2tk_") + name + "_" + std::to_string(stamp) + "_" + std::to_string(counter++));
+      std::filesystem::create_directories(m_Path);
+    }
+
+    ~TestDirectory()
+    {
+      std::error_code ec;
+      std::filesystem::remove_all(m_Path, ec);
+    }
+
+    TestDirectory(const TestDirectory&) = delete;
+    TestDirectory &operator=(const TestDirectory&) = delete;
+
+    /**
+     * @param name name of a file in the directory
+     * @return the full path of the file
+     */
+    std::string file(const char *name) const { return (m_Path / name).string(); }
+
+    const std::filesystem::path &path() const { return m_Path; }
+
+  private:
+    std::filesystem::path m_Path;
+  };
+
+  /**
+   * @param content bytes to copy
+   * @return a buffer holding a copy of content
+   */
+  inline Archive::DataBuffer makeBuffer(const std::string &content)
+  {
+    std::shared_ptr<unsigned char> buffer(new unsigned char[content.size() + 1],
+                                          array_deleter<unsigned char>());
+    memcpy(buffer.get(), content.data(), content.size());
+    return Archive::DataBuffer(buffer, static_cast<BSAULong>(content.size()));
+  }
+
+  /**
+   * @param width width of the texture in pixels
+   * @param height height of the texture in pixels
+   * @param mips number of mip maps
+   * @param seed varies the pixel data
+   * @return a dds file holding a DXT1 texture
+   */
+  inline std::string makeTexture(BSAULong width, BSAULong height, BSAULong mips, unsigned int seed)
+  {
+    DDS_HEADER header = {};
+    header.dwSize = sizeof(DDS_HEADER);
+    header.dwHeaderFlags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_MIPMAP | DDS_HEADER_FLAGS_LINEARSIZE;
+    header.dwWidth = width;
+    header.dwHeight = height;
+    header.dwMipMapCount = mips;
+    header.ddspf = DDSPF_DXT1;
+    header.dwSurfaceFlags = DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP;
+
+    BSAULong magic = DDS_MAGIC;
+    std::string result(reinterpret_cast<const char*>(&magic), sizeof(magic));
+    result.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    // 8 bytes per block of 4x4 pixels
+    for (BSAULong mip = 0; mip < mips; ++mip) {
+      BSAULong blocksX = (std::max<BSAULong>(1, width >> mip) + 3) / 4;
+      BSAULong blocksY = (std::max<BSAULong>(1, height >> mip) + 3) / 4;
+      for (BSAULong i = 0; i < blocksX * blocksY * 8; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        result.push_back(static_cast<char>(seed >> 16));
+      }
+    }
+    return result;
+  }
+
+  /**
+   * @param buffer a buffer as returned by Archive::readFile
+   * @return the content of the buffer
+   */
+  inline std::string toString(const Archive::DataBuffer &buffer)
+  {
+    return std::string(reinterpret_cast<const char*>(buffer.first.get()), buffer.second);
+  }
+
+  /**
+   * print the result of a test
+   * @param name name of the test
+   * @return the exit code of the test
+   */
+  inline int testResult(const char *name)
+  {
+    if (testFailures() != 0) {
+      fprintf(stderr, "%s: %d checks failed\n", name, testFailures());
+      return 1;
+    }
+    printf("%s: passed\n", name);
+    return 0;
+  }
+
+} // namespace BA2
+
+#endif // BA2_TEST_H
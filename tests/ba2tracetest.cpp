@@ -0,0 +1,78 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2test.h"
+#include "ba2exception.h"
+#include "ba2trace.h"
+#include "ba2writer.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace BA2;
+
+
+int main()
+{
+  TestDirectory directory("trace");
+  std::string archiveName = directory.file("trace.ba2");
+  std::string traceName = directory.file("trace.json");
+
+  ArchiveWriter writer(TYPE_GENERAL);
+  for (int i = 0; i < 8; ++i) {
+    std::string name = "meshes\\trace \"" + std::to_string(i) + "\".nif";
+    BA2_CHECK_EQUAL(writer.addData(name, makeBuffer(std::string(1000 + i, 'x'))), ERROR_NONE);
+  }
+  BA2_CHECK_EQUAL(writer.write(archiveName.c_str()), ERROR_NONE);
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(archiveName.c_str()), ERROR_NONE);
+  TraceRecorder recorder;
+  ExtractOptions options;
+  options.trace = &recorder;
+  options.threads = 2;
+  BA2_CHECK_EQUAL(archive.extractAll(directory.file("output").c_str(), options), ERROR_NONE);
+  BA2_CHECK(recorder.writeChromeTrace(traceName.c_str()));
+
+  // what is read back has to give the same order the recording gives
+  TraceRecorder loaded;
+  BA2_CHECK(loaded.readChromeTrace(traceName.c_str()));
+  std::vector<std::string> expected = recorder.getAccessOrder();
+  BA2_CHECK_EQUAL(expected.size(), 8);
+  BA2_CHECK(loaded.getAccessOrder() == expected);
+  BA2_CHECK_EQUAL(loaded.getSpans().size(), recorder.getSpans().size());
+
+  std::string brokenName = directory.file("broken.json");
+  std::ofstream(brokenName) << "{\"traceEvents\":[{\"name\":\"entry\",";
+  BA2_CHECK(!loaded.readChromeTrace(brokenName.c_str()));
+  BA2_CHECK(!loaded.readChromeTrace(directory.file("missing.json").c_str()));
+  BA2_CHECK(loaded.getAccessOrder() == expected);
+
+  // unknown values are skipped, but not nested deeper than the reader allows
+  std::string nestedName = directory.file("nested.json");
+  std::ofstream(nestedName) << "{\"other\":" << std::string(100000, '[') << std::string(100000, ']')
+                            << ",\"traceEvents\":[]}";
+  BA2_CHECK(!loaded.readChromeTrace(nestedName.c_str()));
+  std::ofstream(nestedName) << "{\"other\":[[{\"a\":[1,2]}]],\"traceEvents\":[]}";
+  BA2_CHECK(loaded.readChromeTrace(nestedName.c_str()));
+
+  BA2_CHECK(makeJSONString("a\"b\\c\n\x01") == "\"a\\\"b\\\\c\\n\\u0001\"");
+
+  return testResult("trace");
+}
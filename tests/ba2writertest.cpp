@@ -0,0 +1,378 @@
+/*
+Vortex BA2 handling
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "ba2test.h"
+#include "ba2writer.h"
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace BA2;
+
+
+namespace {
+
+typedef std::map<std::string, std::string> Contents;
+
+
+std::string randomData(size_t size, unsigned int seed)
+{
+  std::string result(size, '\0');
+  for (char &ch : result) {
+    seed = seed * 1103515245u + 12345u;
+    ch = static_cast<char>(seed >> 16);
+  }
+  return result;
+}
+
+
+std::string textData(size_t size, const std::string &word)
+{
+  std::string result;
+  while (result.size() < size) {
+    result.append(word).append(" ").append(std::to_string(result.size() % 97)).append("\n");
+  }
+  result.resize(size);
+  return result;
+}
+
+
+EErrorCode addAll(ArchiveWriter &writer, const Contents &contents)
+{
+  for (const auto &file : contents) {
+    EErrorCode error = writer.addData(file.first, makeBuffer(file.second));
+    if (error != ERROR_NONE) {
+      return error;
+    }
+  }
+  return ERROR_NONE;
+}
+
+
+// reads every file of the archive back, by name and by index
+void checkGeneral(const std::string &fileName, const Contents &contents)
+{
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  BA2_CHECK_EQUAL(archive.getType(), TYPE_GENERAL);
+  BA2_CHECK_EQUAL(archive.getFileCount(), contents.size());
+  for (const auto &file : contents) {
+    Archive::DataBuffer buffer;
+    BSAULong index = 0;
+    BA2_CHECK(archive.findFile(file.first, index));
+    BA2_CHECK_EQUAL(archive.readFile(file.first, buffer), ERROR_NONE);
+    if (toString(buffer) != file.second) {
+      fprintf(stderr, "content of %s differs\n", file.first.c_str());
+      BA2_CHECK(toString(buffer) == file.second);
+    }
+    BA2_CHECK_EQUAL(archive.readFile(index, buffer), ERROR_NONE);
+    BA2_CHECK(toString(buffer) == file.second);
+  }
+}
+
+
+void testGeneral(const TestDirectory &directory)
+{
+  Contents contents = {
+    { "meshes\\text.nif", textData(300000, "vertex") },
+    { "meshes\\random.nif", randomData(200000, 1) },
+    { "meshes\\copy of text.nif", textData(300000, "vertex") },
+    { "sound\\voice.fuz", randomData(5000, 2) },
+    { "scripts\\empty.pex", std::string() },
+    { "scripts\\tiny.pex", "x" },
+  };
+
+  for (ECompressionPolicy policy : { COMPRESSION_ADAPTIVE, COMPRESSION_ALWAYS, COMPRESSION_NEVER }) {
+    std::string fileName = directory.file(("general" + std::to_string(policy) + ".ba2").c_str());
+    ArchiveWriter writer(TYPE_GENERAL);
+    writer.setCompressionPolicy(policy);
+    BA2_CHECK_EQUAL(addAll(writer, contents), ERROR_NONE);
+    BA2_CHECK_EQUAL(writer.getFileCount(), contents.size());
+    BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+    // the copy is stored once
+    BA2_CHECK_EQUAL(writer.getDuplicateCount(), 1);
+    // random data, the empty file and the one that doesn't get smaller are stored
+    BA2_CHECK_EQUAL(writer.getStoredCount(), policy == COMPRESSION_NEVER ? contents.size() : 4);
+    checkGeneral(fileName, contents);
+
+    Archive archive;
+    BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+    BSAULong text = 0;
+    BSAULong random = 0;
+    BA2_CHECK(archive.findFile("MESHES/TEXT.NIF", text));
+    BA2_CHECK(archive.findFile("meshes\\random.nif", random));
+    FileInfo textInfo;
+    FileInfo randomInfo;
+    BA2_CHECK(archive.getFileInfo(text, textInfo) && archive.getFileInfo(random, randomInfo));
+    BA2_CHECK_EQUAL(textInfo.compressed, policy != COMPRESSION_NEVER);
+    BA2_CHECK_EQUAL(randomInfo.compressed, false);
+  }
+
+  // only files that end up in the archive count
+  std::string fileName = directory.file("general replaced.ba2");
+  ArchiveWriter writer(TYPE_GENERAL);
+  BA2_CHECK_EQUAL(writer.addData("meshes\\a.nif", makeBuffer(randomData(5000, 3))), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.addData("meshes\\a.nif", makeBuffer(textData(5000, "text"))), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.getStoredCount(), 0);
+}
+
+
+void testTextures(const TestDirectory &directory)
+{
+  std::string fileName = directory.file("textures.ba2");
+  Contents contents = {
+    { "textures\\large.dds", makeTexture(512, 256, 10, 1) },
+    { "textures\\small.dds", makeTexture(16, 16, 5, 2) },
+    { "textures\\odd.dds", makeTexture(20, 12, 1, 3) },
+  };
+  ArchiveWriter writer(TYPE_DX10);
+  BA2_CHECK_EQUAL(addAll(writer, contents), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  BA2_CHECK_EQUAL(archive.getType(), TYPE_DX10);
+  BA2_CHECK_EQUAL(archive.getFileCount(), contents.size());
+  size_t headerSize = sizeof(BSAULong) + sizeof(DDS_HEADER);
+  for (const auto &file : contents) {
+    // the dds header is generated from the index, the pixel data has to match
+    Archive::DataBuffer buffer;
+    BA2_CHECK_EQUAL(archive.readFile(file.first, buffer), ERROR_NONE);
+    std::string extracted = toString(buffer);
+    BA2_CHECK_EQUAL(extracted.size(), file.second.size());
+    BA2_CHECK(extracted.compare(headerSize, std::string::npos, file.second, headerSize, std::string::npos) == 0);
+
+    DDS_HEADER original;
+    DDS_HEADER header;
+    memcpy(&original, file.second.data() + sizeof(BSAULong), sizeof(DDS_HEADER));
+    memcpy(&header, extracted.data() + sizeof(BSAULong), sizeof(DDS_HEADER));
+    BA2_CHECK_EQUAL(header.dwWidth, original.dwWidth);
+    BA2_CHECK_EQUAL(header.dwHeight, original.dwHeight);
+    BA2_CHECK_EQUAL(header.dwMipMapCount, original.dwMipMapCount);
+    BA2_CHECK_EQUAL(header.ddspf.dwFourCC, original.ddspf.dwFourCC);
+
+    BSAULong index = 0;
+    BSAULong width = 0;
+    BSAULong height = 0;
+    BA2_CHECK(archive.findFile(file.first, index));
+    BA2_CHECK_EQUAL(archive.decodeTexture(index, 0, buffer, width, height), ERROR_NONE);
+    BA2_CHECK_EQUAL(width, original.dwWidth);
+    BA2_CHECK_EQUAL(height, original.dwHeight);
+    BA2_CHECK_EQUAL(buffer.second, width * height * 4);
+  }
+
+  // copying textures into a new archive keeps them intact
+  std::string copyName = directory.file("textures copy.ba2");
+  ArchiveWriter copy(TYPE_DX10);
+  BA2_CHECK_EQUAL(copy.addArchive(archive), ERROR_NONE);
+  BA2_CHECK_EQUAL(copy.write(copyName.c_str()), ERROR_NONE);
+  Archive copied;
+  BA2_CHECK_EQUAL(copied.read(copyName.c_str()), ERROR_NONE);
+  for (const auto &file : contents) {
+    Archive::DataBuffer expected;
+    Archive::DataBuffer buffer;
+    BA2_CHECK_EQUAL(archive.readFile(file.first, expected), ERROR_NONE);
+    BA2_CHECK_EQUAL(copied.readFile(file.first, buffer), ERROR_NONE);
+    BA2_CHECK(toString(buffer) == toString(expected));
+  }
+}
+
+
+// mip sizes are computed by shifting the dimensions, more mip maps than a full
+// chain has would shift by 32 or more
+void testOversizedMips(const TestDirectory &directory)
+{
+  std::string fileName = directory.file("mips.ba2");
+  ArchiveWriter writer(TYPE_DX10);
+  BA2_CHECK_EQUAL(writer.addData("textures\full.dds", makeBuffer(makeTexture(16, 16, 5, 4))), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+
+  {
+    Archive archive;
+    BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+    BSAULong width = 0;
+    BSAULong height = 0;
+    Archive::DataBuffer buffer;
+    BA2_CHECK_EQUAL(archive.decodeTexture(0, 4, buffer, width, height), ERROR_NONE);
+    BA2_CHECK_EQUAL(width, 1);
+    BA2_CHECK_EQUAL(archive.findMip(0, 0), 4);
+  }
+
+  {
+    std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(24 + 0x14);
+    file.put(static_cast<char>(40));
+  }
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_INVALIDDATA);
+}
+
+
+// the writer computes the chunk layout from the mip count of the dds header
+void testOversizedDDSMips()
+{
+  std::string texture = makeTexture(16, 16, 5, 5);
+  DDS_HEADER header;
+  memcpy(&header, texture.data() + sizeof(BSAULong), sizeof(DDS_HEADER));
+  header.dwMipMapCount = 40;
+  memcpy(&texture[sizeof(BSAULong)], &header, sizeof(DDS_HEADER));
+
+  ArchiveWriter writer(TYPE_DX10);
+  BA2_CHECK_EQUAL(writer.addData("textures\\mips.dds", makeBuffer(texture)), ERROR_INVALIDDATA);
+  BA2_CHECK_EQUAL(writer.getFileCount(), 0);
+}
+
+
+// opens fileName, applies change and updates the archive in place
+template <typename Change>
+void update(const std::string &fileName, Change change)
+{
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  ArchiveWriter writer(archive.getType());
+  BA2_CHECK_EQUAL(writer.addArchive(archive), ERROR_NONE);
+  change(writer);
+  BA2_CHECK_EQUAL(writer.update(archive, fileName.c_str()), ERROR_NONE);
+}
+
+
+void testUpdate(const TestDirectory &directory)
+{
+  std::string fileName = directory.file("update.ba2");
+  Contents contents = {
+    { "meshes\\a.nif", textData(40000, "first") },
+    { "meshes\\b.nif", randomData(30000, 4) },
+    { "meshes\\c.nif", textData(20000, "third") },
+  };
+  ArchiveWriter writer(TYPE_GENERAL);
+  BA2_CHECK_EQUAL(addAll(writer, contents), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+
+  // replace, remove and add files
+  update(fileName, [&contents](ArchiveWriter &writer) {
+    contents["meshes\\a.nif"] = textData(80000, "replaced");
+    BA2_CHECK_EQUAL(writer.addData("meshes\\a.nif", makeBuffer(contents["meshes\\a.nif"])), ERROR_NONE);
+    BA2_CHECK(writer.removeFile("meshes\\b.nif"));
+    contents.erase("meshes\\b.nif");
+    contents["meshes\\d.nif"] = randomData(1000, 5);
+    BA2_CHECK_EQUAL(writer.addData("meshes\\d.nif", makeBuffer(contents["meshes\\d.nif"])), ERROR_NONE);
+  });
+  checkGeneral(fileName, contents);
+
+  // enough new files to grow the index into the data of the first files, which
+  // have to be moved
+  update(fileName, [&contents](ArchiveWriter &writer) {
+    for (int i = 0; i < 300; ++i) {
+      std::string name = "meshes\\new\\file" + std::to_string(i) + ".nif";
+      contents[name] = textData(100 + i, name);
+      BA2_CHECK_EQUAL(writer.addData(name, makeBuffer(contents[name])), ERROR_NONE);
+    }
+  });
+  checkGeneral(fileName, contents);
+
+  // writing to the same name compacts the archive
+  BSAHash updatedSize = std::filesystem::file_size(fileName);
+  {
+    Archive archive;
+    BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+    ArchiveWriter compact(TYPE_GENERAL);
+    BA2_CHECK_EQUAL(compact.addArchive(archive), ERROR_NONE);
+    BA2_CHECK_EQUAL(compact.write(fileName.c_str()), ERROR_NONE);
+  }
+  BA2_CHECK(std::filesystem::file_size(fileName) < updatedSize);
+  checkGeneral(fileName, contents);
+}
+
+
+// a loose file that disappears before the archive is written makes writing fail.
+// Neither the temporary file nor data appended by update may be left behind
+void testFailedWrites(const TestDirectory &directory)
+{
+  std::string fileName = directory.file("failed.ba2");
+  Contents contents = { { "meshes\\kept.nif", textData(5000, "kept") } };
+  ArchiveWriter writer(TYPE_GENERAL);
+  BA2_CHECK_EQUAL(addAll(writer, contents), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+  BSAHash size = std::filesystem::file_size(fileName);
+
+  std::string looseName = directory.file("loose.nif");
+  std::ofstream(looseName, std::ios::binary) << randomData(20000, 8);
+
+  ArchiveWriter rewrite(TYPE_GENERAL);
+  BA2_CHECK_EQUAL(rewrite.addLooseFile("meshes\\loose.nif", looseName.c_str()), ERROR_NONE);
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  ArchiveWriter updater(TYPE_GENERAL);
+  BA2_CHECK_EQUAL(updater.addArchive(archive), ERROR_NONE);
+  BA2_CHECK_EQUAL(updater.addLooseFile("meshes\\loose.nif", looseName.c_str()), ERROR_NONE);
+
+  std::filesystem::remove(looseName);
+  BA2_CHECK_EQUAL(rewrite.write(fileName.c_str()), ERROR_INVALIDDATA);
+  BA2_CHECK(!std::filesystem::exists(fileName + ".tmp"));
+  BA2_CHECK_EQUAL(updater.update(archive, fileName.c_str()), ERROR_INVALIDDATA);
+  archive.close();
+  BA2_CHECK_EQUAL(std::filesystem::file_size(fileName), size);
+  checkGeneral(fileName, contents);
+}
+
+
+void testUpdateTextures(const TestDirectory &directory)
+{
+  std::string fileName = directory.file("update textures.ba2");
+  ArchiveWriter writer(TYPE_DX10);
+  std::string first = makeTexture(64, 64, 7, 6);
+  std::string second = makeTexture(128, 32, 8, 7);
+  BA2_CHECK_EQUAL(writer.addData("textures\\first.dds", makeBuffer(first)), ERROR_NONE);
+  BA2_CHECK_EQUAL(writer.write(fileName.c_str()), ERROR_NONE);
+
+  update(fileName, [&second](ArchiveWriter &writer) {
+    BA2_CHECK_EQUAL(writer.addData("textures\\second.dds", makeBuffer(second)), ERROR_NONE);
+  });
+
+  Archive archive;
+  BA2_CHECK_EQUAL(archive.read(fileName.c_str()), ERROR_NONE);
+  BA2_CHECK_EQUAL(archive.getFileCount(), 2);
+  size_t headerSize = sizeof(BSAULong) + sizeof(DDS_HEADER);
+  for (const auto &file : Contents{ { "textures\\first.dds", first }, { "textures\\second.dds", second } }) {
+    Archive::DataBuffer buffer;
+    BA2_CHECK_EQUAL(archive.readFile(file.first, buffer), ERROR_NONE);
+    std::string extracted = toString(buffer);
+    BA2_CHECK(extracted.size() == file.second.size()
+              && (extracted.compare(headerSize, std::string::npos, file.second, headerSize, std::string::npos) == 0));
+  }
+}
+
+} // namespace
+
+
+int main()
+{
+  TestDirectory directory("writer");
+  testGeneral(directory);
+  testTextures(directory);
+  testOversizedMips(directory);
+  testOversizedDDSMips();
+  testUpdate(directory);
+  testUpdateTextures(directory);
+  testFailedWrites(directory);
+  return testResult("writer");
+}